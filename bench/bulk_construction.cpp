@@ -0,0 +1,57 @@
+#include "common.h"
+#include <apolo/bulk_construction.h>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+    // Startup of a service with this many scripts that each build a small table at load time
+    constexpr std::size_t SCRIPTS = 1000;
+
+    const char* const SOURCE =
+        "local config = {} for i = 1, 50 do config[i] = { id = i, weight = i * 2 } end "
+        "function handle(x) return config[x % 50 + 1].weight + twice(x) end";
+
+    std::vector<apolo::script_definition> definitions()
+    {
+        auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_free_function("twice", [](double x) { return 2 * x; });
+        return std::vector<apolo::script_definition>(SCRIPTS, {"bench", bench::S(SOURCE), {}, registry});
+    }
+
+    void report_startup(std::chrono::steady_clock::duration duration, std::size_t iterations)
+    {
+        const double seconds = std::chrono::duration<double>(duration).count();
+        bench::report("ms per startup", seconds * 1000 / static_cast<double>(iterations));
+        bench::report("scripts per second", static_cast<double>(iterations * SCRIPTS) / seconds);
+    }
+}
+
+BENCHMARK(bulk_construction, sequential)
+{
+    const auto scripts = definitions();
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        std::vector<std::unique_ptr<apolo::script>> results;
+        results.reserve(scripts.size());
+        for (const auto& definition : scripts)
+        {
+            results.push_back(std::make_unique<apolo::script>(definition.name, definition.buffer, definition.config, definition.registry));
+        }
+        bench::do_not_optimize(results);
+    }
+    report_startup(std::chrono::steady_clock::now() - start, iterations);
+}
+
+BENCHMARK(bulk_construction, parallel)
+{
+    const auto scripts = definitions();
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(apolo::construct_scripts(scripts));
+    }
+    report_startup(std::chrono::steady_clock::now() - start, iterations);
+    bench::report("threads", std::max(1u, std::thread::hardware_concurrency()));
+}
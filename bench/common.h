@@ -0,0 +1,52 @@
+#include <apolo/apolo.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    // A benchmark runs its body \a iterations times
+    using benchmark_function = std::function<void(std::size_t iterations)>;
+
+    // Registers a benchmark; use the BENCHMARK macro instead
+    bool register_benchmark(std::string name, benchmark_function function);
+
+    // Prevents the compiler from optimizing away a computed value
+    template <typename T>
+    inline void do_not_optimize(const T& value)
+    {
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    // Convenience method for turning a string into a character vector
+    inline std::vector<char> S(const std::string& str)
+    {
+        return {str.begin(), str.end()};
+    }
+
+    // Creates a raw Lua state with the standard libraries, runs \a code in it and leaves the results on the stack.
+    // This is the baseline that apolo's overhead is measured against.
+    apolo::detail::lua_state_ptr raw_state(const char* code);
+
+    // Calls the function on top of the stack of a raw Lua state, with \a nargs arguments and one result
+    void raw_call(lua_State* state, int nargs);
+
+    // Reports an additional measurement of the running benchmark, such as memory use, printed below its time
+    void report(const std::string& metric, double value);
+
+    // Returns the number of bytes allocated on the heap, or 0 where this isn't available
+    std::size_t heap_size();
+}
+
+// Defines a benchmark named "group.name". The body runs the measured code 'iterations' times.
+#define BENCHMARK(group, name) \
+    static void bench_##group##_##name(std::size_t iterations); \
+    static const bool bench_##group##_##name##_registered = \
+        bench::register_benchmark(#group "." #name, &bench_##group##_##name); \
+    static void bench_##group##_##name(std::size_t iterations)
@@ -0,0 +1,74 @@
+#include "common.h"
+#include <vector>
+
+namespace
+{
+    // Each iteration runs this many coroutines that each yield this many times
+    constexpr int COROUTINES = 100;
+    constexpr int YIELDS = 10;
+
+    const char* const WORKER = "function worker(n) local s = 0 for i = 1, n do s = s + i yield() end return s end";
+}
+
+BENCHMARK(executor, yielding_coroutines)
+{
+    apolo::script script("bench", bench::S(WORKER));
+    std::vector<std::future<apolo::value>> futures;
+    futures.reserve(COROUTINES);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::cooperative_executor executor;
+        futures.clear();
+        for (int c = 0; c < COROUTINES; ++c)
+        {
+            futures.push_back(script.call_async(executor, "worker", YIELDS));
+        }
+        executor.run();
+        for (auto& future : futures)
+        {
+            bench::do_not_optimize(future.get());
+        }
+    }
+}
+
+BENCHMARK(executor, yielding_coroutines_raw)
+{
+    auto state = bench::raw_state((std::string("yield = coroutine.yield ") + WORKER).c_str());
+    std::vector<std::pair<lua_State*, int>> threads;
+    threads.reserve(COROUTINES);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        for (int c = 0; c < COROUTINES; ++c)
+        {
+            lua_State* thread = lua_newthread(state.get());
+            threads.emplace_back(thread, luaL_ref(state.get(), LUA_REGISTRYINDEX));
+            lua_getglobal(thread, "worker");
+            lua_pushinteger(thread, YIELDS);
+        }
+
+        // Round-robin until all threads are done
+        while (!threads.empty())
+        {
+            for (std::size_t t = 0; t < threads.size();)
+            {
+                auto [thread, ref] = threads[t];
+                const int nargs = (lua_status(thread) == LUA_OK) ? 1 : 0;
+                switch (lua_resume(thread, nullptr, nargs))
+                {
+                case LUA_YIELD:
+                    lua_settop(thread, 0);
+                    ++t;
+                    break;
+                case LUA_OK:
+                    bench::do_not_optimize(lua_tointeger(thread, -1));
+                    luaL_unref(state.get(), LUA_REGISTRYINDEX, ref);
+                    threads[t] = threads.back();
+                    threads.pop_back();
+                    break;
+                default:
+                    throw std::runtime_error(lua_tostring(thread, -1));
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#include "common.h"
+#include <apolo/expression_set.h>
+#include <chrono>
+
+//
+// An expression evaluated over columns of 1k to 10M rows with expression_set::test_batch and
+// evaluate_batch, compared with a call of expression_set::test per row. The columns are built
+// once and shared; every benchmark reports its time per row.
+//
+
+namespace
+{
+    constexpr std::size_t MAX_ROWS = 10'000'000;
+
+    struct columns
+    {
+        std::vector<float> prices;
+        std::vector<int> quantities;
+        std::vector<std::string_view> regions;
+    };
+
+    const columns& data()
+    {
+        static const columns result = [] {
+            columns columns;
+            columns.prices.resize(MAX_ROWS);
+            columns.quantities.resize(MAX_ROWS);
+            columns.regions.resize(MAX_ROWS);
+            for (std::size_t i = 0; i < MAX_ROWS; ++i)
+            {
+                columns.prices[i] = static_cast<float>(i % 97) * 0.5f;
+                columns.quantities[i] = static_cast<int>(i % 13);
+                columns.regions[i] = (i % 3 == 0) ? "EU" : "US";
+            }
+            return columns;
+        }();
+        return result;
+    }
+
+    // Runs a function over all rows 'iterations' times, and reports the time per row
+    template <typename Function>
+    void run(std::size_t iterations, std::size_t rows, Function function)
+    {
+        data();
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            function();
+        }
+        const std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+        bench::report("ns per row", duration.count() / static_cast<double>(iterations * rows));
+    }
+
+    void test_batch(std::size_t iterations, std::size_t rows)
+    {
+        apolo::expression_set set({"price", "quantity"});
+        const auto expression = set.add("price > 10 and quantity < 5");
+        std::vector<std::uint64_t> selection((rows + 63) / 64);
+        run(iterations, rows, [&] {
+            set.test_batch(expression, {data().prices, data().quantities}, rows, selection);
+            bench::do_not_optimize(selection.front());
+        });
+    }
+}
+
+BENCHMARK(expression_batch, test_1k)
+{
+    test_batch(iterations, 1'000);
+}
+
+BENCHMARK(expression_batch, test_100k)
+{
+    test_batch(iterations, 100'000);
+}
+
+BENCHMARK(expression_batch, test_1m)
+{
+    test_batch(iterations, 1'000'000);
+}
+
+BENCHMARK(expression_batch, test_10m)
+{
+    test_batch(iterations, 10'000'000);
+}
+
+BENCHMARK(expression_batch, test_strings_1m)
+{
+    constexpr std::size_t rows = 1'000'000;
+    apolo::expression_set set({"price", "region"});
+    const auto expression = set.add(R"(price > 10 and region == "EU")");
+    std::vector<std::uint64_t> selection((rows + 63) / 64);
+    run(iterations, rows, [&] {
+        set.test_batch(expression, {data().prices, data().regions}, rows, selection);
+        bench::do_not_optimize(selection.front());
+    });
+}
+
+BENCHMARK(expression_batch, evaluate_1m)
+{
+    constexpr std::size_t rows = 1'000'000;
+    apolo::expression_set set({"price", "quantity"});
+    const auto expression = set.add("price * quantity * 0.9");
+    std::vector<double> results(rows);
+    run(iterations, rows, [&] {
+        set.evaluate_batch(expression, {data().prices, data().quantities}, rows, results);
+        bench::do_not_optimize(results.front());
+    });
+}
+
+BENCHMARK(expression_batch, test_per_row_1m)
+{
+    constexpr std::size_t rows = 1'000'000;
+    apolo::expression_set set({"price", "quantity"});
+    const auto expression = set.add("price > 10 and quantity < 5");
+    std::vector<std::uint64_t> selection((rows + 63) / 64);
+    run(iterations, rows, [&] {
+        for (std::size_t i = 0; i < rows; ++i)
+        {
+            if (set.test(expression, data().prices[i], data().quantities[i]))
+            {
+                selection[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+        }
+        bench::do_not_optimize(selection.front());
+    });
+}
@@ -0,0 +1,84 @@
+#include "common.h"
+#include <apolo/expression_set.h>
+#include <memory>
+
+//
+// Many small rule expressions: compiled into an expression_set, compared with a script per
+// expression. Memory per expression is measured as the growth of the heap for 1000 expressions.
+//
+
+namespace
+{
+    constexpr int EXPRESSIONS = 1000;
+
+    std::string make_expression(int i)
+    {
+        return "price > " + std::to_string(i) + " and region == \"EU\"";
+    }
+}
+
+BENCHMARK(expression_set, construct)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const auto heap = bench::heap_size();
+        apolo::expression_set set({"price", "region"});
+        const auto empty = set.memory();
+        for (int j = 0; j < EXPRESSIONS; ++j)
+        {
+            set.add(make_expression(j));
+        }
+        if (i == 0)
+        {
+            bench::report("bytes per expression (heap)", static_cast<double>(bench::heap_size() - heap) / EXPRESSIONS);
+            bench::report("bytes per expression (Lua)", static_cast<double>(set.memory() - empty) / EXPRESSIONS);
+        }
+    }
+}
+
+BENCHMARK(expression_set, construct_scripts)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const auto heap = bench::heap_size();
+        std::vector<std::unique_ptr<apolo::script>> scripts;
+        for (int j = 0; j < EXPRESSIONS; ++j)
+        {
+            const auto code = "function test(price, region) return " + make_expression(j) + " end";
+            scripts.push_back(std::make_unique<apolo::script>("bench", bench::S(code)));
+        }
+        if (i == 0)
+        {
+            bench::report("bytes per expression (heap)", static_cast<double>(bench::heap_size() - heap) / EXPRESSIONS);
+        }
+    }
+}
+
+BENCHMARK(expression_set, test)
+{
+    apolo::expression_set set({"price", "region"});
+    const auto expression = set.add(make_expression(10));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(set.test(expression, static_cast<double>(i & 31), "EU"));
+    }
+}
+
+BENCHMARK(expression_set, evaluate)
+{
+    apolo::expression_set set({"price", "region"});
+    const auto expression = set.add(make_expression(10));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(set.evaluate(expression, static_cast<double>(i & 31), "EU"));
+    }
+}
+
+BENCHMARK(expression_set, test_script)
+{
+    apolo::script script("bench", bench::S("function test(price, region) return " + make_expression(10) + " end"));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(script.call("test", static_cast<double>(i & 31), "EU"));
+    }
+}
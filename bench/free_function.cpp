@@ -0,0 +1,80 @@
+#include "common.h"
+
+namespace
+{
+    // Calls a native function n times from Lua, so the trampoline dominates
+    const char* const LOOP_INTEGER = "function loop(n) local s = 0 for i = 1, n do s = native(i) end return s end";
+    const char* const LOOP_STRING = "function loop(n) local s = 0 for i = 1, n do s = native('Hello World') end return s end";
+    const char* const LOOP_VARARGS = "function loop(n) local s = 0 for i = 1, n do s = native(i, 2.5, 'x', true) end return s end";
+
+    int raw_integer(lua_State* state)
+    {
+        lua_pushinteger(state, luaL_checkinteger(state, 1) + 1);
+        return 1;
+    }
+
+    int raw_string(lua_State* state)
+    {
+        std::size_t size;
+        luaL_checklstring(state, 1, &size);
+        lua_pushinteger(state, static_cast<lua_Integer>(size));
+        return 1;
+    }
+
+    int raw_varargs(lua_State* state)
+    {
+        lua_pushinteger(state, lua_gettop(state));
+        return 1;
+    }
+
+    void run_apolo(const char* code, std::shared_ptr<apolo::type_registry> registry, std::size_t iterations)
+    {
+        apolo::script script("bench", bench::S(code), std::move(registry));
+        bench::do_not_optimize(script.call("loop", iterations));
+    }
+
+    void run_raw(const char* code, lua_CFunction function, std::size_t iterations)
+    {
+        auto state = bench::raw_state(code);
+        lua_register(state.get(), "native", function);
+        lua_getglobal(state.get(), "loop");
+        lua_pushinteger(state.get(), static_cast<lua_Integer>(iterations));
+        bench::raw_call(state.get(), 1);
+    }
+}
+
+BENCHMARK(free_function, integer_argument)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("native", [](int x) { return x + 1; });
+    run_apolo(LOOP_INTEGER, registry, iterations);
+}
+
+BENCHMARK(free_function, integer_argument_raw)
+{
+    run_raw(LOOP_INTEGER, &raw_integer, iterations);
+}
+
+BENCHMARK(free_function, string_argument)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("native", [](const std::string& x) { return x.size(); });
+    run_apolo(LOOP_STRING, registry, iterations);
+}
+
+BENCHMARK(free_function, string_argument_raw)
+{
+    run_raw(LOOP_STRING, &raw_string, iterations);
+}
+
+BENCHMARK(free_function, variable_arguments)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("native", [](std::vector<apolo::value> args) { return args.size(); });
+    run_apolo(LOOP_VARARGS, registry, iterations);
+}
+
+BENCHMARK(free_function, variable_arguments_raw)
+{
+    run_raw(LOOP_VARARGS, &raw_varargs, iterations);
+}
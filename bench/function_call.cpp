@@ -0,0 +1,61 @@
+#include "common.h"
+
+namespace
+{
+    const char* const ADD = "function add(x, y) return x + y end";
+}
+
+BENCHMARK(function_call, call)
+{
+    apolo::script script("bench", bench::S(ADD));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(script.call("add", 1, 2));
+    }
+}
+
+BENCHMARK(function_call, call_async)
+{
+    apolo::script script("bench", bench::S(ADD));
+    apolo::cooperative_executor executor;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto future = script.call_async(executor, "add", 1, 2);
+        executor.run();
+        bench::do_not_optimize(future.get());
+    }
+}
+
+BENCHMARK(function_call, call_raw_pcall)
+{
+    auto state = bench::raw_state(ADD);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        lua_getglobal(state.get(), "add");
+        lua_pushinteger(state.get(), 1);
+        lua_pushinteger(state.get(), 2);
+        bench::raw_call(state.get(), 2);
+        bench::do_not_optimize(lua_tointeger(state.get(), -1));
+        lua_pop(state.get(), 1);
+    }
+}
+
+// Equivalent to what call() does: run the function in a new, referenced coroutine
+BENCHMARK(function_call, call_raw_coroutine)
+{
+    auto state = bench::raw_state(ADD);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        lua_State* thread = lua_newthread(state.get());
+        int ref = luaL_ref(state.get(), LUA_REGISTRYINDEX);
+        lua_getglobal(thread, "add");
+        lua_pushinteger(thread, 1);
+        lua_pushinteger(thread, 2);
+        if (lua_resume(thread, nullptr, 2) != LUA_OK)
+        {
+            throw std::runtime_error(lua_tostring(thread, -1));
+        }
+        bench::do_not_optimize(lua_tointeger(thread, -1));
+        luaL_unref(state.get(), LUA_REGISTRYINDEX, ref);
+    }
+}
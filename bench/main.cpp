@@ -0,0 +1,101 @@
+#include "common.h"
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    // Minimum time to run each benchmark for a stable measurement
+    constexpr auto MIN_DURATION = std::chrono::milliseconds(200);
+
+    std::map<std::string, bench::benchmark_function>& benchmarks()
+    {
+        static std::map<std::string, bench::benchmark_function> s_benchmarks;
+        return s_benchmarks;
+    }
+
+    // The measurements reported by the last run of a benchmark
+    std::map<std::string, double> s_reports;
+}
+
+apolo::detail::lua_state_ptr bench::raw_state(const char* code)
+{
+    apolo::detail::lua_state_ptr state(luaL_newstate());
+    luaL_openlibs(state.get());
+    if (luaL_loadstring(state.get(), code) != LUA_OK)
+    {
+        throw std::runtime_error(lua_tostring(state.get(), -1));
+    }
+    raw_call(state.get(), 0);
+    lua_settop(state.get(), 0);
+    return state;
+}
+
+void bench::raw_call(lua_State* state, int nargs)
+{
+    if (lua_pcall(state, nargs, 1, 0) != LUA_OK)
+    {
+        throw std::runtime_error(lua_tostring(state, -1));
+    }
+}
+
+void bench::report(const std::string& metric, double value)
+{
+    s_reports[metric] = value;
+}
+
+std::size_t bench::heap_size()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+bool bench::register_benchmark(std::string name, benchmark_function function)
+{
+    return benchmarks().emplace(std::move(name), std::move(function)).second;
+}
+
+// Usage: apolo-bench [filter]
+// Runs all benchmarks whose name contains the filter string.
+int main(int argc, char* argv[])
+{
+    const std::string filter = (argc > 1) ? argv[1] : "";
+
+    std::printf("%-50s %15s %12s\n", "benchmark", "ns/iteration", "iterations");
+    for (const auto& [name, function] : benchmarks())
+    {
+        if (name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        // Grow the iteration count until the benchmark runs long enough
+        for (std::size_t iterations = 1;; iterations *= 4)
+        {
+            s_reports.clear();
+            const auto start = clock::now();
+            function(iterations);
+            const auto duration = clock::now() - start;
+            if (duration >= MIN_DURATION)
+            {
+                const auto ns = std::chrono::duration<double, std::nano>(duration).count();
+                std::printf("%-50s %15.1f %12zu\n", name.c_str(), ns / iterations, iterations);
+                for (const auto& [metric, value] : s_reports)
+                {
+                    std::printf("  %-48s %15.1f\n", metric.c_str(), value);
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "common.h"
+
+//
+// A pure function called repeatedly with a small set of arguments (tax rules keyed by region and
+// category), with and without caching its results.
+//
+
+namespace
+{
+    const char* const TAX_SCRIPT = R"(
+        function tax(region, category)
+            local rate = 0.1
+            for i = 1, category do rate = rate + 0.01 end
+            if region == "EU" then rate = rate * 2 end
+            return rate
+        end
+    )";
+
+    const char* const REGIONS[] = {"EU", "US", "APAC", "LATAM"};
+
+    void call_tax(std::size_t iterations, bool pure)
+    {
+        apolo::script script("bench", bench::S(TAX_SCRIPT));
+        if (pure)
+        {
+            script.mark_pure("tax");
+        }
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            bench::do_not_optimize(script.call("tax", REGIONS[i % 4], static_cast<int>(i % 16)));
+        }
+        if (pure)
+        {
+            bench::report("hit ratio", script.memoization("tax").hit_ratio());
+        }
+    }
+}
+
+BENCHMARK(memoization, uncached)
+{
+    call_tax(iterations, false);
+}
+
+BENCHMARK(memoization, pure)
+{
+    call_tax(iterations, true);
+}
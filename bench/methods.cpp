@@ -0,0 +1,85 @@
+#include "common.h"
+
+namespace
+{
+    class Counter
+    {
+    public:
+        virtual ~Counter() = default;
+
+        void add(int x)
+        {
+            m_total += x;
+        }
+
+    private:
+        long long m_total = 0;
+    };
+
+    class DerivedCounter : public Counter
+    {
+    };
+
+    // Calls a method on an object n times from Lua, so the method trampoline dominates
+    const char* const LOOP = "function loop(obj, n) for i = 1, n do obj:add(i) end end";
+
+    const char* const RAW_METATABLE = "bench.Counter";
+
+    int raw_add(lua_State* state)
+    {
+        auto* counter = static_cast<std::shared_ptr<Counter>*>(luaL_checkudata(state, 1, RAW_METATABLE));
+        (*counter)->add(static_cast<int>(luaL_checkinteger(state, 2)));
+        return 0;
+    }
+
+    int raw_gc(lua_State* state)
+    {
+        static_cast<std::shared_ptr<Counter>*>(luaL_checkudata(state, 1, RAW_METATABLE))->~shared_ptr();
+        return 0;
+    }
+
+    template <typename T>
+    void run_apolo(std::size_t iterations)
+    {
+        auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_object_type<Counter>()
+            .WithMethod("add", &Counter::add);
+        registry->add_object_type<DerivedCounter>()
+            .template WithBase<Counter>();
+
+        apolo::script script("bench", bench::S(LOOP), registry);
+        script.call("loop", std::make_shared<T>(), iterations);
+    }
+}
+
+BENCHMARK(methods, method_call)
+{
+    run_apolo<Counter>(iterations);
+}
+
+BENCHMARK(methods, inherited_method_call)
+{
+    run_apolo<DerivedCounter>(iterations);
+}
+
+BENCHMARK(methods, method_call_raw)
+{
+    auto state = bench::raw_state(LOOP);
+    lua_getglobal(state.get(), "loop");
+
+    void* mem = lua_newuserdata(state.get(), sizeof(std::shared_ptr<Counter>));
+    new (mem) std::shared_ptr<Counter>(std::make_shared<Counter>());
+    if (luaL_newmetatable(state.get(), RAW_METATABLE))
+    {
+        lua_pushvalue(state.get(), -1);
+        lua_setfield(state.get(), -2, "__index");
+        lua_pushcfunction(state.get(), &raw_add);
+        lua_setfield(state.get(), -2, "add");
+        lua_pushcfunction(state.get(), &raw_gc);
+        lua_setfield(state.get(), -2, "__gc");
+    }
+    lua_setmetatable(state.get(), -2);
+
+    lua_pushinteger(state.get(), static_cast<lua_Integer>(iterations));
+    bench::raw_call(state.get(), 2);
+}
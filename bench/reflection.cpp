@@ -0,0 +1,107 @@
+#include "common.h"
+
+//
+// Conversion of a plain struct to and from a Lua table, via reflection and via hand-written code.
+//
+
+namespace
+{
+    struct order
+    {
+        long long id;
+        double price;
+        int quantity;
+        std::string symbol;
+        bool active;
+    };
+}
+
+template <>
+struct apolo::reflect<order>
+{
+    static constexpr auto fields = std::make_tuple(
+        apolo::field("id", &order::id),
+        apolo::field("price", &order::price),
+        apolo::field("quantity", &order::quantity),
+        apolo::field("symbol", &order::symbol),
+        apolo::field("active", &order::active));
+};
+
+namespace
+{
+    const order ORDER{12345, 99.5, 10, "ABCD", true};
+
+    void push_order_raw(lua_State* state, const order& o)
+    {
+        lua_createtable(state, 0, 5);
+        lua_pushinteger(state, o.id);
+        lua_setfield(state, -2, "id");
+        lua_pushnumber(state, o.price);
+        lua_setfield(state, -2, "price");
+        lua_pushinteger(state, o.quantity);
+        lua_setfield(state, -2, "quantity");
+        lua_pushstring(state, o.symbol.c_str());
+        lua_setfield(state, -2, "symbol");
+        lua_pushboolean(state, o.active);
+        lua_setfield(state, -2, "active");
+    }
+
+    order read_order_raw(lua_State* state, int index)
+    {
+        order o;
+        lua_getfield(state, index, "id");
+        o.id = luaL_checkinteger(state, -1);
+        lua_getfield(state, index, "price");
+        o.price = luaL_checknumber(state, -1);
+        lua_getfield(state, index, "quantity");
+        o.quantity = static_cast<int>(luaL_checkinteger(state, -1));
+        lua_getfield(state, index, "symbol");
+        o.symbol = luaL_checkstring(state, -1);
+        lua_getfield(state, index, "active");
+        o.active = lua_toboolean(state, -1) != 0;
+        lua_pop(state, 5);
+        return o;
+    }
+}
+
+BENCHMARK(reflection, push)
+{
+    auto state = bench::raw_state("");
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::detail::push_value(*state, ORDER);
+        lua_pop(state.get(), 1);
+    }
+}
+
+BENCHMARK(reflection, push_raw)
+{
+    auto state = bench::raw_state("");
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        push_order_raw(state.get(), ORDER);
+        lua_pop(state.get(), 1);
+    }
+}
+
+BENCHMARK(reflection, read)
+{
+    auto state = bench::raw_state("");
+    push_order_raw(state.get(), ORDER);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto o = apolo::detail::read_value(*state, -1, static_cast<order*>(nullptr));
+        bench::do_not_optimize(o);
+    }
+}
+
+BENCHMARK(reflection, read_raw)
+{
+    auto state = bench::raw_state("");
+    push_order_raw(state.get(), ORDER);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto o = read_order_raw(state.get(), lua_gettop(state.get()));
+        bench::do_not_optimize(o);
+    }
+}
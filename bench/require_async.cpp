@@ -0,0 +1,59 @@
+#include "common.h"
+#include <chrono>
+#include <thread>
+
+namespace
+{
+    // Startup of this many scripts that each require a library from storage with this latency
+    constexpr int SCRIPTS = 20;
+    constexpr auto LATENCY = std::chrono::milliseconds(2);
+
+    // Every script requires its own library, so fetches overlap instead of being shared
+    std::vector<char> source(int script)
+    {
+        return bench::S("require('lib" + std::to_string(script) + "') function foo(x) return lib_function(x) end");
+    }
+
+    const char* const LIBRARY = "function lib_function(x) return x + 1 end";
+
+    apolo::script_data fetch_library()
+    {
+        std::this_thread::sleep_for(LATENCY);
+        return bench::S(LIBRARY);
+    }
+}
+
+BENCHMARK(require_async, sync_load_function)
+{
+    apolo::configuration config;
+    config.load_function([](const std::string&) { return fetch_library(); });
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        for (int s = 0; s < SCRIPTS; ++s)
+        {
+            bench::do_not_optimize(apolo::script("bench", source(s), config));
+        }
+    }
+}
+
+BENCHMARK(require_async, async_load_function)
+{
+    apolo::configuration config;
+    config.async_load_function([](const std::string&) { return std::async(std::launch::async, &fetch_library); });
+    std::vector<std::future<std::unique_ptr<apolo::script>>> futures;
+    futures.reserve(SCRIPTS);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::cooperative_executor executor;
+        futures.clear();
+        for (int s = 0; s < SCRIPTS; ++s)
+        {
+            futures.push_back(apolo::script::create_async(executor, "bench", source(s), config));
+        }
+        executor.run();
+        for (auto& future : futures)
+        {
+            bench::do_not_optimize(future.get());
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#include "common.h"
+#include <array>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+    const char* const SOURCE = "function foo(x) return x * 2 end";
+    const char* const LIBRARY = "function lib_function(x) return x + 1 end";
+    const char* const REQUIRES = "require('a') require('b') require('c')";
+
+    // The standard libraries apolo opens
+    const std::array<luaL_Reg, 5> RAW_LIBS = {{
+        {"_G", &luaopen_base},
+        {LUA_TABLIBNAME, &luaopen_table},
+        {LUA_STRLIBNAME, &luaopen_string},
+        {LUA_MATHLIBNAME, &luaopen_math},
+        {LUA_UTF8LIBNAME, &luaopen_utf8},
+    }};
+
+    void raw_run(lua_State* state, const char* code, const char* name)
+    {
+        if (luaL_loadbuffer(state, code, std::strlen(code), name) != LUA_OK)
+        {
+            throw std::runtime_error(lua_tostring(state, -1));
+        }
+        bench::raw_call(state, 0);
+        lua_pop(state, 1);
+    }
+
+    apolo::detail::lua_state_ptr raw_script(const char* code)
+    {
+        apolo::detail::lua_state_ptr state(luaL_newstate());
+        for (const auto& lib : RAW_LIBS)
+        {
+            luaL_requiref(state.get(), lib.name, lib.func, 1);
+            lua_pop(state.get(), 1);
+        }
+        raw_run(state.get(), code, "bench");
+        return state;
+    }
+
+    // A minimal require that runs a library at most once
+    int raw_require(lua_State* state)
+    {
+        const char* name = luaL_checkstring(state, 1);
+        lua_getfield(state, LUA_REGISTRYINDEX, "bench_loaded");
+        if (lua_getfield(state, -1, name) == LUA_TNIL)
+        {
+            lua_pushboolean(state, 1);
+            lua_setfield(state, -3, name);
+            raw_run(state, LIBRARY, name);
+        }
+        return 0;
+    }
+
+    // Memory per script, as the baseline of its Lua state and the growth of the heap for 1000 scripts
+    void report_memory(const apolo::configuration& config)
+    {
+        constexpr int SCRIPTS = 1000;
+        const auto heap = bench::heap_size();
+        std::vector<std::unique_ptr<apolo::script>> scripts;
+        scripts.reserve(SCRIPTS);
+        for (int i = 0; i < SCRIPTS; ++i)
+        {
+            scripts.push_back(std::make_unique<apolo::script>("bench", bench::S(SOURCE), config));
+        }
+        bench::report("bytes per script (heap)", static_cast<double>(bench::heap_size() - heap) / SCRIPTS);
+        bench::report("bytes per script (Lua baseline)", static_cast<double>(scripts.front()->baseline_memory()));
+    }
+}
+
+BENCHMARK(script, construction)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::script script("bench", bench::S(SOURCE));
+        bench::do_not_optimize(script);
+    }
+}
+
+BENCHMARK(script, construction_minimal_footprint)
+{
+    const auto config = apolo::configuration::minimal_footprint();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::script script("bench", bench::S(SOURCE), config);
+        bench::do_not_optimize(script);
+    }
+}
+
+BENCHMARK(script, memory)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        report_memory(apolo::configuration{});
+    }
+}
+
+BENCHMARK(script, memory_minimal_footprint)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        report_memory(apolo::configuration::minimal_footprint());
+    }
+}
+
+BENCHMARK(script, construction_raw)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        auto state = raw_script(SOURCE);
+        bench::do_not_optimize(state);
+    }
+}
+
+BENCHMARK(script, require)
+{
+    apolo::configuration config;
+    config.load_function([](const std::string&) { return bench::S(LIBRARY); });
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::script script("bench", bench::S(REQUIRES), config);
+        bench::do_not_optimize(script);
+    }
+}
+
+BENCHMARK(script, require_raw)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::detail::lua_state_ptr state(luaL_newstate());
+        for (const auto& lib : RAW_LIBS)
+        {
+            luaL_requiref(state.get(), lib.name, lib.func, 1);
+            lua_pop(state.get(), 1);
+        }
+        lua_newtable(state.get());
+        lua_setfield(state.get(), LUA_REGISTRYINDEX, "bench_loaded");
+        lua_register(state.get(), "require", &raw_require);
+        raw_run(state.get(), REQUIRES, "bench");
+        bench::do_not_optimize(state);
+    }
+}
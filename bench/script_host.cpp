@@ -0,0 +1,81 @@
+#include "common.h"
+#include <apolo/script_host.h>
+#include <memory>
+
+//
+// Memory per tenant: a small tenant script run as an environment of a script_host, compared with
+// a script per tenant. Measured as the growth of the heap for 1000 tenants.
+//
+
+namespace
+{
+    constexpr int TENANTS = 1000;
+
+    std::vector<char> tenant_script(int i)
+    {
+        return bench::S(R"(
+            rates = { EU = 0.2, US = 0.1, other = )" + std::to_string(i % 10) + R"( / 100 }
+            function tax(region, price)
+                return price * (rates[region] or rates.other)
+            end
+        )");
+    }
+}
+
+BENCHMARK(script_host, create_environments)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const auto heap = bench::heap_size();
+        apolo::script_host host;
+        const auto empty = host.memory();
+        std::vector<apolo::environment> environments;
+        environments.reserve(TENANTS);
+        for (int j = 0; j < TENANTS; ++j)
+        {
+            environments.push_back(host.create("tenant", tenant_script(j)));
+        }
+        if (i == 0)
+        {
+            bench::report("bytes per tenant (heap)", static_cast<double>(bench::heap_size() - heap) / TENANTS);
+            bench::report("bytes per tenant (Lua)", static_cast<double>(host.memory() - empty) / TENANTS);
+        }
+    }
+}
+
+BENCHMARK(script_host, create_scripts)
+{
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const auto heap = bench::heap_size();
+        std::vector<std::unique_ptr<apolo::script>> scripts;
+        scripts.reserve(TENANTS);
+        for (int j = 0; j < TENANTS; ++j)
+        {
+            scripts.push_back(std::make_unique<apolo::script>("tenant", tenant_script(j)));
+        }
+        if (i == 0)
+        {
+            bench::report("bytes per tenant (heap)", static_cast<double>(bench::heap_size() - heap) / TENANTS);
+        }
+    }
+}
+
+BENCHMARK(script_host, call_environment)
+{
+    apolo::script_host host;
+    auto environment = host.create("tenant", tenant_script(1));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(environment.call("tax", "EU", 10.0));
+    }
+}
+
+BENCHMARK(script_host, call_script)
+{
+    apolo::script script("tenant", tenant_script(1));
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(script.call("tax", "EU", 10.0));
+    }
+}
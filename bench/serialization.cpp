@@ -0,0 +1,91 @@
+#include "common.h"
+#include <apolo/serialization.h>
+
+namespace
+{
+    // A table of records, similar to typical script state
+    const char* const RECORDS = R"(
+        records = {}
+        for i = 1, 1000 do
+            records[i] = { id = i, price = i * 1.25, name = 'item' .. tostring(i), tags = { 'a', 'b', 'c' }, active = i % 2 == 0 }
+        end)";
+
+    apolo::detail::lua_state_ptr create_records()
+    {
+        auto state = bench::raw_state(RECORDS);
+        lua_getglobal(state.get(), "records");
+        return state;
+    }
+
+    // The naive alternative: walk the table and read every scalar via read_value
+    void walk_table(lua_State& state, int index, std::vector<apolo::value>& values)
+    {
+        lua_pushnil(&state);
+        while (lua_next(&state, index) != 0)
+        {
+            const int top = lua_gettop(&state);
+            values.push_back(apolo::detail::read_value(state, top - 1));
+            if (lua_istable(&state, top))
+            {
+                walk_table(state, top, values);
+            }
+            else
+            {
+                values.push_back(apolo::detail::read_value(state, top));
+            }
+            lua_pop(&state, 1);
+        }
+    }
+}
+
+BENCHMARK(serialization, write_table)
+{
+    auto state = create_records();
+    apolo::script_data buffer;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        buffer.clear();
+        apolo::value_writer(buffer).write(*state, -1);
+        bench::do_not_optimize(buffer.data());
+    }
+}
+
+BENCHMARK(serialization, write_table_baseline_read_value_walk)
+{
+    auto state = create_records();
+    std::vector<apolo::value> values;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        values.clear();
+        walk_table(*state, lua_gettop(state.get()), values);
+        bench::do_not_optimize(values.data());
+    }
+}
+
+BENCHMARK(serialization, read_table)
+{
+    auto state = create_records();
+    apolo::script_data buffer;
+    apolo::value_writer(buffer).write(*state, -1);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        apolo::value_reader(buffer).read(*state);
+        lua_pop(state.get(), 1);
+    }
+}
+
+BENCHMARK(serialization, write_values)
+{
+    const std::vector<apolo::value> values{ 42, 3.1415, "Hello World", true };
+    apolo::script_data buffer;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        buffer.clear();
+        apolo::value_writer writer(buffer);
+        for (const auto& value : values)
+        {
+            writer.write(value);
+        }
+        bench::do_not_optimize(buffer.data());
+    }
+}
@@ -0,0 +1,59 @@
+#include "common.h"
+
+//
+// Building a report of 1000 lines in a script, with the string_buffer() builtin compared with
+// repeated concatenation (which copies the growing string every time) and table.concat.
+//
+
+namespace
+{
+    const char* const SOURCE = R"(
+        function buffer()
+            local result = string_buffer()
+            for i = 1, 1000 do
+                result:append("line ", i, "\n")
+            end
+            return #result
+        end
+
+        function concat()
+            local result = ""
+            for i = 1, 1000 do
+                result = result .. "line " .. tostring(i) .. "\n"
+            end
+            return #result
+        end
+
+        function table_concat()
+            local lines = {}
+            for i = 1, 1000 do
+                lines[#lines + 1] = "line " .. tostring(i) .. "\n"
+            end
+            return #table.concat(lines)
+        end
+    )";
+
+    void run(std::size_t iterations, const char* function)
+    {
+        apolo::script script("bench", bench::S(SOURCE));
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            bench::do_not_optimize(script.call(function));
+        }
+    }
+}
+
+BENCHMARK(string_buffer, buffer)
+{
+    run(iterations, "buffer");
+}
+
+BENCHMARK(string_buffer, concat)
+{
+    run(iterations, "concat");
+}
+
+BENCHMARK(string_buffer, table_concat)
+{
+    run(iterations, "table_concat");
+}
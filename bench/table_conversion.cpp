@@ -0,0 +1,89 @@
+#include "common.h"
+
+//
+// Conversion between std::vector and Lua tables at different sizes, compared with
+// the straightforward element-by-element conversion without presizing.
+//
+
+namespace
+{
+    std::vector<double> make_values(std::size_t size)
+    {
+        std::vector<double> values(size);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            values[i] = static_cast<double>(i) * 0.5;
+        }
+        return values;
+    }
+
+    void push(std::size_t iterations, std::size_t size)
+    {
+        auto state = bench::raw_state("");
+        const auto values = make_values(size);
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            apolo::detail::push_value(*state, values);
+            lua_pop(state.get(), 1);
+        }
+    }
+
+    void push_raw(std::size_t iterations, std::size_t size)
+    {
+        auto state = bench::raw_state("");
+        const auto values = make_values(size);
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            lua_newtable(state.get());
+            for (std::size_t j = 0; j < values.size(); ++j)
+            {
+                lua_pushnumber(state.get(), values[j]);
+                lua_rawseti(state.get(), -2, static_cast<lua_Integer>(j + 1));
+            }
+            lua_pop(state.get(), 1);
+        }
+    }
+
+    void read(std::size_t iterations, std::size_t size)
+    {
+        auto state = bench::raw_state("");
+        apolo::detail::push_value(*state, make_values(size));
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            auto values = apolo::detail::read_value(*state, -1, static_cast<std::vector<double>*>(nullptr));
+            bench::do_not_optimize(values.data());
+        }
+    }
+
+    void read_raw(std::size_t iterations, std::size_t size)
+    {
+        auto state = bench::raw_state("");
+        apolo::detail::push_value(*state, make_values(size));
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            std::vector<double> values;
+            const auto length = lua_rawlen(state.get(), -1);
+            for (std::size_t j = 1; j <= length; ++j)
+            {
+                lua_rawgeti(state.get(), -1, static_cast<lua_Integer>(j));
+                values.push_back(luaL_checknumber(state.get(), -1));
+                lua_pop(state.get(), 1);
+            }
+            bench::do_not_optimize(values.data());
+        }
+    }
+}
+
+BENCHMARK(table_conversion, push_1k) { push(iterations, 1000); }
+BENCHMARK(table_conversion, push_1k_raw) { push_raw(iterations, 1000); }
+BENCHMARK(table_conversion, push_100k) { push(iterations, 100000); }
+BENCHMARK(table_conversion, push_100k_raw) { push_raw(iterations, 100000); }
+BENCHMARK(table_conversion, push_10m) { push(iterations, 10000000); }
+BENCHMARK(table_conversion, push_10m_raw) { push_raw(iterations, 10000000); }
+
+BENCHMARK(table_conversion, read_1k) { read(iterations, 1000); }
+BENCHMARK(table_conversion, read_1k_raw) { read_raw(iterations, 1000); }
+BENCHMARK(table_conversion, read_100k) { read(iterations, 100000); }
+BENCHMARK(table_conversion, read_100k_raw) { read_raw(iterations, 100000); }
+BENCHMARK(table_conversion, read_10m) { read(iterations, 10000000); }
+BENCHMARK(table_conversion, read_10m_raw) { read_raw(iterations, 10000000); }
@@ -0,0 +1,99 @@
+#include "common.h"
+
+//
+// Rotating and translating 1000 points per iteration: with Lua tables allocated per operation,
+// with vmath values, and with a single vmath batch call on an array of floats.
+//
+
+namespace
+{
+    const char* const SOURCE = R"(
+        local function rotate(q, v)
+            -- v + 2w(q x v) + q x 2(q x v)
+            local tx = 2 * (q.y * v.z - q.z * v.y)
+            local ty = 2 * (q.z * v.x - q.x * v.z)
+            local tz = 2 * (q.x * v.y - q.y * v.x)
+            return {
+                x = v.x + q.w * tx + q.y * tz - q.z * ty,
+                y = v.y + q.w * ty + q.z * tx - q.x * tz,
+                z = v.z + q.w * tz + q.x * ty - q.y * tx,
+            }
+        end
+
+        local function add(a, b) return {x = a.x + b.x, y = a.y + b.y, z = a.z + b.z} end
+
+        function tables(points)
+            local q = {x = 0, y = 0, z = math.sin(0.5), w = math.cos(0.5)}
+            local offset = {x = 1, y = 2, z = 3}
+            local last
+            for i = 1, #points do
+                last = add(rotate(q, points[i]), offset)
+            end
+            return last.x
+        end
+
+        function values(points)
+            local q = vmath.axis_angle(vmath.vec3(0, 0, 1), 1)
+            local offset = vmath.vec3(1, 2, 3)
+            local last
+            for i = 1, #points do
+                last = q * points[i] + offset
+            end
+            return last.x
+        end
+
+        function batch(points, out)
+            local q = vmath.axis_angle(vmath.vec3(0, 0, 1), 1)
+            local m = vmath.translation(vmath.vec3(1, 2, 3)) * vmath.rotation(q)
+            vmath.transform_points(m, points, out)
+        end
+
+        table_points, value_points = {}, {}
+        for i = 1, 1000 do
+            table_points[i] = {x = i, y = 2 * i, z = 3 * i}
+            value_points[i] = vmath.vec3(i, 2 * i, 3 * i)
+        end
+    )";
+
+    apolo::configuration configuration()
+    {
+        apolo::configuration config;
+        config.vector_math(true);
+        return config;
+    }
+
+    void run(std::size_t iterations, const char* code)
+    {
+        apolo::script script("bench", bench::S(std::string(SOURCE) + code), configuration());
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            bench::do_not_optimize(script.call("run"));
+        }
+    }
+}
+
+BENCHMARK(vector_math, tables)
+{
+    run(iterations, "function run() return tables(table_points) end");
+}
+
+BENCHMARK(vector_math, values)
+{
+    run(iterations, "function run() return values(value_points) end");
+}
+
+BENCHMARK(vector_math, batch)
+{
+    apolo::script script("bench", bench::S(SOURCE), configuration());
+    std::vector<float> points(3000);
+    std::vector<float> out(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+        points[i] = static_cast<float>(i);
+    }
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        script.call("batch", apolo::array_view<const float>(points), apolo::array_view<float>(out));
+        bench::do_not_optimize(out.data());
+    }
+}
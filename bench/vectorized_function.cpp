@@ -0,0 +1,61 @@
+#include "common.h"
+
+//
+// Applying a native function to 1000 numbers: with a call per element from a Lua loop, compared
+// with a single call of the vectorized form on a table and on an array view.
+//
+
+namespace
+{
+    const char* const SOURCE = R"(
+        values = {}
+        for i = 1, 1000 do values[i] = i * 0.5 end
+
+        function loop()
+            local out = {}
+            for i = 1, #values do out[i] = scale(values[i], 2) end
+            return out[#out]
+        end
+
+        function table() return scale(values, 2)[1000] end
+
+        function view(input, output) scale(input, 2, output) end
+    )";
+
+    std::shared_ptr<apolo::type_registry> make_registry()
+    {
+        auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_vectorized_function("scale", [](double x, double factor) { return x * factor; });
+        return registry;
+    }
+}
+
+BENCHMARK(vectorized_function, loop)
+{
+    apolo::script script("bench", bench::S(SOURCE), make_registry());
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(script.call("loop"));
+    }
+}
+
+BENCHMARK(vectorized_function, table)
+{
+    apolo::script script("bench", bench::S(SOURCE), make_registry());
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        bench::do_not_optimize(script.call("table"));
+    }
+}
+
+BENCHMARK(vectorized_function, view)
+{
+    apolo::script script("bench", bench::S(SOURCE), make_registry());
+    std::vector<double> input(1000, 0.5);
+    std::vector<double> output(input.size());
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        script.call("view", apolo::array_view<const double>(input), apolo::array_view<double>(output));
+        bench::do_not_optimize(output.data());
+    }
+}
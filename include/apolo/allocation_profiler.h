@@ -0,0 +1,155 @@
+#pragma once
+
+#include <lua/lua.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace apolo
+{
+
+//
+// Allocation profiler for the Lua heap of a script.
+//
+// All memory of a script's Lua state is allocated through this class. It always keeps track of the
+// number of live bytes. While running, it also records the number of allocations and allocated bytes
+// per size class and per type of Lua object, and the allocation rate over time.
+//
+// Obtain the allocation profiler of a script via \ref script::allocations.
+//
+class allocation_profiler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Allocations in a range of sizes
+    struct size_class
+    {
+        // The largest allocation size in this class; the last class is unbounded
+        std::size_t max_size;
+
+        // The number of allocations
+        std::uint64_t allocations;
+
+        // The number of allocated bytes
+        std::uint64_t bytes;
+    };
+
+    // Allocations for a single type of object
+    struct type_allocations
+    {
+        //
+        // The type of object: "string", "table", "function" (closures), "userdata", "thread", "proto"
+        // (compiled function bodies) or "internal" (table contents, stacks, upvalues, buffers and resizes)
+        //
+        std::string type;
+
+        // The number of allocations
+        std::uint64_t allocations;
+
+        // The number of allocated bytes
+        std::uint64_t bytes;
+    };
+
+    // Allocations in an interval of time
+    struct rate_sample
+    {
+        // The start of the interval, relative to the start of profiling
+        std::chrono::nanoseconds time;
+
+        // The number of allocations
+        std::uint64_t allocations;
+
+        // The number of allocated bytes
+        std::uint64_t bytes;
+    };
+
+    allocation_profiler() = default;
+
+    // Non-copyable; the Lua state refers to this instance
+    allocation_profiler(const allocation_profiler&) = delete;
+    allocation_profiler& operator=(const allocation_profiler&) = delete;
+
+    //
+    // Starts recording allocations.
+    //
+    // \param interval[in] the length of the time intervals of the allocation rate timeline.
+    //
+    void start(std::chrono::nanoseconds interval = std::chrono::milliseconds(100));
+
+    // Stops recording. Results are kept until #reset is called.
+    void stop();
+
+    // Returns true if the profiler is recording
+    bool running() const
+    {
+        return m_running;
+    }
+
+    // Discards all results
+    void reset();
+
+    // Returns the number of bytes currently allocated by the Lua state
+    std::size_t live_bytes() const
+    {
+        return m_live_bytes;
+    }
+
+    // Returns the highest number of bytes allocated at any time while recording
+    std::size_t peak_bytes() const
+    {
+        return m_peak_bytes;
+    }
+
+    // Returns the allocations per size class, for the size classes that have allocations
+    std::vector<size_class> size_classes() const;
+
+    // Returns the allocations per object type, sorted by descending bytes
+    std::vector<type_allocations> types() const;
+
+    // Returns the number of allocations and allocated bytes per time interval since profiling started
+    const std::vector<rate_sample>& timeline() const
+    {
+        return m_timeline;
+    }
+
+    // Returns the average allocation rate while recording, in bytes per second
+    double bytes_per_second() const;
+
+    //
+    // The allocation function of the Lua states, with the profiler as user data.
+    // See lua_Alloc in the Lua reference manual.
+    //
+    static void* allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize);
+
+private:
+    // Size classes of up to 8, 16, 32, ... 1M bytes, and larger
+    static constexpr std::size_t SIZE_CLASSES = 19;
+
+    // The Lua object types (tags) of new allocations, plus prototypes
+    static constexpr std::size_t TYPES = LUA_NUMTAGS + 1;
+
+    struct counter
+    {
+        std::uint64_t allocations = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    void record(std::size_t type, std::size_t size);
+
+    bool m_running = false;
+    std::size_t m_live_bytes = 0;
+    std::size_t m_peak_bytes = 0;
+    std::array<counter, SIZE_CLASSES> m_size_classes{};
+    std::array<counter, TYPES> m_types{};
+    std::vector<rate_sample> m_timeline;
+    std::chrono::nanoseconds m_interval{};
+    clock::time_point m_start;
+    std::chrono::nanoseconds m_elapsed{};
+};
+
+}
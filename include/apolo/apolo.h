@@ -1,14 +1,27 @@
 #pragma once
 
 #include <lua/lua.hpp>
-
+#include <apolo/allocation_profiler.h>
+#include <apolo/profiler.h>
+#include <apolo/tracing.h>
+#include <apolo/vector_math.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <limits>
+#include <list>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <tuple>
 #include <typeindex>
@@ -41,12 +54,25 @@ public:
   using exception::exception;
 };
 
+// A script has exceeded its usage quota
+class quota_exceeded_error : public runtime_error
+{
+public:
+  using runtime_error::runtime_error;
+};
+
 namespace detail
 {
     // Helper types for overloading on type for std::visit
     template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
     template<class... Ts> overloaded(Ts...)->overloaded<Ts...>;
 
+    // Combines two hashes into one
+    inline std::size_t hash_combine(std::size_t seed, std::size_t hash)
+    {
+        return seed ^ (hash + static_cast<std::size_t>(0x9e3779b97f4a7c15ull) + (seed << 6) + (seed >> 2));
+    }
+
     // function_traits: helper types to get argument and return type for lambdas
     template <typename T, typename Enable = void>
     struct function_traits;
@@ -80,6 +106,14 @@ namespace detail
 
     std::string metatable_name(const std::type_info& type);
 
+    // Returns the metatable name of \p T, without allocating after the first call
+    template <typename T>
+    const char* metatable_name()
+    {
+        static const std::string name = metatable_name(typeid(T));
+        return name.c_str();
+    }
+
     template <typename T, std::enable_if_t<std::is_integral_v<T>, void*> = nullptr>
     void push_value(lua_State& state, T value)
     {
@@ -107,6 +141,11 @@ namespace detail
         lua_pushstring(&state, value);
     }
 
+    inline void push_value(lua_State& state, std::string_view value)
+    {
+        lua_pushlstring(&state, value.data(), value.size());
+    }
+
 
     struct lua_state_delete
     {
@@ -132,15 +171,18 @@ namespace detail
           : m_state(ref.m_state)
           , m_ref(ref.m_ref)
         {
-            ref.release();
+            ref.reset();
         }
 
         lua_ref& operator=(lua_ref&& ref)
         {
-            release();
-            m_state = ref.m_state;
-            m_ref = ref.m_ref;
-            ref.release();
+            if (this != &ref)
+            {
+                release();
+                m_state = ref.m_state;
+                m_ref = ref.m_ref;
+                ref.reset();
+            }
             return *this;
         }
 
@@ -149,6 +191,12 @@ namespace detail
             return lua_ref(state, luaL_ref(&state, LUA_REGISTRYINDEX));
         }
 
+        // Pushes the referenced value onto the stack of \p state
+        void push(lua_State& state) const
+        {
+            lua_rawgeti(&state, LUA_REGISTRYINDEX, m_ref);
+        }
+
         ~lua_ref()
         {
             release();
@@ -160,11 +208,17 @@ namespace detail
             if (m_state != nullptr)
             {
                 luaL_unref(m_state, LUA_REGISTRYINDEX, m_ref);
-                m_state = nullptr;
-                m_ref = LUA_REFNIL;
+                reset();
             }
         }
 
+        // Forget the reference without releasing it, e.g. after its ownership has moved
+        void reset()
+        {
+            m_state = nullptr;
+            m_ref = LUA_REFNIL;
+        }
+
         lua_ref(lua_State& state, int ref)
             : m_state(&state)
             , m_ref(ref)
@@ -229,6 +283,16 @@ public:
     bool operator==(const value& other) const { return m_storage == other.m_storage; }
     bool operator!=(const value& other) const { return m_storage != other.m_storage; }
 
+    // Returns a hash of the value, consistent with operator==. Objects are hashed by type and address.
+    std::size_t hash() const
+    {
+        const std::size_t type = m_storage.index();
+        return std::visit(detail::overloaded{
+            [&](const object_info& x) { return detail::hash_combine(std::hash<std::type_index>()(x.m_type), std::hash<std::uintptr_t>()(x.m_address)); },
+            [&](const auto& x) { return detail::hash_combine(type, std::hash<std::decay_t<decltype(x)>>()(x)); },
+        }, m_storage);
+    }
+
 private:
     struct object_info
     {
@@ -242,12 +306,204 @@ private:
     std::variant<std::nullptr_t, bool, long long, double, std::string, object_info> m_storage;
 };
 
+//
+// Non-owning view of a contiguous array of numbers, for passing to and from scripts without copying.
+//
+// Views can be passed as arguments to \ref script::call, returned from registered functions and
+// taken as arguments of registered functions. In Lua, a view is a userdata that can be indexed like
+// an array (starting at 1) and supports the length operator. Elements are read from and written to
+// the underlying buffer directly. Views of const elements are read-only in Lua.
+//
+// The buffer must outlive all uses of the view in scripts, or be kept alive by passing its owner.
+//
+template <typename T>
+class array_view
+{
+public:
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<std::remove_const_t<T>, bool>, "array_view requires a numeric type");
+
+    //
+    // Constructs a view of \p size elements at \p data.
+    // \param owner[in] (optional) an object that keeps the buffer alive while the view is used by scripts.
+    //
+    array_view(T* data, std::size_t size, std::shared_ptr<const void> owner = nullptr)
+        : m_data(data)
+        , m_size(size)
+        , m_owner(std::move(owner))
+    {
+    }
+
+    // Constructs a view of a contiguous container, such as a std::vector or std::array
+    template <typename Container, typename = std::enable_if_t<std::is_convertible_v<decltype(std::declval<Container&>().data()), T*> &&
+                                                              !std::is_base_of_v<array_view, Container>>>
+    array_view(Container& container)
+        : array_view(container.data(), container.size())
+    {
+    }
+
+    // Constructs a read-only view from a mutable view
+    template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T> && !std::is_same_v<U, T>>>
+    array_view(const array_view<U>& other)
+        : array_view(other.data(), other.size(), other.owner())
+    {
+    }
+
+    T* data() const
+    {
+        return m_data;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    const std::shared_ptr<const void>& owner() const
+    {
+        return m_owner;
+    }
+
+private:
+    T* m_data;
+    std::size_t m_size;
+    std::shared_ptr<const void> m_owner;
+};
+
+//
+// Lazy sequence of values, for returning collections from registered functions without building a table.
+//
+// In Lua, a generator is an iterator function for generic for-loops, e.g. 'for i, v in items() do'.
+// Every iteration pulls the next element from \p Next, a callable returning a std::optional of the
+// element, until it returns std::nullopt. Loops yield the 1-based position and the element, or the
+// key and value for elements that are a std::pair. Loops that exit early only pull the elements they visit.
+//
+// Create generators with \ref make_generator or \ref iterate.
+//
+template <typename Next>
+class generator
+{
+public:
+    explicit generator(Next next)
+        : m_next(std::move(next))
+    {
+    }
+
+    // Returns the next element, if any
+    auto next()
+    {
+        return m_next();
+    }
+
+private:
+    Next m_next;
+};
+
+//
+// Describes a data member of a struct, for converting the struct to and from Lua tables.
+// Create descriptors with \ref field.
+//
+template <typename Class, typename Member>
+struct field_descriptor
+{
+    // The key of the member in Lua tables
+    const char* name;
+
+    // The data member
+    Member Class::*pointer;
+};
+
+// Returns the descriptor of data member \p pointer, with Lua table key \p name
+template <typename Class, typename Member>
+constexpr field_descriptor<Class, Member> field(const char* name, Member Class::*pointer)
+{
+    return {name, pointer};
+}
+
+//
+// Specialize this for a struct to pass it to and from scripts as a table.
+//
+// The specialization has a static constexpr tuple of field descriptors named 'fields':
+//
+//   template <>
+//   struct apolo::reflect<order>
+//   {
+//       static constexpr auto fields = std::make_tuple(apolo::field("id", &order::id), apolo::field("price", &order::price));
+//   };
+//
+// The members can be of any type supported as argument, including other reflected structs.
+// Reflected structs can then be passed to \ref script::call, and used as argument and return type of
+// registered functions. Reading a table fails if a field is missing or has the wrong type.
+//
+template <typename T>
+struct reflect;
+
+// Creates a generator from a callable returning a std::optional of the next element
+template <typename Next>
+generator<Next> make_generator(Next next)
+{
+    return generator<Next>(std::move(next));
+}
+
+//
+// Creates a generator over the elements in [\p begin, \p end).
+// The underlying range must outlive the iteration.
+//
+template <typename Iterator>
+auto iterate(Iterator begin, Iterator end)
+{
+    using element_type = std::decay_t<decltype(*begin)>;
+    return make_generator([begin, end]() mutable -> std::optional<element_type> {
+        if (begin == end)
+        {
+            return std::nullopt;
+        }
+        return *begin++;
+    });
+}
+
+//
+// Creates a generator over the elements of \p range.
+// An lvalue range is iterated in place, without copying it, and must outlive the iteration.
+// An rvalue range, such as a temporary container, is moved into the generator.
+//
+template <typename Range>
+auto iterate(Range&& range)
+{
+    if constexpr (std::is_lvalue_reference_v<Range>)
+    {
+        return iterate(std::begin(range), std::end(range));
+    }
+    else
+    {
+        using iterator_type = decltype(std::begin(range));
+        using element_type = std::decay_t<decltype(*std::begin(range))>;
+
+        // The iterators are created on first use, so they refer to the generator's own range
+        return make_generator([range = std::move(range), it = iterator_type(), started = false]() mutable -> std::optional<element_type> {
+            if (!started)
+            {
+                it = std::begin(range);
+                started = true;
+            }
+            if (it == std::end(range))
+            {
+                return std::nullopt;
+            }
+            return *it++;
+        });
+    }
+}
+
 namespace detail
 {
     value read_value(lua_State& state, int index);
     long long read_integer(lua_State& state, int index);
     double read_double(lua_State& state, int index);
     std::string read_string(lua_State& state, int index);
+    std::string_view read_string_view(lua_State& state, int index);
+
+    // Loads the standard libraries that are safe for sandboxed code into the global table
+    void load_sandboxed_libraries(lua_State& state);
 
     template <typename T>
     static std::enable_if_t<std::is_floating_point_v<T>, T> read_value(lua_State& state, int index, T*)
@@ -266,181 +522,1139 @@ namespace detail
         return detail::read_string(state, index);
     };
 
-    template <int Index>
-    static auto read_arguments(lua_State& state)
+    //
+    // Reads a string or a buffer created by the string_buffer() builtin without copying it.
+    // The view is valid while the Lua value is, e.g. for the duration of a registered function call.
+    //
+    inline std::string_view read_value(lua_State& state, int index, std::string_view*)
     {
-        if (lua_gettop(&state) + 1 != Index)
-        {
-            throw runtime_error("Insufficient arguments to function");
-        }
-        return std::make_tuple();
-    }
+        return detail::read_string_view(state, index);
+    };
 
-    template <int Index, typename Head, typename... Args>
-    static auto read_arguments(std::enable_if_t<std::is_same_v<std::decay_t<Head>, std::vector<value>>, lua_State&> state)
+    inline bool read_value(lua_State& state, int index, bool*)
     {
-        static_assert(sizeof...(Args) == 0, "std::vector<value> must be last argument in function");
-        std::vector<value> values;
-        int maxArg = lua_gettop(&state);
-        for (int i = Index; i <= maxArg; ++i)
+        if (!lua_isboolean(&state, index))
         {
-            values.push_back(detail::read_value(state, i));
+            throw runtime_error("Wrong arguments to function");
         }
-        return std::make_tuple(values);
-    }
+        return lua_toboolean(&state, index) != 0;
+    };
 
-    template <int Index, typename Head, typename... Args>
-    static auto read_arguments(std::enable_if_t<!std::is_same_v<std::decay_t<Head>, std::vector<value>>, lua_State&> state)
+    // Returns the metatable name of views of T
+    template <typename T>
+    const char* array_view_metatable_name()
     {
-        auto arg = detail::read_value(state, Index, std::add_pointer_t<Head>{});
-        return std::tuple_cat(std::make_tuple(arg), read_arguments<Index + 1, Args...>(state));
+        static const std::string name = std::string(std::is_const_v<T> ? "ArrayView:const " : "ArrayView:") + typeid(T).name();
+        return name.c_str();
     }
 
-
-    class lua_callback
+    template <typename T>
+    int array_view_index(lua_State* state)
     {
-    public:
-        virtual ~lua_callback() = default;
-        virtual int invoke(lua_State& state) const = 0;
-
-    protected:
-        template <typename Callable, typename ArgsTuple>
-        int invoke(lua_State& state, Callable &&callable, ArgsTuple&& argsTuple) const
+        const auto* view = static_cast<array_view<T>*>(luaL_checkudata(state, 1, array_view_metatable_name<T>()));
+        int is_integer = 0;
+        const lua_Integer index = lua_tointegerx(state, 2, &is_integer);
+        if (is_integer == 0 || index < 1 || static_cast<std::size_t>(index) > view->size())
         {
-            return push_value(state, [&](){
-                return std::apply(std::forward<Callable>(callable), std::forward<ArgsTuple>(argsTuple));
-            });
+            // Like tables, missing elements are nil
+            lua_pushnil(state);
         }
-
-    private:
-        template <typename Callable>
-        static std::enable_if_t<std::is_void_v<std::invoke_result_t<Callable>>, int>
-        push_value(lua_State&, Callable&& callable)
+        else if constexpr (std::is_integral_v<T>)
         {
-            callable();
-            return 0;
+            lua_pushinteger(state, static_cast<lua_Integer>(view->data()[index - 1]));
         }
-
-        template <typename Callable>
-        static std::enable_if_t<!std::is_void_v<std::invoke_result_t<Callable>>, int>
-        push_value(lua_State& state, Callable&& callable)
+        else
         {
-            push_value(state, callable());
-            return 1;
+            lua_pushnumber(state, static_cast<lua_Number>(view->data()[index - 1]));
         }
-    };
+        return 1;
+    }
 
-    template <typename R, typename... Args>
-    class simple_lua_callback: public detail::lua_callback
+    template <typename T>
+    int array_view_newindex(lua_State* state)
     {
-    public:
-        simple_lua_callback(std::function<R(Args...)> callable)
-            : m_callable(std::move(callable))
+        const auto* view = static_cast<array_view<T>*>(luaL_checkudata(state, 1, array_view_metatable_name<T>()));
+        if constexpr (std::is_const_v<T>)
         {
+            return luaL_error(state, "array view is read-only");
         }
-
-        int invoke(lua_State& state) const override
+        else
         {
-            auto args = read_arguments<1, std::decay_t<Args>...>(state);
-            return detail::lua_callback::invoke(state, m_callable, args);
+            int is_integer = 0;
+            const lua_Integer index = lua_tointegerx(state, 2, &is_integer);
+            if (is_integer == 0 || index < 1 || static_cast<std::size_t>(index) > view->size())
+            {
+                return luaL_error(state, "array view index out of range");
+            }
+
+            if constexpr (std::is_integral_v<T>)
+            {
+                const lua_Integer value = luaL_checkinteger(state, 3);
+                if (static_cast<lua_Integer>(static_cast<T>(value)) != value)
+                {
+                    return luaL_error(state, "value out of range for array view");
+                }
+                view->data()[index - 1] = static_cast<T>(value);
+            }
+            else
+            {
+                view->data()[index - 1] = static_cast<T>(luaL_checknumber(state, 3));
+            }
+            return 0;
         }
+    }
 
-    private:
-        std::function<R(Args...)> m_callable;
-    };
+    template <typename T>
+    int array_view_len(lua_State* state)
+    {
+        const auto* view = static_cast<array_view<T>*>(luaL_checkudata(state, 1, array_view_metatable_name<T>()));
+        lua_pushinteger(state, static_cast<lua_Integer>(view->size()));
+        return 1;
+    }
 
-    template <typename ObjectType>
-    class object_lua_callback : public detail::lua_callback
+    template <typename T>
+    int array_view_gc(lua_State* state)
     {
-    public:
-        int invoke(lua_State& state) const override
+        static_cast<array_view<T>*>(luaL_checkudata(state, 1, array_view_metatable_name<T>()))->~array_view();
+        return 0;
+    }
+
+    template <typename T>
+    void push_value(lua_State& state, const array_view<T>& view)
+    {
+        new(lua_newuserdata(&state, sizeof(array_view<T>))) array_view<T>(view);
+        if (luaL_newmetatable(&state, array_view_metatable_name<T>()))
         {
-            // Check that the first argument is a native object reference
-            auto* ref = static_cast<std::shared_ptr<ObjectType>*>(luaL_testudata(&state, 1, detail::metatable_name(typeid(ObjectType)).c_str()));
-            if (ref == nullptr)
+            static const luaL_Reg methods[] = {
+                {"__index", &array_view_index<T>},
+                {"__newindex", &array_view_newindex<T>},
+                {"__len", &array_view_len<T>},
+                {"__gc", &array_view_gc<T>},
+                {nullptr, nullptr},
+            };
+            luaL_setfuncs(&state, methods, 0);
+        }
+        lua_setmetatable(&state, -2);
+    }
+
+    template <typename T>
+    array_view<T> read_value(lua_State& state, int index, array_view<T>*)
+    {
+        using element_type = std::remove_const_t<T>;
+        if (auto* view = static_cast<array_view<element_type>*>(luaL_testudata(&state, index, array_view_metatable_name<element_type>())))
+        {
+            return *view;
+        }
+        if constexpr (std::is_const_v<T>)
+        {
+            // Read-only views can be passed where read-only views are expected
+            if (auto* view = static_cast<array_view<T>*>(luaL_testudata(&state, index, array_view_metatable_name<T>())))
             {
-                throw runtime_error("Wrong arguments to function");
+                return *view;
             }
-            assert(*ref != nullptr);
-            return invoke(**ref, state);
         }
+        throw runtime_error("Wrong arguments to function");
+    }
 
-        virtual int invoke(ObjectType& object, lua_State& state) const = 0;
-    };
+    // Numeric types that are converted in bulk between std::vector and Lua tables
+    template <typename T>
+    constexpr bool is_bulk_convertible_v = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
 
-    template <typename ObjectType, typename Callable, typename... Args>
-    class unbound_lua_callback : public object_lua_callback<ObjectType>
+    //
+    // Pushes a vector of numbers as a new Lua array.
+    // The table is created with its final size, so filling it doesn't rehash.
+    //
+    template <typename T, std::enable_if_t<is_bulk_convertible_v<T>, void*> = nullptr>
+    void push_value(lua_State& state, const std::vector<T>& values)
     {
-    public:
-        unbound_lua_callback(Callable callable)
-            : m_callable(callable)
+        if (values.size() > static_cast<std::size_t>(std::numeric_limits<int>::max()))
         {
+            throw runtime_error("Vector is too large for a Lua table");
         }
 
-        int invoke(ObjectType& object, lua_State& state) const override
+        const int size = static_cast<int>(values.size());
+        lua_createtable(&state, size, 0);
+        for (int i = 0; i < size; ++i)
         {
-            // Read the arguments from Lua and call the callback
-            auto args = read_arguments<2, std::decay_t<Args>...>(state);
-            auto applyArgs = std::tuple_cat(std::tie(object), args);
-            return detail::lua_callback::invoke(state, m_callable, applyArgs);
+            if constexpr (std::is_integral_v<T>)
+            {
+                lua_pushinteger(&state, static_cast<lua_Integer>(values[i]));
+            }
+            else
+            {
+                lua_pushnumber(&state, static_cast<lua_Number>(values[i]));
+            }
+            lua_rawseti(&state, -2, i + 1);
         }
+    }
 
-    private:
-        Callable m_callable;
-    };
-
-    template <typename DerivedType, typename BaseType>
-    class object_cast_lua_callback : public detail::object_lua_callback<DerivedType>
+    //
+    // Reads a Lua array of numbers into a vector.
+    // Elements are read in batches on the stack, to check and convert them in a tight loop.
+    //
+    template <typename T>
+    std::enable_if_t<is_bulk_convertible_v<T>, std::vector<T>> read_value(lua_State& state, int index, std::vector<T>*)
     {
-    public:
-        object_cast_lua_callback(const object_lua_callback<BaseType>& callback)
-            : m_callback(callback)
+        static constexpr int BATCH_SIZE = 64;
+
+        if (!lua_istable(&state, index) || !lua_checkstack(&state, BATCH_SIZE))
         {
+            throw runtime_error("Wrong arguments to function");
         }
+        index = lua_absindex(&state, index);
+        const auto size = lua_rawlen(&state, index);
 
-        int invoke(DerivedType& object, lua_State& state) const override
+        std::vector<T> values(size);
+        const int top = lua_gettop(&state);
+        for (std::size_t begin = 0; begin < size; begin += BATCH_SIZE)
         {
-            return m_callback.invoke(object, state);
-        }
+            const auto count = static_cast<int>(std::min<std::size_t>(BATCH_SIZE, size - begin));
+            for (int i = 0; i < count; ++i)
+            {
+                lua_rawgeti(&state, index, static_cast<lua_Integer>(begin) + i + 1);
+            }
+
+            bool valid = true;
+            for (int i = 0; i < count; ++i)
+            {
+                int is_number = 0;
+                if constexpr (std::is_integral_v<T>)
+                {
+                    const lua_Integer value = lua_tointegerx(&state, top + 1 + i, &is_number);
+                    values[begin + i] = static_cast<T>(value);
+                    valid &= (is_number != 0 && static_cast<lua_Integer>(values[begin + i]) == value);
+                }
+                else
+                {
+                    values[begin + i] = static_cast<T>(lua_tonumberx(&state, top + 1 + i, &is_number));
+                    valid &= (is_number != 0);
+                }
+            }
+            lua_settop(&state, top);
+
+            if (!valid)
+            {
+                throw runtime_error("Wrong arguments to function");
+            }
+        }
+        return values;
+    }
+
+    template <typename T, typename = void>
+    struct is_reflected : std::false_type {};
+
+    template <typename T>
+    struct is_reflected<T, std::void_t<decltype(reflect<T>::fields)>> : std::true_type {};
+
+    template <typename T>
+    constexpr bool is_reflected_v = is_reflected<T>::value;
+
+    // Calls function(index, descriptor) for every field of reflected type T
+    template <typename T, typename Function>
+    void for_each_field(Function&& function)
+    {
+        std::apply([&](const auto&... fields) {
+            int index = 0;
+            (function(++index, fields), ...);
+        }, reflect<T>::fields);
+    }
+
+    //
+    // Pushes an array with the field names of reflected type T.
+    // The names are created once per Lua state and kept in the registry, so they're not interned again.
+    //
+    template <typename T>
+    void push_field_names(lua_State& state)
+    {
+        // Only the address of the key is used; it's unique per type
+        static const char key = 0;
+        if (lua_rawgetp(&state, LUA_REGISTRYINDEX, &key) != LUA_TTABLE)
+        {
+            lua_pop(&state, 1);
+            lua_createtable(&state, static_cast<int>(std::tuple_size_v<std::decay_t<decltype(reflect<T>::fields)>>), 0);
+            for_each_field<T>([&](int index, const auto& field) {
+                lua_pushstring(&state, field.name);
+                lua_rawseti(&state, -2, index);
+            });
+            lua_pushvalue(&state, -1);
+            lua_rawsetp(&state, LUA_REGISTRYINDEX, &key);
+        }
+    }
+
+    // Pushes a reflected struct as a new table with a field per member
+    template <typename T, std::enable_if_t<is_reflected_v<T>, void*> = nullptr>
+    void push_value(lua_State& state, const T& object)
+    {
+        constexpr auto size = std::tuple_size_v<std::decay_t<decltype(reflect<T>::fields)>>;
+        if (!lua_checkstack(&state, 4))
+        {
+            throw runtime_error("Struct is too deeply nested");
+        }
+
+        lua_createtable(&state, 0, static_cast<int>(size));
+        push_field_names<T>(state);
+        for_each_field<T>([&](int index, const auto& field) {
+            lua_rawgeti(&state, -1, index);
+            push_value(state, object.*field.pointer);
+            lua_rawset(&state, -4);
+        });
+        lua_pop(&state, 1);
+    }
+
+    //
+    // Reads a table with a field per member into a reflected struct.
+    // The field names are constants, so Lua finds their interned strings in its cache of API strings.
+    //
+    template <typename T>
+    std::enable_if_t<is_reflected_v<T>, T> read_value(lua_State& state, int index, T*)
+    {
+        if (!lua_istable(&state, index) || !lua_checkstack(&state, 2))
+        {
+            throw runtime_error("Wrong arguments to function");
+        }
+        index = lua_absindex(&state, index);
+
+        T object{};
+        for_each_field<T>([&](int, const auto& field) {
+            using member_type = std::decay_t<decltype(object.*field.pointer)>;
+            lua_getfield(&state, index, field.name);
+            object.*field.pointer = read_value(state, -1, static_cast<member_type*>(nullptr));
+            lua_pop(&state, 1);
+        });
+        return object;
+    }
+
+    template <typename T>
+    struct is_pair : std::false_type {};
+
+    template <typename First, typename Second>
+    struct is_pair<std::pair<First, Second>> : std::true_type {};
+
+    // State of a generator pushed to Lua
+    template <typename Next>
+    class lua_generator
+    {
+    public:
+        explicit lua_generator(generator<Next> generator)
+            : m_generator(std::move(generator))
+        {
+        }
+
+        // Pushes the loop variables of the next iteration and returns their count, or 0 at the end
+        int push_next(lua_State& state)
+        {
+            auto element = m_generator.next();
+            if (!element)
+            {
+                return 0;
+            }
+
+            if constexpr (is_pair<std::decay_t<decltype(*element)>>::value)
+            {
+                push_value(state, element->first);
+                push_value(state, element->second);
+            }
+            else
+            {
+                lua_pushinteger(&state, ++m_position);
+                push_value(state, *element);
+            }
+            return 2;
+        }
+
+        static const char* metatable_name()
+        {
+            static const std::string name = std::string("Generator:") + typeid(Next).name();
+            return name.c_str();
+        }
+
+        static int next(lua_State* state)
+        {
+            auto* self = static_cast<lua_generator*>(lua_touserdata(state, lua_upvalueindex(1)));
+            try
+            {
+                return self->push_next(*state);
+            }
+            catch (const std::exception& e)
+            {
+                lua_pushstring(state, e.what());
+            }
+            catch (...)
+            {
+                lua_pushstring(state, "Unknown exception in generator");
+            }
+
+            // Raise the error outside of the catch block, as it doesn't return
+            return lua_error(state);
+        }
+
+        static int destroy(lua_State* state)
+        {
+            static_cast<lua_generator*>(luaL_checkudata(state, 1, metatable_name()))->~lua_generator();
+            return 0;
+        }
+
+    private:
+        generator<Next> m_generator;
+        lua_Integer m_position = 0;
+    };
+
+    // Pushes a generator as iterator function for generic for-loops
+    template <typename Next>
+    void push_value(lua_State& state, generator<Next> generator)
+    {
+        new(lua_newuserdata(&state, sizeof(lua_generator<Next>))) lua_generator<Next>(std::move(generator));
+        if (luaL_newmetatable(&state, lua_generator<Next>::metatable_name()))
+        {
+            lua_pushcfunction(&state, &lua_generator<Next>::destroy);
+            lua_setfield(&state, -2, "__gc");
+        }
+        lua_setmetatable(&state, -2);
+        lua_pushcclosure(&state, &lua_generator<Next>::next, 1);
+    }
+
+    template <int Index>
+    static auto read_arguments(lua_State& state)
+    {
+        if (lua_gettop(&state) + 1 != Index)
+        {
+            throw runtime_error("Insufficient arguments to function");
+        }
+        return std::make_tuple();
+    }
+
+    template <int Index, typename Head, typename... Args>
+    static auto read_arguments(std::enable_if_t<std::is_same_v<std::decay_t<Head>, std::vector<value>>, lua_State&> state)
+    {
+        static_assert(sizeof...(Args) == 0, "std::vector<value> must be last argument in function");
+        std::vector<value> values;
+        int maxArg = lua_gettop(&state);
+        for (int i = Index; i <= maxArg; ++i)
+        {
+            values.push_back(detail::read_value(state, i));
+        }
+        return std::make_tuple(values);
+    }
+
+    template <int Index, typename Head, typename... Args>
+    static auto read_arguments(std::enable_if_t<!std::is_same_v<std::decay_t<Head>, std::vector<value>>, lua_State&> state)
+    {
+        auto arg = detail::read_value(state, Index, std::add_pointer_t<Head>{});
+        return std::tuple_cat(std::make_tuple(arg), read_arguments<Index + 1, Args...>(state));
+    }
+
+
+    // Lock-free statistics of calls to a single callback
+    class call_statistics
+    {
+    public:
+        // Number of latency buckets; bucket i counts calls that took less than 2^(i+1) nanoseconds
+        static constexpr std::size_t BUCKETS = 40;
+
+        void record(std::chrono::nanoseconds duration, bool failed) noexcept;
+        void reset() noexcept;
+
+        std::uint64_t calls() const noexcept { return m_calls.load(std::memory_order_relaxed); }
+        std::uint64_t errors() const noexcept { return m_errors.load(std::memory_order_relaxed); }
+        std::chrono::nanoseconds total_time() const noexcept { return std::chrono::nanoseconds(m_total_time.load(std::memory_order_relaxed)); }
+        std::uint64_t bucket(std::size_t index) const noexcept { return m_histogram[index].load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint64_t> m_calls{0};
+        std::atomic<std::uint64_t> m_errors{0};
+        std::atomic<std::int64_t> m_total_time{0};
+        std::array<std::atomic<std::uint64_t>, BUCKETS> m_histogram{};
+    };
+
+    class lua_callback
+    {
+    public:
+        virtual ~lua_callback() = default;
+        virtual int invoke(lua_State& state) const = 0;
+
+        // Returns the name the callback was registered with
+        const std::string& name() const
+        {
+            return m_name;
+        }
+
+        // Sets the name the callback was registered with
+        void name(std::string name)
+        {
+            m_name = std::move(name);
+        }
+
+        // Returns the statistics of calls to this callback. Only collected if enabled in the registry.
+        call_statistics& statistics() const
+        {
+            return m_statistics;
+        }
+
+    protected:
+        template <typename Callable, typename ArgsTuple>
+        int invoke(lua_State& state, Callable &&callable, ArgsTuple&& argsTuple) const
+        {
+            return push_value(state, [&](){
+                return std::apply(std::forward<Callable>(callable), std::forward<ArgsTuple>(argsTuple));
+            });
+        }
+
+    private:
+        template <typename Callable>
+        static std::enable_if_t<std::is_void_v<std::invoke_result_t<Callable>>, int>
+        push_value(lua_State&, Callable&& callable)
+        {
+            callable();
+            return 0;
+        }
+
+        template <typename Callable>
+        static std::enable_if_t<!std::is_void_v<std::invoke_result_t<Callable>>, int>
+        push_value(lua_State& state, Callable&& callable)
+        {
+            detail::push_value(state, callable());
+            return 1;
+        }
+
+        std::string m_name;
+        mutable call_statistics m_statistics;
+    };
+
+    template <typename R, typename... Args>
+    class simple_lua_callback: public detail::lua_callback
+    {
+    public:
+        simple_lua_callback(std::function<R(Args...)> callable)
+            : m_callable(std::move(callable))
+        {
+        }
+
+        int invoke(lua_State& state) const override
+        {
+            auto args = read_arguments<1, std::decay_t<Args>...>(state);
+            return detail::lua_callback::invoke(state, m_callable, args);
+        }
+
+    private:
+        std::function<R(Args...)> m_callable;
+    };
+
+    // An argument of a vectorized function: an array, or a number that is broadcast to all elements
+    template <typename T>
+    struct vectorized_argument
+    {
+        const T* data = nullptr;
+        std::size_t size = 0;
+
+        // 0 for broadcast numbers
+        std::size_t stride = 1;
+
+        T number{};
+        std::vector<T> table;
+    };
+
+    //
+    // Reads an argument of a vectorized function.
+    // Array views are used in place; tables are read in bulk into the argument's own storage.
+    //
+    template <typename T>
+    void read_vectorized_argument(lua_State& state, int index, vectorized_argument<T>& argument)
+    {
+        if (lua_type(&state, index) == LUA_TNUMBER)
+        {
+            argument.number = read_value(state, index, static_cast<T*>(nullptr));
+            argument.data = &argument.number;
+            argument.stride = 0;
+        }
+        else if (lua_istable(&state, index))
+        {
+            argument.table = read_value(state, index, static_cast<std::vector<T>*>(nullptr));
+            argument.data = argument.table.data();
+            argument.size = argument.table.size();
+        }
+        else
+        {
+            const auto view = read_value(state, index, static_cast<array_view<const T>*>(nullptr));
+            argument.data = view.data();
+            argument.size = view.size();
+        }
+    }
+
+    template <typename Callable, typename R, typename... Args>
+    class vectorized_lua_callback : public detail::lua_callback
+    {
+        static_assert(is_bulk_convertible_v<R> && (is_bulk_convertible_v<Args> && ...),
+                      "vectorized functions require numeric arguments and result");
+
+    public:
+        vectorized_lua_callback(Callable callable)
+            : m_callable(std::move(callable))
+        {
+        }
+
+        int invoke(lua_State& state) const override
+        {
+            constexpr int arity = static_cast<int>(sizeof...(Args));
+            const int top = lua_gettop(&state);
+            if (top != arity && top != arity + 1)
+            {
+                throw runtime_error("Wrong arguments to function");
+            }
+
+            // A call with numbers only is a single call of the function
+            if (top == arity && all_numbers(state, std::index_sequence_for<Args...>()))
+            {
+                auto args = read_arguments<1, Args...>(state);
+                detail::push_value(state, static_cast<R>(std::apply(m_callable, args)));
+                return 1;
+            }
+
+            std::tuple<vectorized_argument<Args>...> args;
+            const std::size_t size = read_batch(state, args, std::index_sequence_for<Args...>());
+
+            // The results go to an output view, if given, or a new table
+            if (top == arity + 1)
+            {
+                const auto output = read_value(state, top, static_cast<array_view<R>*>(nullptr));
+                if (output.size() != size)
+                {
+                    throw runtime_error("Wrong size of output array");
+                }
+                run(output.data(), size, args, std::index_sequence_for<Args...>());
+                return 0;
+            }
+
+            std::vector<R> results(size);
+            run(results.data(), size, args, std::index_sequence_for<Args...>());
+            detail::push_value(state, results);
+            return 1;
+        }
+
+    private:
+        template <std::size_t... I>
+        static bool all_numbers(lua_State& state, std::index_sequence<I...>)
+        {
+            return ((lua_type(&state, static_cast<int>(I) + 1) == LUA_TNUMBER) && ...);
+        }
+
+        // Reads the arguments and returns the number of elements; all arrays must have that size
+        template <std::size_t... I>
+        static std::size_t read_batch(lua_State& state, std::tuple<vectorized_argument<Args>...>& args, std::index_sequence<I...>)
+        {
+            (read_vectorized_argument(state, static_cast<int>(I) + 1, std::get<I>(args)), ...);
+
+            // Numbers are broadcast, so only arrays have a size; an empty array counts as well
+            std::optional<std::size_t> size;
+            bool mismatch = false;
+            ([&](const auto& argument) {
+                if (argument.stride != 0)
+                {
+                    mismatch |= (size.has_value() && argument.size != *size);
+                    size = argument.size;
+                }
+            }(std::get<I>(args)), ...);
+
+            if (mismatch)
+            {
+                throw runtime_error("Arrays of different sizes");
+            }
+            return size.value_or(0);
+        }
+
+        // The batch loop, with the function inlined where possible so the compiler can vectorize it
+        template <std::size_t... I>
+        void run(R* output, std::size_t size, const std::tuple<vectorized_argument<Args>...>& args, std::index_sequence<I...>) const
+        {
+            const std::tuple<const Args*...> data(std::get<I>(args).data...);
+            const std::array<std::size_t, sizeof...(Args)> strides{{std::get<I>(args).stride...}};
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                output[i] = static_cast<R>(m_callable(std::get<I>(data)[i * strides[I]]...));
+            }
+        }
+
+        Callable m_callable;
+    };
+
+    template <typename Callable, typename R, typename... Args>
+    std::unique_ptr<lua_callback> make_vectorized_callback(Callable&& callable, R (*)(Args...))
+    {
+        return std::make_unique<vectorized_lua_callback<std::decay_t<Callable>, R, std::decay_t<Args>...>>(std::forward<Callable>(callable));
+    }
+
+    // Pushes a registered callback as Lua function; instrumented callbacks collect call statistics
+    void push_callback(lua_State& state, const lua_callback& callback, bool instrumented);
+
+    template <typename ObjectType>
+    class object_lua_callback : public detail::lua_callback
+    {
+    public:
+        int invoke(lua_State& state) const override
+        {
+            // Check that the first argument is a native object reference
+            auto* ref = static_cast<std::shared_ptr<ObjectType>*>(luaL_testudata(&state, 1, detail::metatable_name<ObjectType>()));
+            if (ref == nullptr)
+            {
+                throw runtime_error("Wrong arguments to function");
+            }
+            assert(*ref != nullptr);
+            return invoke(**ref, state);
+        }
+
+        virtual int invoke(ObjectType& object, lua_State& state) const = 0;
+    };
+
+    template <typename ObjectType, typename Callable, typename... Args>
+    class unbound_lua_callback : public object_lua_callback<ObjectType>
+    {
+    public:
+        unbound_lua_callback(Callable callable)
+            : m_callable(callable)
+        {
+        }
+
+        int invoke(ObjectType& object, lua_State& state) const override
+        {
+            // Read the arguments from Lua and call the callback
+            auto args = read_arguments<2, std::decay_t<Args>...>(state);
+            auto applyArgs = std::tuple_cat(std::tie(object), args);
+            return detail::lua_callback::invoke(state, m_callable, applyArgs);
+        }
+
+    private:
+        Callable m_callable;
+    };
+
+    template <typename DerivedType, typename BaseType>
+    class object_cast_lua_callback : public detail::object_lua_callback<DerivedType>
+    {
+    public:
+        object_cast_lua_callback(const object_lua_callback<BaseType>& callback)
+            : m_callback(callback)
+        {
+        }
+
+        int invoke(DerivedType& object, lua_State& state) const override
+        {
+            return m_callback.invoke(object, state);
+        }
+
+    private:
+        const object_lua_callback<BaseType>& m_callback;
+    };
+}
+
+using script_data = std::vector<char>;
+
+using script_load_function = std::function<script_data(const std::string&)>;
+
+using script_async_load_function = std::function<std::future<script_data>(const std::string&)>;
+
+namespace detail
+{
+    // Fetches libraries with an asynchronous load function. Concurrent fetches of the same library,
+    // also by different scripts on different threads, share a single call of the load function.
+    class library_fetcher
+    {
+    public:
+        explicit library_fetcher(script_async_load_function load_function)
+            : m_load_function(std::move(load_function))
+        {
+        }
+
+        // Returns the fetch of a library, which is started unless one is in progress
+        std::shared_future<script_data> fetch(const std::string& name);
+
+        const script_async_load_function& load_function() const
+        {
+            return m_load_function;
+        }
+
+    private:
+        script_async_load_function m_load_function;
+
+        // The fetches in progress, and those finished since the last fetch
+        std::mutex m_mutex;
+        std::unordered_map<std::string, std::shared_future<script_data>> m_fetches;
+    };
+}
+
+//
+// Snapshot of the global data of a script.
+//
+// Create one with \ref script::snapshot and pass it to the \ref script constructor to restore the
+// script's state without re-running its top-level chunk. The data can be stored and used in another process.
+//
+class script_snapshot
+{
+public:
+    explicit script_snapshot(script_data data)
+        : m_data(std::move(data))
+    {
+    }
+
+    // Returns the serialized snapshot
+    const script_data& data() const
+    {
+        return m_data;
+    }
+
+private:
+    script_data m_data;
+};
+
+//
+// Record of a call to a script function that took longer than the configured threshold.
+//
+// See \ref configuration::slow_call_threshold.
+//
+struct slow_call
+{
+    // The name of the called function
+    std::string function;
+
+    // Summary of the arguments, e.g. (1, "abc", nil)
+    std::string arguments;
+
+    // The time from the start of the call until it finished, including time spent waiting while yielded
+    std::chrono::nanoseconds duration;
+
+    // The time spent running the call
+    std::chrono::nanoseconds run_time;
+
+    // The number of times the call was resumed, including its start
+    int resumes;
+
+    //
+    // The Lua traceback at the end of the slowest resume: where the call yielded, raised an error
+    // or returned. Only the called function is listed if it returned.
+    //
+    std::string traceback;
+
+    // True if the call raised an error
+    bool failed;
+};
+
+using slow_call_function = std::function<void(const slow_call&)>;
+
+//
+// Resources used by a script.
+//
+// See \ref configuration::usage_accounting.
+//
+struct script_usage
+{
+    // The CPU time spent running the script's Lua code, including native functions called by it
+    std::chrono::nanoseconds cpu_time{0};
+
+    // The wall-clock time spent running the script's Lua code
+    std::chrono::nanoseconds wall_time{0};
+
+    // The number of executed VM instructions, in multiples of \ref script_usage::INSTRUCTION_GRANULARITY
+    std::uint64_t instructions = 0;
+
+    // The granularity of instruction counts
+    static constexpr int INSTRUCTION_GRANULARITY = 1000;
+};
+
+// What happens when a script exceeds its quota
+enum class quota_action
+{
+    // Abort running calls with an error and reject new calls with apolo::quota_exceeded_error
+    reject,
+
+    // Let cooperative executors only run the script's threads when no other threads can run
+    deprioritize,
+};
+
+//
+// Limits on the resources used by a script.
+//
+// See \ref configuration::usage_quota.
+//
+struct usage_quota
+{
+    // The maximum CPU time (0 for unlimited)
+    std::chrono::nanoseconds cpu_time{0};
+
+    // The maximum number of VM instructions (0 for unlimited)
+    std::uint64_t instructions = 0;
+
+    // What to do when the quota is exceeded
+    quota_action action = quota_action::reject;
+};
+
+//
+// Configuration for scripts.
+//
+// This object contains all configuration information for use in scripts, such as
+// the library-loading callback.
+class configuration
+{
+public:
+    //
+    // Set the function to load external scripts.
+    //
+    // Script can import external scripts (e.g. libraries) via a 'require' call.
+    // This callback is used to load those scripts' data.
+    //
+    // \param callback[in] the callback used to load external scripts (pass null to disable).
+    //
+    void load_function(script_load_function load_function)
+    {
+        m_load_function = load_function;
+    }
+
+    // Returns the the configured load function
+    const script_load_function& load_function() const
+    {
+        return m_load_function;
+    }
+
+    //
+    // Set an asynchronous function to load external scripts, which takes precedence over the load function.
+    //
+    // A 'require' call in a thread on an executor, such as a call with \ref script::call_async or the
+    // top-level chunk of \ref script::create_async, yields the thread until the returned future is
+    // ready, so the executor runs other threads in the meantime, or blocks if there are none (see
+    // \ref thread::is_waiting). Elsewhere, e.g. in the top-level
+    // chunk of a script constructed synchronously, 'require' waits for the future.
+    //
+    // Requires of the same library that wait at the same time share one call of the function. This
+    // includes requires in other scripts that use a copy of this configuration, so the function can
+    // be called from multiple threads.
+    //
+    // \param callback[in] the callback used to start loading external scripts (pass null to disable).
+    //
+    void async_load_function(script_async_load_function load_function)
+    {
+        m_library_fetcher = load_function ? std::make_shared<detail::library_fetcher>(std::move(load_function)) : nullptr;
+    }
+
+    // Returns the configured asynchronous load function
+    script_async_load_function async_load_function() const
+    {
+        return m_library_fetcher != nullptr ? m_library_fetcher->load_function() : nullptr;
+    }
+
+    //
+    // Set the sampling interval of the profiler.
+    //
+    // If non-zero, the script's \ref sampling_profiler is started during construction,
+    // so the top-level chunk is profiled as well.
+    //
+    // \param instructions[in] the number of VM instructions between samples (pass 0 to disable).
+    //
+    void profiler_sample_interval(int instructions)
+    {
+        m_profiler_sample_interval = instructions;
+    }
+
+    // Returns the configured sampling interval of the profiler
+    int profiler_sample_interval() const
+    {
+        return m_profiler_sample_interval;
+    }
+
+    //
+    // Set the threshold for reporting slow calls.
+    //
+    // Calls (via \ref script::call or \ref script::call_async) that take at least this long from start
+    // to finish are reported to the slow call function. Timing is only done if both are set.
+    //
+    // \param threshold[in] the minimum duration of reported calls (pass 0 to disable).
+    //
+    void slow_call_threshold(std::chrono::nanoseconds threshold)
+    {
+        m_slow_call_threshold = threshold;
+    }
+
+    // Returns the configured threshold for reporting slow calls
+    std::chrono::nanoseconds slow_call_threshold() const
+    {
+        return m_slow_call_threshold;
+    }
+
+    //
+    // Set the function that receives the slow call records.
+    //
+    // The function is called on the thread that finished the call. Exceptions thrown by it are ignored.
+    //
+    // \param callback[in] the callback receiving the records (pass null to disable).
+    //
+    void slow_call_function(apolo::slow_call_function slow_call_function)
+    {
+        m_slow_call_function = std::move(slow_call_function);
+    }
+
+    // Returns the configured slow call function
+    const apolo::slow_call_function& slow_call_function() const
+    {
+        return m_slow_call_function;
+    }
+
+    //
+    // Set the tracer for the lifecycle of scripts.
+    //
+    // The tracer receives spans for construction, loading of builtins and registered functions,
+    // compilation and execution of chunks, and loading of libraries.
+    //
+    // \param tracer[in] the tracer (pass null to disable).
+    //
+    void tracer(std::shared_ptr<apolo::tracer> tracer)
+    {
+        m_tracer = std::move(tracer);
+    }
+
+    // Returns the configured tracer
+    const std::shared_ptr<apolo::tracer>& tracer() const
+    {
+        return m_tracer;
+    }
+
+    //
+    // Set whether to account the resources used by scripts.
+    //
+    // If enabled, the CPU time, wall-clock time and VM instructions spent in the top-level chunk,
+    // libraries and all calls are accumulated per script. See \ref script::usage.
+    //
+    void usage_accounting(bool enable)
+    {
+        m_usage_accounting = enable;
+    }
+
+    // Returns true if resource usage is accounted; this is implied by a usage quota
+    bool usage_accounting() const
+    {
+        return m_usage_accounting || usage_quota().cpu_time.count() > 0 || usage_quota().instructions > 0;
+    }
 
-    private:
-        const object_lua_callback<BaseType>& m_callback;
-    };
-}
+    //
+    // Set the quota for the resources used by scripts.
+    //
+    // The quota applies to every script individually and enables usage accounting.
+    //
+    void usage_quota(const apolo::usage_quota& quota)
+    {
+        m_usage_quota = quota;
+    }
 
-using script_data = std::vector<char>;
+    // Returns the configured usage quota
+    const apolo::usage_quota& usage_quota() const
+    {
+        return m_usage_quota;
+    }
 
-using script_load_function = std::function<script_data(const std::string&)>;
+    //
+    // Set whether scripts can use the 'vmath' module for vector math.
+    //
+    // See \ref open_vector_math for the contents of the module.
+    //
+    void vector_math(bool enable)
+    {
+        m_vector_math = enable;
+    }
+
+    // Returns true if scripts can use the 'vmath' module
+    bool vector_math() const
+    {
+        return m_vector_math;
+    }
 
-//
-// Configuration for scripts.
-//
-// This object contains all configuration information for use in scripts, such as
-// the library-loading callback.
-class configuration
-{
-public:
     //
-    // Set the function to load external scripts.
+    // Set whether the builtin libraries (table, string, math, utf8 and vmath) are loaded on first use.
     //
-    // Script can import external scripts (e.g. libraries) via a 'require' call.
-    // This callback is used to load those scripts' data.
+    // If enabled, a library is loaded when a script first reads its global or, for the string
+    // library, indexes a string value, so scripts only pay for the libraries that they use.
+    // Libraries that aren't loaded yet aren't listed when iterating the global table.
     //
-    // \param callback[in] the callback used to load external scripts (pass null to disable).
+    void lazy_builtins(bool enable)
+    {
+        m_lazy_builtins = enable;
+    }
+
+    // Returns true if the builtin libraries are loaded on first use
+    bool lazy_builtins() const
+    {
+        return m_lazy_builtins;
+    }
+
     //
-    void load_function(script_load_function load_function)
+    // Set whether scripts are compacted after construction.
+    //
+    // If enabled, a script runs full garbage collections after its top-level chunk (or snapshot)
+    // until its memory stops shrinking, which also shrinks the string table and the stacks. See
+    // \ref script::baseline_memory.
+    //
+    void compact_after_load(bool enable)
     {
-        m_load_function = load_function;
+        m_compact_after_load = enable;
     }
 
-    // Returns the the configured load function
-    const script_load_function& load_function() const
+    // Returns true if scripts are compacted after construction
+    bool compact_after_load() const
     {
-        return m_load_function;
+        return m_compact_after_load;
+    }
+
+    //
+    // Returns a configuration for a minimal memory footprint per script, for very large numbers of
+    // scripts: builtin libraries are loaded on first use and scripts are compacted after construction.
+    //
+    static configuration minimal_footprint()
+    {
+        configuration config;
+        config.lazy_builtins(true);
+        config.compact_after_load(true);
+        return config;
     }
 
 private:
+    friend class script;
+
     script_load_function m_load_function;
+    std::shared_ptr<detail::library_fetcher> m_library_fetcher;
+    int m_profiler_sample_interval = 0;
+    std::chrono::nanoseconds m_slow_call_threshold{0};
+    apolo::slow_call_function m_slow_call_function;
+    std::shared_ptr<apolo::tracer> m_tracer;
+    bool m_usage_accounting = false;
+    apolo::usage_quota m_usage_quota;
+    bool m_vector_math = false;
+    bool m_lazy_builtins = false;
+    bool m_compact_after_load = false;
+};
+
+//
+// Statistics of calls to a registered native function or method.
+//
+// See \ref type_registry::collect_statistics.
+//
+struct binding_statistics
+{
+    // The name the function or method was registered with
+    std::string name;
+
+    // The name of the object type for methods; empty for free functions
+    std::string type;
+
+    // The number of calls
+    std::uint64_t calls;
+
+    // The number of calls that threw an exception
+    std::uint64_t errors;
+
+    // The total time spent in the calls
+    std::chrono::nanoseconds total_time;
+
+    // Number of calls per latency bucket, where bucket i counts calls that took less than 2^(i+1) nanoseconds
+    std::vector<std::uint64_t> latency_histogram;
+
+    //
+    // Returns an upper bound for the latency of the fastest \p fraction of calls (e.g. 0.99 for the p99 latency).
+    // The result is accurate up to a factor of two.
+    //
+    std::chrono::nanoseconds latency_percentile(double fraction) const;
 };
 
 //
@@ -449,6 +1663,9 @@ private:
 // Construct a registry, register functions and classes and pass it in to \ref script instances to allow
 // the registered methods and classes to be used in those script instances.
 //
+// Once the functions and classes are registered, the registry is only read, so it can be shared
+// by scripts that are constructed and run on different threads.
+//
 class type_registry
 {
 public:
@@ -465,6 +1682,7 @@ public:
     protected:
         void register_method(std::string name, std::unique_ptr<detail::lua_callback> callback)
         {
+            callback->name(name);
             bool success = m_methods.emplace(std::move(name), std::move(callback)).second;
             assert(success && "register_method");
             (void)success;
@@ -565,6 +1783,32 @@ public:
         }));
     }
 
+    //
+    // Adds an element-wise function of numbers as a global function that also processes whole arrays.
+    //
+    // Called from Lua with numbers, the function calls \p callable once and returns its result.
+    // Tables and \ref array_view arguments are processed in one call into C++: \p callable is called
+    // for every element in a loop over contiguous arrays, with numbers broadcast to all elements,
+    // and the results are returned as a new table. Passing a mutable view of the result type as
+    // extra last argument writes the results there instead.
+    //
+    // For example, after registering 'scale' as '[](double x, double factor) { return x * factor; }',
+    // 'scale(values, 2)' returns a table with all values doubled, and 'scale(view, 2, view)' doubles
+    // the values of a view in place. All arrays must have the same size.
+    //
+    // Array views are passed without copying and tables are read in bulk. Pass an inlinable callable,
+    // such as a lambda, so the compiler can vectorize the loop.
+    //
+    // \param[in] name the name to register the function as
+    // \param[in] callable the function of one element, with numeric arguments and result
+    //
+    template <typename Callable>
+    void add_vectorized_function(std::string name, Callable&& callable)
+    {
+        using Signature = typename detail::function_traits<std::decay_t<Callable>>::signature;
+        add_free_callback(std::move(name), detail::make_vectorized_callback(std::forward<Callable>(callable), static_cast<Signature*>(nullptr)));
+    }
+
     //
     // Returns a reference to the the registered free functions
     //
@@ -596,20 +1840,176 @@ public:
     //
     const object_type_info_base* get_object_type(std::type_index typeIndex) const;
 
+    //
+    // Set whether to collect call statistics for the registered functions and methods.
+    //
+    // Statistics are collected by the scripts constructed after enabling this, and aggregated over all
+    // scripts that share this registry, including scripts running on other threads.
+    //
+    void collect_statistics(bool enable)
+    {
+        m_collect_statistics.store(enable, std::memory_order_relaxed);
+    }
+
+    // Returns true if call statistics are collected
+    bool collect_statistics() const
+    {
+        return m_collect_statistics.load(std::memory_order_relaxed);
+    }
+
+    //
+    // Returns the call statistics of all registered functions and methods, sorted by descending total time.
+    //
+    std::vector<binding_statistics> statistics() const;
+
+    // Resets the call statistics of all registered functions and methods
+    void reset_statistics();
+
 private:
     // Adds a std::function as global function
     template <typename R, typename... Args>
     void add_free_function(std::string name, std::function<R(Args...)> callable)
+    {
+        add_free_callback(std::move(name), std::make_unique<detail::simple_lua_callback<R, Args...>>(std::move(callable)));
+    }
+
+    void add_free_callback(std::string name, std::unique_ptr<detail::lua_callback> callback)
     {
         assert(m_free_functions.find(name) == m_free_functions.end());
-        m_free_functions.emplace(std::move(name),
-        std::make_unique<detail::simple_lua_callback<R, Args...>>(std::move(callable)));
+        callback->name(name);
+        m_free_functions.emplace(std::move(name), std::move(callback));
     }
 
     std::unordered_map<std::string, std::unique_ptr<detail::lua_callback>> m_free_functions;
     std::unordered_map<std::type_index, std::unique_ptr<object_type_info_base>> m_object_types;
+
+    // Can be changed while scripts on other threads are being constructed
+    std::atomic<bool> m_collect_statistics{false};
+};
+
+//
+// Statistics of the results cache of a pure script function.
+//
+// See \ref script::mark_pure.
+//
+struct memoization_statistics
+{
+    // The number of calls that returned a cached result
+    std::uint64_t hits = 0;
+
+    // The number of calls that ran the function
+    std::uint64_t misses = 0;
+
+    // The number of results removed from the cache to make room for newer ones
+    std::uint64_t evictions = 0;
+
+    // The number of cached results
+    std::size_t size = 0;
+
+    // Returns the fraction of calls that returned a cached result, or 0 if there were no calls
+    double hit_ratio() const
+    {
+        return (hits + misses == 0) ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+    }
 };
 
+class script;
+
+namespace detail
+{
+    // A script that is being constructed by a thread; see script::create_async
+    struct pending_script;
+
+    // Loads the libraries and functions that are available to all scripts into the global table, except require
+    void load_builtins(lua_State& state, const configuration& config);
+
+    // True for the types of arguments that a pure function's results can be cached by. Objects are
+    // excluded: their value is only an address, which a later object can reuse.
+    template <typename T>
+    constexpr bool is_memoizable_argument = std::is_constructible_v<value, const T&>;
+
+    template <typename T>
+    constexpr bool is_memoizable_argument<std::shared_ptr<T>> = false;
+
+    // Cache of the most recently used results of a pure function, by the values of its arguments
+    class memo_cache
+    {
+    public:
+        explicit memo_cache(std::size_t capacity)
+            : m_capacity(capacity)
+        {
+        }
+
+        memo_cache(const memo_cache&) = delete;
+        memo_cache& operator=(const memo_cache&) = delete;
+
+        // Returns the result for \p arguments and marks it as most recently used, or nullptr if it isn't cached
+        const value* find(const std::vector<value>& arguments);
+
+        // Caches the result for \p arguments, evicting the least recently used result if the cache is full
+        void insert(std::vector<value> arguments, value result);
+
+        // Removes all results
+        void clear();
+
+        memoization_statistics statistics() const;
+
+    private:
+        struct entry
+        {
+            std::vector<value> arguments;
+            value result;
+        };
+
+        // The index refers to the arguments in the entries, which don't move
+        struct arguments_hash
+        {
+            std::size_t operator()(const std::vector<value>* arguments) const;
+        };
+
+        struct arguments_equal
+        {
+            bool operator()(const std::vector<value>* a, const std::vector<value>* b) const
+            {
+                return *a == *b;
+            }
+        };
+
+        std::size_t m_capacity;
+
+        // The entries from most to least recently used
+        std::list<entry> m_entries;
+        std::unordered_map<const std::vector<value>*, std::list<entry>::iterator, arguments_hash, arguments_equal> m_index;
+        memoization_statistics m_statistics;
+    };
+
+    // Timing of a call, for reporting slow calls
+    class call_timer
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // Expects the function and its arguments on top of the stack of \p state
+        call_timer(lua_State& state, int nargs, std::string function, std::chrono::nanoseconds threshold);
+
+        void resume_started();
+
+        // Expects the resumed thread in the state of the end of the resume
+        void resume_finished(lua_State& state, int result);
+
+        // Returns the record if the call was slow
+        bool finished(slow_call& record);
+
+    private:
+        std::chrono::nanoseconds m_threshold;
+        slow_call m_record;
+        std::string m_location;
+        clock::time_point m_start;
+        clock::time_point m_resume_start;
+        std::chrono::nanoseconds m_slowest_resume{-1};
+    };
+}
+
 class thread
 {
 public:
@@ -623,7 +2023,9 @@ public:
     // Creates a thread from the specified state and calls the function at the top of the stack.
     // It expects the top of the stack contains the function to-be-run in the thread, plus
     // \a nargs of arguments. The top \a nargs + 1 stack values are moved to the newly created thread.
-    thread(lua_State& state, int nargs);
+    // If \a owner is specified, that script is notified when the thread runs, and \a function is
+    // the name of the called function in slow call reports.
+    thread(lua_State& state, int nargs, script* owner = nullptr, const std::string& function = {});
 
     // Run the thread until it yields or finishes.
     // Exceptions thrown while running the thread will mark the thread as finished.
@@ -637,13 +2039,33 @@ public:
         return m_promise.get_future();
     }
 
+    // Returns true if the thread should only run when no other threads can, because its script exceeded its quota
+    bool is_deprioritized() const;
+
+    // Returns true if the thread yielded to wait for data, such as a library fetched for 'require', that isn't ready yet
+    bool is_waiting() const;
+
+    // Blocks until the data the thread waits for is ready, for at most \p timeout; returns true if it's ready
+    bool wait_for(std::chrono::nanoseconds timeout) const;
+
 private:
+    friend class script;
+
     bool is_runnable() const;
+    void finished() noexcept;
 
     lua_State* m_state;
+    script* m_owner;
+
+    // Destroyed after the Lua thread is released, e.g. to hand over the script constructed by the thread
+    std::shared_ptr<void> m_completion;
     detail::lua_ref m_ref;
     int m_nargs;
     std::promise<value> m_promise;
+    std::unique_ptr<detail::call_timer> m_timer;
+
+    // The data the thread yielded for
+    std::shared_future<script_data> m_waiting;
 };
 
 // Executors manage the execution of script threads. These threads are started by calling
@@ -658,7 +2080,8 @@ public:
 };
 
 // An executor that cooperatively runs the threads added to it.
-// It runs each thread until it yields, then runs the next one.
+// It runs each thread until it yields, then runs the next one. Threads that wait for data aren't
+// resumed until it's ready, and when all threads wait, the executor blocks until one can run.
 class cooperative_executor final : public executor
 {
 public:
@@ -667,7 +2090,27 @@ public:
     // Runs all added threads until they finish
     void run();
 private:
-    std::queue<thread> threads;
+    // Moves the waiting threads whose data is ready to the queue
+    void queue_ready_threads();
+
+    // Blocks until the data of one of the waiting threads is ready
+    void wait_for_any() const;
+
+    // Queue of threads from index m_head onwards; the storage is reused so running doesn't allocate
+    std::vector<thread> threads;
+    std::size_t m_head = 0;
+
+    // Threads of scripts over their quota, which are queued again once the queue is empty
+    std::vector<thread> m_deprioritized;
+
+    // The number of threads at the head of the queue that were queued again from m_deprioritized
+    std::size_t m_promoted = 0;
+
+    // Threads that wait for data, which are queued again after the pass over the queue in which their data is ready
+    std::vector<thread> m_waiting;
+
+    // The number of threads left to take from the queue in the current pass
+    std::size_t m_pass = 0;
 };
 
 class script final
@@ -717,6 +2160,117 @@ public:
     {
     }
 
+    //
+    // Constructs a named script object from a snapshot.
+    //
+    // Instead of running the top-level chunk of a script, the global data and functions stored
+    // in \p snapshot are restored. Libraries that were loaded when the snapshot was taken are
+    // considered loaded.
+    //
+    // \param name[in] the name of the script. This is used when reporting errors.
+    // \param snapshot[in] a snapshot created with #snapshot. This must come from a trusted source.
+    // \param config[in] configuration to use for this script. A copy is taken during construction.
+    // \param registry[in] (optional) a registry of functions and object types that will be integrated with this script.
+    // \throws apolo::serialization_error if the snapshot is invalid.
+    //
+    script(const std::string& name, const script_snapshot& snapshot, const configuration& config, std::shared_ptr<type_registry> registry);
+
+    //
+    // Constructs a named script object from a snapshot, with the default configuration.
+    //
+    // \param name[in] the name of the script. This is used when reporting errors.
+    // \param snapshot[in] a snapshot created with #snapshot. This must come from a trusted source.
+    // \param registry[in] (optional) a registry of functions and object types that will be integrated with this script.
+    script(const std::string& name, const script_snapshot& snapshot, std::shared_ptr<type_registry> registry)
+        : script(name, snapshot, default_configuration(), std::move(registry))
+    {
+    }
+
+    //
+    // Constructs a named script object asynchronously.
+    //
+    // The builtins and registered functions are loaded immediately. Compiling and running the
+    // top-level chunk is done by a thread on \p executor, like a call with #call_async, so the chunk
+    // can yield and run interleaved with other threads of the executor. Libraries loaded with require
+    // still run to completion.
+    //
+    // \param executor[in] the executor that runs the top-level chunk.
+    // \param name[in] the name of the script. This is used when reporting errors.
+    // \param buffer[in] the data of the script. This can be the source code or a compiled script binary.
+    // \param config[in] configuration to use for this script. A copy is taken.
+    // \param registry[in] (optional) a registry of functions and object types that will be integrated with this script.
+    // \return a future to the script, ready once the top-level chunk has finished and the executor has
+    //         released its thread. It throws apolo::syntax_error or apolo::runtime_error if the chunk
+    //         failed, and apolo::runtime_error if the executor was destroyed without finishing it.
+    //
+    static std::future<std::unique_ptr<script>> create_async(executor& executor, const std::string& name, const script_data& buffer,
+                                                             const configuration& config, std::shared_ptr<type_registry> registry = nullptr);
+
+    //
+    // Constructs a named script object asynchronously with the default configuration. See above.
+    //
+    static std::future<std::unique_ptr<script>> create_async(executor& executor, const std::string& name, const script_data& buffer,
+                                                             std::shared_ptr<type_registry> registry = nullptr)
+    {
+        return create_async(executor, name, buffer, default_configuration(), std::move(registry));
+    }
+
+    //
+    // Takes a snapshot of the global data of this script.
+    //
+    // All globals that are not builtins or registered functions are stored: tables, strings, numbers
+    // and booleans as data and Lua functions as bytecode. Registered native objects are stored as
+    // placeholders that are restored as nil.
+    //
+    // \return the snapshot, which can be passed to the \ref script constructor.
+    // \throws apolo::serialization_error if a global contains a value that cannot be stored, such as a
+    //         native function or a Lua function that refers to local variables of an enclosing function.
+    //
+    script_snapshot snapshot() const;
+
+    //
+    // Returns the profiler for this script.
+    //
+    // The profiler is not running unless it's started, or enabled in the configuration.
+    //
+    sampling_profiler& profiler()
+    {
+        return m_profiler;
+    }
+
+    //
+    // Returns the allocation profiler for this script's Lua heap.
+    //
+    // The number of live bytes is always available; detailed results are only recorded after it's started.
+    //
+    allocation_profiler& allocations()
+    {
+        return m_allocations;
+    }
+
+    //
+    // Returns the resources used by this script so far.
+    //
+    // Resources are only accounted if enabled in the configuration.
+    //
+    script_usage usage() const;
+
+    // Resets the accounted resource usage, e.g. at the start of a new billing period
+    void reset_usage();
+
+    // Returns true if the resource usage exceeds the configured quota
+    bool quota_exceeded() const;
+
+    //
+    // Returns the memory used by the Lua state of this script at the end of its construction, in
+    // bytes: the baseline cost of the script before any calls. This includes the compaction of
+    // \ref configuration::compact_after_load.
+    //
+    std::size_t baseline_memory() const
+    {
+        return m_baseline_memory;
+    }
+
     //
     // Calls a function in this script.
     //
@@ -728,16 +2282,57 @@ public:
     // \param args the arguments to pass to the function.
     // \return the return value of the function. If the function returns multiple values, only the first one is returned.
     // \throws apolo::runtime_error if an error occurred during execution of the function.
+    // \throws apolo::quota_exceeded_error if the script exceeded its usage quota.
     //
 	template <typename... Args>
     value call(const std::string& name, Args&& ...args)
     {
-	    cooperative_executor executor;
-	    auto future = call_async(executor, name, std::forward<Args>(args)...);
-	    executor.run();
-	    return future.get();
+        // Results of pure functions are cached if all arguments can be stored as values
+        if constexpr ((detail::is_memoizable_argument<std::decay_t<Args>> && ...))
+        {
+            if (!m_memoized.empty())
+            {
+                if (auto it = m_memoized.find(name); it != m_memoized.end())
+                {
+                    std::vector<value> arguments{value(args)...};
+                    if (const value* result = it->second.find(arguments))
+                    {
+                        return *result;
+                    }
+                    value result = call_uncached(name, std::forward<Args>(args)...);
+                    it->second.insert(std::move(arguments), result);
+                    return result;
+                }
+            }
+        }
+        return call_uncached(name, std::forward<Args>(args)...);
     }
 
+    //
+    // Marks a function of this script as pure: its result only depends on its arguments and calling
+    // it has no side effects. #call then caches the results of the function by its arguments, and
+    // returns a cached result instead of running the function again. The cache keeps the \p capacity
+    // most recently used results.
+    //
+    // Only calls whose arguments can all be stored as \ref value are cached. Calls with objects or
+    // array views as arguments, failed calls and calls with #call_async are not cached.
+    //
+    // \throws apolo::runtime_error if \p capacity is 0.
+    //
+    void mark_pure(const std::string& name, std::size_t capacity = 256);
+
+    //
+    // Returns the statistics of the results cache of a pure function.
+    // \throws apolo::runtime_error if the function isn't marked as pure.
+    //
+    memoization_statistics memoization(const std::string& name) const;
+
+    //
+    // Clears the cached results of all pure functions, e.g. when their code is reloaded. The
+    // functions stay marked as pure and their statistics are kept.
+    //
+    void invalidate_memoized();
+
     //
     // Calls a function in this script, asynchronously.
     //
@@ -751,7 +2346,12 @@ public:
     template <typename... Args>
     std::future<value> call_async(executor& executor, const std::string& name, Args&& ...args)
     {
-             // Get the function
+        if (m_usage_accounting)
+        {
+            check_quota();
+        }
+
+        // Get the function
         lua_getglobal(m_state.get(), name.c_str());
         if (!lua_isfunction(m_state.get(), -1))
         {
@@ -762,13 +2362,24 @@ public:
         // Push arguments
         (push_value(*m_state.get(), args), ...);
 
-        thread t(*m_state.get(), sizeof...(args));
+        thread t(*m_state.get(), sizeof...(args), this, name);
         auto future = t.get_future();
         executor.add_thread(std::move(t));
         return future;
     }
 
 private:
+    friend class thread;
+
+    template <typename... Args>
+    value call_uncached(const std::string& name, Args&& ...args)
+    {
+        cooperative_executor executor;
+        auto future = call_async(executor, name, std::forward<Args>(args)...);
+        executor.run();
+        return future.get();
+    }
+
     template <typename T>
     void push_value(lua_State& state, const T& value)
     {
@@ -776,6 +2387,7 @@ private:
     }
 
     void set_object_methods(lua_State& state, std::type_index type) const;
+    void push_callback(lua_State& state, const detail::lua_callback& callback) const;
 
     template <typename T>
     void push_value(lua_State& state, const std::shared_ptr<T>& value)
@@ -796,7 +2408,7 @@ private:
         new(mem) std::shared_ptr<T>{ value };
 
         // Associate metatable for the userdata
-        if (luaL_newmetatable(&state, detail::metatable_name(typeid(T)).c_str()))
+        if (luaL_newmetatable(&state, detail::metatable_name<T>()))
         {
             // Populate the new metatable with the object's methods
             set_object_methods(state, typeid(T));
@@ -817,7 +2429,7 @@ private:
     static int destroy_object_reference(lua_State* state)
     {
         // Get the to-be-GC'd argument and validate that it's a reference of the correct type
-        void* ref = luaL_checkudata(state, 1, detail::metatable_name(typeid(T)).c_str());
+        void* ref = luaL_checkudata(state, 1, detail::metatable_name<T>());
         if (ref != nullptr)
         {
             auto* ptr = static_cast<std::shared_ptr<T>*>(ref);
@@ -828,19 +2440,72 @@ private:
 
     static configuration default_configuration();
 
+    // Constructs a script without running a chunk, for create_async
+    script(const configuration& config, std::shared_ptr<type_registry> registry);
+
+    static int run_pending(lua_State* state);
+    static int finish_pending(lua_State* state, int status, lua_KContext context);
+
+    void initialize();
+    void restore(const script_snapshot& snapshot, const std::string& name);
+    bool is_builtin_global(lua_State& state, int index) const;
+
     void run(const script_data& buffer, const std::string& name);
-    void load_library(const std::string& libname);
+
+    // Loads a library unless it's loaded; returns false if the running thread must yield until it's fetched
+    bool load_library(lua_State& state, const std::string& libname);
 
     void load_builtins();
-    static int builtin_yield(lua_State* state);
+    void finish_construction();
     static int builtin_require(lua_State* state);
+    static int continue_require(lua_State* state, int status, lua_KContext context);
 
     static script* script_from_state(lua_State& state);
 
+    // Called by threads of this script before they're (re)started
+    void thread_resuming();
+
+    // Resource accounting of running Lua code; returns true if begin_usage must be matched by end_usage
+    bool begin_usage();
+    void end_usage();
+    void check_quota() const;
+    static void usage_hook(lua_State* state, lua_Debug* ar);
+
     configuration m_configuration;
     std::shared_ptr<type_registry> m_registry;
     std::set<std::string> m_loaded_libraries;
+
+    // The fetches of libraries with the asynchronous load function that threads are waiting for
+    std::unordered_map<std::string, std::shared_future<script_data>> m_pending_libraries;
+
+    // The fetch that the running thread yields for, which the thread takes once it yielded
+    std::shared_future<script_data> m_waiting_fetch;
+    allocation_profiler m_allocations;
     detail::lua_state_ptr m_state;
+    sampling_profiler m_profiler;
+
+    bool m_usage_accounting = false;
+    script_usage m_usage;
+    int m_usage_depth = 0;
+    std::chrono::nanoseconds m_usage_cpu_start{0};
+    std::chrono::steady_clock::time_point m_usage_wall_start;
+    std::size_t m_baseline_memory = 0;
+
+    // The results caches of the functions marked as pure, by function name
+    std::unordered_map<std::string, detail::memo_cache> m_memoized;
 };
 
 }
+
+namespace std
+{
+    // Allows values as keys of unordered containers
+    template <>
+    struct hash<apolo::value>
+    {
+        std::size_t operator()(const apolo::value& value) const
+        {
+            return value.hash();
+        }
+    };
+}
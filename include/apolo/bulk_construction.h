@@ -0,0 +1,52 @@
+#pragma once
+
+#include <apolo/apolo.h>
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace apolo
+{
+
+//
+// Definition of a script to construct with \ref construct_scripts, with the arguments of the script constructor.
+//
+struct script_definition
+{
+    std::string name;
+    script_data buffer;
+    configuration config;
+    std::shared_ptr<type_registry> registry;
+};
+
+//
+// Result of constructing a single script with \ref construct_scripts: either the script, or the
+// exception that its construction threw.
+//
+struct script_construction
+{
+    std::unique_ptr<script> instance;
+    std::exception_ptr error;
+};
+
+//
+// Constructs many scripts in parallel, such as all scripts of a service at startup.
+//
+// Each script is constructed like with the script constructor, on one of \p threads threads.
+// Scripts don't share state, so construction scales with the number of cores. The calling thread
+// takes part and the function returns when all scripts have been constructed.
+//
+// Registries may be shared by the scripts, but must not be changed during the construction. Load
+// functions, tracers and registered functions that the top-level chunks call are called from all
+// threads concurrently. The constructed scripts can afterwards be used from any single thread.
+//
+// \param definitions[in] the scripts to construct.
+// \param threads[in] (optional) the number of threads, including the calling thread, or 0 for the
+//                    number of hardware threads.
+// \return the result of every definition, in the same order. A failed construction doesn't affect the others.
+//
+std::vector<script_construction> construct_scripts(const std::vector<script_definition>& definitions, std::size_t threads = 0);
+
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <apolo/apolo.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace apolo
+{
+
+//
+// Column of values of one parameter, for evaluating an expression over a batch of rows with
+// \ref expression_set::evaluate_batch and \ref expression_set::test_batch.
+//
+// A column refers to the caller's array of numbers, booleans, std::string or std::string_view
+// values, which are read directly into the Lua state while evaluating, without copying the
+// column. The array must outlive the evaluation.
+//
+class column
+{
+public:
+    template <typename T>
+    static constexpr bool is_element_type = (std::is_arithmetic_v<T> && !std::is_same_v<T, char>) ||
+                                            std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+
+    //
+    // Constructs a column of the values at \p data.
+    // \param size[in] (optional) the number of values, which is checked against the number of rows.
+    //
+    template <typename T, typename = std::enable_if_t<is_element_type<T>>>
+    column(const T* data, std::size_t size = std::numeric_limits<std::size_t>::max())
+        : m_data(data)
+        , m_size(size)
+        , m_load(&load<T>)
+    {
+    }
+
+    // Constructs a column of a contiguous container, such as a std::vector or an \ref array_view
+    template <typename Container,
+              typename T = std::remove_const_t<std::remove_pointer_t<decltype(std::declval<const Container&>().data())>>,
+              typename = std::enable_if_t<is_element_type<T>>>
+    column(const Container& container)
+        : column(static_cast<const T*>(container.data()), container.size())
+    {
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    friend class expression_set;
+
+    // Sets the elements 1 to \p count of the table at the top of the stack to the values from row \p first on
+    template <typename T>
+    static void load(lua_State& state, const void* data, std::size_t first, std::size_t count)
+    {
+        const T* values = static_cast<const T*>(data) + first;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            detail::push_value(state, values[i]);
+            lua_rawseti(&state, -2, static_cast<lua_Integer>(i + 1));
+        }
+    }
+
+    const void* m_data;
+    std::size_t m_size;
+    void (*m_load)(lua_State&, const void*, std::size_t, std::size_t);
+};
+
+//
+// Set of many small expressions, such as rule predicates, compiled into functions of a single Lua state.
+//
+// Expressions are added once and evaluated many times via their handle, with the values of the
+// set's named parameters passed as function arguments. For example, a set with the parameters
+// {"price", "region"} can hold 'price > 10 and region == "EU"', which is then evaluated with
+// 'set.test(handle, 12.5, "EU")'.
+//
+// Compared to a \ref script per expression, an expression costs a compiled function instead of a
+// Lua state, and evaluation calls the function directly instead of going through an executor.
+// Expressions can use the builtin libraries of scripts and the free functions of a registry, but
+// not registered object types.
+//
+// An expression_set is not thread-safe.
+//
+class expression_set
+{
+public:
+    // Identifies an expression in its set
+    struct handle
+    {
+        int index;
+    };
+
+    //
+    // Constructs an empty set.
+    // \param parameters[in] the names of the parameters of all expressions, in argument order.
+    // \param registry[in] (optional) the registry of the functions that expressions can call.
+    // \throws apolo::runtime_error if a parameter name is not a valid Lua name.
+    //
+    explicit expression_set(std::vector<std::string> parameters, std::shared_ptr<type_registry> registry = nullptr);
+
+    //
+    // Compiles an expression and adds it to the set.
+    // \throws apolo::runtime_error if the expression doesn't compile.
+    //
+    handle add(const std::string& expression);
+
+    //
+    // Evaluates an expression with a value for every parameter, and returns its result.
+    // \throws apolo::runtime_error if the evaluation fails or the number of arguments is wrong.
+    //
+    template <typename... Args>
+    value evaluate(handle expression, Args&&... args)
+    {
+        push_function(expression, sizeof...(Args));
+        (detail::push_value(*m_state, std::forward<Args>(args)), ...);
+        call(sizeof...(Args));
+        value result = detail::read_value(*m_state, -1);
+        lua_pop(m_state.get(), 1);
+        return result;
+    }
+
+    //
+    // Evaluates an expression as a predicate: returns false if the result is nil or false, and true otherwise.
+    // This is faster than #evaluate, as it doesn't convert the result.
+    // \throws apolo::runtime_error if the evaluation fails or the number of arguments is wrong.
+    //
+    template <typename... Args>
+    bool test(handle expression, Args&&... args)
+    {
+        push_function(expression, sizeof...(Args));
+        (detail::push_value(*m_state, std::forward<Args>(args)), ...);
+        call(sizeof...(Args));
+        const bool result = lua_toboolean(m_state.get(), -1) != 0;
+        lua_pop(m_state.get(), 1);
+        return result;
+    }
+
+    //
+    // Evaluates an expression for \p rows rows of \p columns, with a column per parameter, and writes
+    // the result of row i to results[i]. Booleans are written as 1 or 0 and nil as 0.
+    //
+    // The loop over the rows runs in Lua, which reads the values of the parameters from the columns
+    // in blocks of rows, so the cost per row is that of interpreting the expression rather than that
+    // of a call into Lua.
+    //
+    // \throws apolo::runtime_error if the evaluation fails, a result isn't a number or boolean, the
+    // number of columns is wrong or a column or \p results have less than \p rows elements.
+    //
+    void evaluate_batch(handle expression, const std::vector<column>& columns, std::size_t rows, array_view<double> results);
+
+    //
+    // Evaluates an expression as a predicate for \p rows rows of \p columns, like #evaluate_batch,
+    // and writes a selection bitmap: bit i % 64 of selection[i / 64] is set if row i passes the test,
+    // and cleared otherwise. Bits past the last row of the last word are cleared.
+    // \throws apolo::runtime_error if the evaluation fails, the number of columns is wrong or a
+    // column or \p selection are too small for \p rows.
+    //
+    void test_batch(handle expression, const std::vector<column>& columns, std::size_t rows, array_view<std::uint64_t> selection);
+
+    // Returns the number of expressions in the set
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    // Returns the names of the parameters
+    const std::vector<std::string>& parameters() const
+    {
+        return m_parameters;
+    }
+
+    // Returns the memory used by the Lua state of the set, in bytes
+    std::size_t memory() const;
+
+private:
+    void push_function(handle expression, std::size_t arguments);
+    void call(std::size_t arguments);
+    void run_batch(handle expression, const std::vector<column>& columns, std::size_t rows, double* results, std::uint64_t* selection);
+    void push_batch_function(handle expression, bool selection);
+    static int load_block(lua_State* state);
+
+    std::vector<std::string> m_parameters;
+    std::shared_ptr<type_registry> m_registry;
+    detail::lua_state_ptr m_state;
+    std::size_t m_size = 0;
+
+    // The source of the expressions, for compiling their batch functions on first use
+    std::vector<std::string> m_expressions;
+
+    // The source before and after each expression
+    std::string m_prefix;
+    std::string m_suffix;
+};
+
+}
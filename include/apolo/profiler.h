@@ -0,0 +1,142 @@
+#pragma once
+
+#include <lua/lua.hpp>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace apolo
+{
+
+//
+// Sampling profiler for the Lua code of a script.
+//
+// While running, the profiler samples the Lua call stack every N virtual machine instructions
+// and attributes the time since the previous sample to that stack. Time spent in registered
+// native functions is measured directly and attributed to the calling stack plus the native
+// function's registered name. The calling stack is taken once per native function and sample
+// interval, so overhead is bounded by the sampling interval.
+//
+// A count hook that is installed on the Lua state when the profiler starts keeps being called
+// on every sample while profiling, and is restored when the profiler stops.
+//
+// Obtain the profiler of a script via \ref script::profiler.
+//
+class sampling_profiler
+{
+public:
+    // Aggregated time for a single function
+    struct function_time
+    {
+        // Name of the function, including its source location for Lua functions
+        std::string name;
+
+        // Time spent in the function itself
+        std::chrono::nanoseconds self;
+
+        // Time spent in the function and everything it called
+        std::chrono::nanoseconds total;
+    };
+
+    explicit sampling_profiler(lua_State& state)
+        : m_state(state)
+    {
+    }
+
+    ~sampling_profiler();
+
+    // Non-copyable; the Lua state refers to this instance
+    sampling_profiler(const sampling_profiler&) = delete;
+    sampling_profiler& operator=(const sampling_profiler&) = delete;
+
+    //
+    // Starts sampling.
+    //
+    // Only calls started after this point are sampled.
+    //
+    // \param instructions[in] the number of VM instructions between samples. Lower values give
+    //                         more precise results at the cost of higher overhead.
+    //
+    void start(int instructions = 1000);
+
+    // Stops sampling. Results are kept until #reset is called.
+    void stop();
+
+    // Returns true if the profiler is sampling
+    bool running() const
+    {
+        return m_running;
+    }
+
+    // Discards all results
+    void reset()
+    {
+        m_native_stacks.clear();
+        m_stacks.clear();
+    }
+
+    //
+    // Returns the results in "folded stacks" format, as used by flame graph tools.
+    // Every line contains a stack with frames separated by ';', followed by a space and the time
+    // in nanoseconds spent in that stack.
+    //
+    std::string folded_stacks() const;
+
+    // Returns the self and total time of every sampled function, sorted by descending self time
+    std::vector<function_time> functions() const;
+
+    //
+    // Restarts the sample clock, so time the script didn't run isn't attributed to a function.
+    // Called when Lua code starts or resumes running.
+    //
+    void resume();
+
+    //
+    // Records time spent in a native function called from Lua.
+    //
+    // Calls of a native function between two samples are attributed to the stack of the first of
+    // them, so only that call walks the Lua stack.
+    //
+    // \param state[in] the Lua thread that called the native function
+    // \param name[in] the registered name of the native function, which must outlive the profiler's results
+    // \param duration[in] the time spent in the native function
+    //
+    void record_native(lua_State& state, const std::string& name, std::chrono::nanoseconds duration);
+
+    // Returns the running profiler of a Lua state, or null if it's not being profiled.
+    static sampling_profiler* from_state(lua_State& state);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static void hook(lua_State* state, lua_Debug* ar);
+
+    void sample(lua_State& state);
+    std::string stack(lua_State& state, int level);
+    std::string frame_name(lua_State& state, const lua_Debug& ar);
+
+    lua_State& m_state;
+    bool m_running = false;
+
+    // The hook that was installed before the profiler started
+    lua_Hook m_previous_hook = nullptr;
+    int m_previous_mask = 0;
+    int m_previous_count = 0;
+    clock::time_point m_last_sample;
+
+    // Time spent in native functions since the last sample, which is not attributed to the sampled stack
+    std::chrono::nanoseconds m_native_time{0};
+
+    // The time of the stacks of native functions called since the last sample, by registered name
+    std::unordered_map<const std::string*, std::chrono::nanoseconds*> m_native_stacks;
+
+    // Time per folded stack
+    std::unordered_map<std::string, std::chrono::nanoseconds> m_stacks;
+
+    // Cache of global names of functions that threads were started with
+    std::unordered_map<const void*, std::string> m_function_names;
+};
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <apolo/apolo.h>
+
+#include <string>
+
+namespace apolo
+{
+
+//
+// Isolated script environment of a \ref script_host, which runs the code of one script (e.g. of a tenant).
+//
+// The globals of the script are stored in the environment's own '_ENV' table. Globals that aren't
+// set by the script are looked up in the builtins of the host, which are shared by all environments
+// and read-only. Functions are called like those of a \ref script.
+//
+// An environment must not outlive its host, and must be used from the thread that uses the host.
+//
+class environment
+{
+public:
+    //
+    // Calls a function of this environment.
+    // \return the first return value of the function.
+    // \throws apolo::runtime_error if the function doesn't exist or an error occurred during its execution.
+    //
+    template <typename... Args>
+    value call(const std::string& name, Args&&... args)
+    {
+        cooperative_executor executor;
+        auto future = call_async(executor, name, std::forward<Args>(args)...);
+        executor.run();
+        return future.get();
+    }
+
+    //
+    // Calls a function of this environment asynchronously on \p executor, like \ref script::call_async.
+    // \throws apolo::runtime_error if the function doesn't exist.
+    //
+    template <typename... Args>
+    std::future<value> call_async(executor& executor, const std::string& name, Args&&... args)
+    {
+        push_function(name, sizeof...(Args));
+        (detail::push_value(*m_state, args), ...);
+
+        thread t(*m_state, sizeof...(Args), nullptr, name);
+        auto future = t.get_future();
+        executor.add_thread(std::move(t));
+        return future;
+    }
+
+    // Returns the name of the environment's script
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+private:
+    friend class script_host;
+
+    environment(lua_State& state, std::string name, detail::lua_ref globals)
+        : m_state(&state)
+        , m_name(std::move(name))
+        , m_globals(std::move(globals))
+    {
+    }
+
+    void push_function(const std::string& name, std::size_t arguments);
+
+    lua_State* m_state;
+    std::string m_name;
+    detail::lua_ref m_globals;
+};
+
+//
+// Lua state that is shared by many isolated script environments, for running a large number of small
+// scripts, such as one per tenant.
+//
+// A \ref script has its own Lua state with its own copy of the builtin libraries, which costs
+// tens of kilobytes per script. The environments of a host instead share a state and its builtins,
+// so an environment costs only its '_ENV' table and the script's own functions and data.
+//
+// The builtins are those of scripts, except require, plus the free functions of the registry.
+// Library tables such as 'string' are shared through read-only proxies, so an environment can't
+// change them for others. Scripts are loaded as source code only.
+//
+// Registered object types aren't supported as arguments. A script_host and its environments are
+// not thread-safe.
+//
+class script_host
+{
+public:
+    //
+    // Constructs a host without environments.
+    // \param config[in] the configuration of the builtins. Other settings, such as profiling, usage
+    //                   accounting and lazy builtins, don't apply to environments.
+    // \param registry[in] (optional) the registry of the functions that scripts can call.
+    //
+    explicit script_host(const configuration& config = {}, std::shared_ptr<type_registry> registry = nullptr);
+
+    //
+    // Creates an environment and runs the top-level code of a script in it.
+    // \param name[in] the name of the script, used when reporting errors.
+    // \param buffer[in] the source code of the script.
+    // \throws apolo::syntax_error if the script doesn't compile.
+    // \throws apolo::runtime_error if the top-level code fails.
+    //
+    environment create(const std::string& name, const script_data& buffer);
+
+    // Returns the memory used by the Lua state of the host, including all environments, in bytes
+    std::size_t memory() const;
+
+private:
+    std::shared_ptr<type_registry> m_registry;
+    detail::lua_state_ptr m_state;
+
+    // The metatable of the '_ENV' table of environments
+    detail::lua_ref m_environment_metatable;
+};
+
+}
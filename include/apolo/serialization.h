@@ -0,0 +1,179 @@
+#pragma once
+
+#include <apolo/apolo.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+namespace apolo
+{
+
+// Serialized data is malformed or contains unsupported values
+class serialization_error : public exception
+{
+public:
+    using exception::exception;
+};
+
+//
+// Streaming writer for the compact binary encoding of values.
+//
+// Each call to #write appends one encoded value to the buffer passed in the constructor,
+// so multiple values can be written back-to-back and read back in order by \ref value_reader.
+// Lua tables are written recursively, including the distinction between integers and floats.
+// Tables that are referenced more than once (including cyclic references) within a single
+// written value are encoded once and restored as shared tables.
+//
+// Lua functions and registered native objects are rejected by default, but can be enabled
+// for trusted uses such as \ref script::snapshot. Functions are written as bytecode and may only
+// refer to the global table as upvalue. Native objects are written as a placeholder carrying
+// their type, which is restored as nil.
+//
+class value_writer
+{
+public:
+    //
+    // Constructs a writer that appends to \p buffer.
+    // \param buffer[in] the buffer to append to. It must outlive the writer.
+    //
+    explicit value_writer(script_data& buffer)
+        : m_buffer(buffer)
+    {
+    }
+
+    //
+    // Appends a value.
+    // \throws apolo::serialization_error if the value contains a native object reference.
+    //
+    void write(const value& value);
+
+    //
+    // Appends the Lua value at \p index on the stack of \p state, without modifying the stack.
+    // \throws apolo::serialization_error if the value is (or contains) a function, userdata or thread.
+    //
+    void write(lua_State& state, int index);
+
+    // Set whether Lua functions can be written (as bytecode)
+    void allow_functions(bool allow)
+    {
+        m_allow_functions = allow;
+    }
+
+    // Set whether registered native objects can be written (as placeholder)
+    void allow_objects(bool allow)
+    {
+        m_allow_objects = allow;
+    }
+
+private:
+    void write_lua(lua_State& state, int index, int depth);
+    bool write_reference(lua_State& state, int index);
+    void write_table(lua_State& state, int index, int depth);
+    void write_function(lua_State& state, int index);
+    void write_object(lua_State& state, int index);
+
+    void write_tag(std::uint8_t tag);
+    void write_varint(std::uint64_t value);
+    void write_integer(long long value);
+    void write_double(double value);
+    void write_string(const char* data, std::size_t size);
+
+    script_data& m_buffer;
+    std::unordered_map<const void*, std::uint64_t> m_references;
+    bool m_allow_functions = false;
+    bool m_allow_objects = false;
+};
+
+//
+// Zero-copy reader for data written by \ref value_writer.
+//
+// The reader does not copy the data; it decodes directly from the buffer passed in the constructor,
+// which must outlive the reader. Strings that are pushed onto a Lua stack are passed directly from
+// the buffer to Lua.
+//
+// Loading function bytecode is only safe for trusted data, so it must be enabled explicitly.
+//
+class value_reader
+{
+public:
+    value_reader(const char* data, std::size_t size)
+        : m_data(data)
+        , m_end(data + size)
+    {
+    }
+
+    explicit value_reader(const script_data& buffer)
+        : value_reader(buffer.data(), buffer.size())
+    {
+    }
+
+    // Returns true if all values have been read
+    bool empty() const
+    {
+        return m_data == m_end;
+    }
+
+    //
+    // Reads the next value.
+    // \throws apolo::serialization_error if the data is malformed or the next value is a table.
+    //
+    value read();
+
+    //
+    // Reads the next value and pushes it onto the stack of \p state. Tables are created as needed.
+    // \throws apolo::serialization_error if the data is malformed.
+    //
+    void read(lua_State& state);
+
+    // Set whether Lua functions (bytecode) can be read
+    void allow_functions(bool allow)
+    {
+        m_allow_functions = allow;
+    }
+
+private:
+    void read_lua(lua_State& state, int references, int depth);
+    void read_table(lua_State& state, int references, int depth);
+    void read_function(lua_State& state, int references);
+
+    std::uint8_t read_tag();
+    std::uint64_t read_varint();
+    long long read_integer();
+    double read_double();
+    std::string_view read_string();
+    const char* consume(std::size_t size);
+
+    std::size_t remaining() const
+    {
+        return static_cast<std::size_t>(m_end - m_data);
+    }
+
+    const char* m_data;
+    const char* m_end;
+    std::uint64_t m_references = 0;
+    bool m_allow_functions = false;
+};
+
+// Convenience method to serialize a single value into a new buffer
+inline script_data serialize(const value& value)
+{
+    script_data buffer;
+    value_writer(buffer).write(value);
+    return buffer;
+}
+
+// Convenience method to deserialize a single value from a buffer
+inline value deserialize(const script_data& buffer)
+{
+    value_reader reader(buffer);
+    auto result = reader.read();
+    if (!reader.empty())
+    {
+        throw serialization_error("Trailing data after serialized value");
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace apolo
+{
+
+// Named arguments of a trace span, such as sizes and library names
+using trace_arguments = std::vector<std::pair<std::string, std::variant<long long, std::string>>>;
+
+//
+// Receiver of trace spans of the lifecycle of scripts.
+//
+// Scripts emit spans for construction, loading of builtins, registration of functions, compilation
+// and execution of chunks, and loading of libraries via 'require'. Spans on the same thread are
+// properly nested: every #begin is followed by a matching #end, and spans that begin before an
+// earlier span ended are nested in it.
+//
+// Set a tracer for scripts via \ref configuration::tracer. Tracers may be called from multiple
+// threads if they're shared by scripts on different threads.
+//
+class tracer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    virtual ~tracer() = default;
+
+    //
+    // Called when a span begins.
+    // \param name[in] the name of the span, e.g. "compile"
+    // \param arguments[in] details of the span, e.g. the size of the compiled chunk
+    // \param time[in] the start of the span
+    //
+    virtual void begin(std::string_view name, const trace_arguments& arguments, clock::time_point time) = 0;
+
+    //
+    // Called when the most recently begun span on this thread ends.
+    // \param name[in] the name of the span
+    // \param time[in] the end of the span
+    //
+    virtual void end(std::string_view name, clock::time_point time) = 0;
+};
+
+//
+// Tracer that collects the spans as Chrome trace events.
+//
+// The result can be loaded in chrome://tracing or Perfetto.
+//
+class chrome_trace_writer : public tracer
+{
+public:
+    chrome_trace_writer()
+        : m_start(clock::now())
+    {
+    }
+
+    void begin(std::string_view name, const trace_arguments& arguments, clock::time_point time) override;
+    void end(std::string_view name, clock::time_point time) override;
+
+    // Writes the collected events in the JSON object format
+    void write(std::ostream& stream) const;
+
+    // Returns the collected events in the JSON object format
+    std::string json() const;
+
+private:
+    struct event
+    {
+        std::string name;
+        char phase;
+        std::thread::id thread;
+        clock::time_point time;
+        trace_arguments arguments;
+    };
+
+    clock::time_point m_start;
+    mutable std::mutex m_mutex;
+    std::vector<event> m_events;
+};
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <lua/lua.hpp>
+
+namespace apolo
+{
+
+//
+// Opens the 'vmath' module for vector math in scripts, and pushes its table.
+//
+// The module provides value types vec2, vec3, vec4, quat (x, y, z, w) and mat4 (column-major),
+// created with e.g. 'vmath.vec3(1, 2, 3)'. Values are immutable userdata with arithmetic
+// metamethods; every operation returns a new value. Components are read as 'v.x' .. 'v.w',
+// matrix elements as 'm:get(row, column)' (1-based). Supported operations:
+//
+//  - '+', '-' and unary '-' on vectors and quaternions of the same type
+//  - '*' between a vector and a number, between vectors (per component), between quaternions,
+//    of a quaternion and a vec3 (rotation), between matrices, and of a matrix and a vec4 or vec3
+//    (transformed as a point); '/' of a vector by a number
+//  - vmath.dot, cross, length, normalize, lerp, conjugate, axis_angle, translation, scaling,
+//    rotation and transpose
+//
+// Batch operations work in place on arrays of floats passed from C++ as \ref array_view, with
+// 3 floats per vector, so one call replaces a loop of interpreted operations:
+//
+//  - vmath.transform_points(m, input, output): output[i] = m * input[i] for every point
+//  - vmath.rotate_vectors(q, input, output): output[i] = q * input[i] for every vector
+//  - vmath.add_scaled(target, source, factor): target[i] += source[i] * factor for every float
+//  - vmath.normalize_all(vectors): normalizes every vector
+//
+// Arithmetic uses SSE on x86 and AVX for batches where the compiler targets it, with a scalar
+// fallback on other platforms.
+//
+// Enable the module for scripts with \ref configuration::vector_math.
+//
+int open_vector_math(lua_State* state);
+
+}
@@ -0,0 +1,172 @@
+#include <apolo/allocation_profiler.h>
+#include <algorithm>
+#include <cstdlib>
+
+namespace apolo
+{
+
+namespace
+{
+    const char* type_name(std::size_t type)
+    {
+        switch (type)
+        {
+        case LUA_TSTRING: return "string";
+        case LUA_TTABLE: return "table";
+        case LUA_TFUNCTION: return "function";
+        case LUA_TUSERDATA: return "userdata";
+        case LUA_TTHREAD: return "thread";
+        case LUA_NUMTAGS: return "proto";
+        default: return "internal";
+        }
+    }
+}
+
+void allocation_profiler::start(std::chrono::nanoseconds interval)
+{
+    m_interval = std::max(interval, std::chrono::nanoseconds(1));
+    m_start = clock::now();
+    m_peak_bytes = std::max(m_peak_bytes, m_live_bytes);
+    m_running = true;
+}
+
+void allocation_profiler::stop()
+{
+    if (m_running)
+    {
+        m_elapsed += clock::now() - m_start;
+        m_running = false;
+    }
+}
+
+void allocation_profiler::reset()
+{
+    m_size_classes = {};
+    m_types = {};
+    m_timeline.clear();
+    m_elapsed = {};
+    m_peak_bytes = m_live_bytes;
+    m_start = clock::now();
+}
+
+std::vector<allocation_profiler::size_class> allocation_profiler::size_classes() const
+{
+    std::vector<size_class> result;
+    for (std::size_t i = 0; i < SIZE_CLASSES; ++i)
+    {
+        if (m_size_classes[i].allocations > 0)
+        {
+            const auto max_size = (i + 1 < SIZE_CLASSES) ? (std::size_t{8} << i) : SIZE_MAX;
+            result.push_back({max_size, m_size_classes[i].allocations, m_size_classes[i].bytes});
+        }
+    }
+    return result;
+}
+
+std::vector<allocation_profiler::type_allocations> allocation_profiler::types() const
+{
+    std::vector<type_allocations> result;
+    for (std::size_t i = 0; i < TYPES; ++i)
+    {
+        if (m_types[i].allocations == 0)
+        {
+            continue;
+        }
+
+        // Several tags map to "internal"
+        const std::string name = type_name(i);
+        auto it = std::find_if(result.begin(), result.end(), [&](const type_allocations& t) { return t.type == name; });
+        if (it == result.end())
+        {
+            result.push_back({name, 0, 0});
+            it = result.end() - 1;
+        }
+        it->allocations += m_types[i].allocations;
+        it->bytes += m_types[i].bytes;
+    }
+    std::sort(result.begin(), result.end(), [](const type_allocations& a, const type_allocations& b) {
+        return a.bytes > b.bytes;
+    });
+    return result;
+}
+
+double allocation_profiler::bytes_per_second() const
+{
+    auto elapsed = m_elapsed;
+    if (m_running)
+    {
+        elapsed += clock::now() - m_start;
+    }
+    if (elapsed.count() <= 0)
+    {
+        return 0.0;
+    }
+
+    std::uint64_t bytes = 0;
+    for (const auto& sample : m_timeline)
+    {
+        bytes += sample.bytes;
+    }
+    return static_cast<double>(bytes) / std::chrono::duration<double>(elapsed).count();
+}
+
+void allocation_profiler::record(std::size_t type, std::size_t size)
+{
+    std::size_t class_index = 0;
+    while (class_index + 1 < SIZE_CLASSES && size > (std::size_t{8} << class_index))
+    {
+        ++class_index;
+    }
+
+    m_size_classes[class_index].allocations += 1;
+    m_size_classes[class_index].bytes += size;
+    m_types[type].allocations += 1;
+    m_types[type].bytes += size;
+
+    const auto elapsed = m_elapsed + (clock::now() - m_start);
+    const auto index = static_cast<std::size_t>(elapsed / m_interval);
+    while (m_timeline.size() <= index)
+    {
+        m_timeline.push_back({m_interval * static_cast<long long>(m_timeline.size()), 0, 0});
+    }
+    m_timeline[index].allocations += 1;
+    m_timeline[index].bytes += size;
+}
+
+void* allocation_profiler::allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize)
+{
+    auto& profiler = *static_cast<allocation_profiler*>(ud);
+
+    // For new blocks, Lua passes the type of the object being created as old size
+    const auto old_size = (ptr != nullptr) ? osize : 0;
+    if (nsize == 0)
+    {
+        std::free(ptr);
+        profiler.m_live_bytes -= old_size;
+        return nullptr;
+    }
+
+    void* result = std::realloc(ptr, nsize);
+    if (result == nullptr)
+    {
+        return nullptr;
+    }
+
+    profiler.m_live_bytes += nsize - old_size;
+    if (profiler.m_running)
+    {
+        profiler.m_peak_bytes = std::max(profiler.m_peak_bytes, profiler.m_live_bytes);
+        if (ptr == nullptr)
+        {
+            profiler.record(osize < TYPES ? osize : 0, nsize);
+        }
+        else if (nsize > osize)
+        {
+            // Growing a block is as costly as a new allocation
+            profiler.record(0, nsize);
+        }
+    }
+    return result;
+}
+
+}
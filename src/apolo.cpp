@@ -1,7 +1,13 @@
 #include <apolo/apolo.h>
+#include <apolo/serialization.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include "lua/lualib.h"
 #include <cstring>
+#include <iterator>
+#include <ctime>
 
 namespace apolo
 {
@@ -28,21 +34,91 @@ namespace
         return 0;
     }
 
+    // Invokes a callback while measuring the time spent in it for the profiler
+    int invoke_profiled(sampling_profiler& profiler, lua_State& state, const detail::lua_callback& callback)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto record = [&] {
+            profiler.record_native(state, callback.name(), std::chrono::steady_clock::now() - start);
+        };
+
+        try
+        {
+            const int results = callback.invoke(state);
+            record();
+            return results;
+        }
+        catch (...)
+        {
+            record();
+            throw;
+        }
+    }
+
+    int invoke_callback(lua_State& state, const detail::lua_callback& callback)
+    {
+        if (auto* profiler = sampling_profiler::from_state(state))
+        {
+            return invoke_profiled(*profiler, state, callback);
+        }
+        return callback.invoke(state);
+    }
+
     int lua_trampoline(lua_State* state)
     {
         return catch_exceptions(state, [&]{
             auto callback = static_cast<detail::lua_callback*>(lua_touserdata(state, lua_upvalueindex(1)));
-            return callback->invoke(*state);
+            return invoke_callback(*state, *callback);
+        });
+    }
+
+    // Records the duration and outcome of a callback invocation when it goes out of scope
+    class call_recorder
+    {
+    public:
+        explicit call_recorder(detail::call_statistics& statistics)
+            : m_statistics(statistics)
+            , m_exceptions(std::uncaught_exceptions())
+            , m_start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~call_recorder()
+        {
+            const bool failed = std::uncaught_exceptions() > m_exceptions;
+            m_statistics.record(std::chrono::steady_clock::now() - m_start, failed);
+        }
+
+    private:
+        detail::call_statistics& m_statistics;
+        int m_exceptions;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Trampoline for registries that collect call statistics
+    int lua_instrumented_trampoline(lua_State* state)
+    {
+        return catch_exceptions(state, [&]{
+            auto callback = static_cast<detail::lua_callback*>(lua_touserdata(state, lua_upvalueindex(1)));
+            call_recorder recorder(callback->statistics());
+            return invoke_callback(*state, *callback);
         });
     }
 
-    auto create_lua_state()
+    int lua_panic(lua_State* state)
+    {
+        lua_writestringerror("PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(state, -1));
+        return 0;
+    }
+
+    auto create_lua_state(allocation_profiler& allocations)
     {
-        detail::lua_state_ptr state(luaL_newstate());
+        detail::lua_state_ptr state(lua_newstate(&allocation_profiler::allocate, &allocations));
         if (state == nullptr)
         {
             throw std::bad_alloc();
         }
+        lua_atpanic(state.get(), &lua_panic);
         return state;
     }
 
@@ -54,11 +130,345 @@ namespace
         return std::string(begin, end);
     }
 
+    // Emits a trace span for the lifetime of the object, if there is a tracer
+    class trace_span
+    {
+    public:
+        template <typename Arguments>
+        trace_span(tracer* tracer, const char* name, Arguments&& arguments)
+            : m_tracer(tracer)
+            , m_name(name)
+        {
+            if (m_tracer != nullptr)
+            {
+                m_tracer->begin(m_name, arguments(), tracer::clock::now());
+            }
+        }
+
+        trace_span(tracer* tracer, const char* name)
+            : trace_span(tracer, name, []{ return trace_arguments(); })
+        {
+        }
+
+        ~trace_span()
+        {
+            if (m_tracer != nullptr)
+            {
+                m_tracer->end(m_name, tracer::clock::now());
+            }
+        }
+
+        trace_span(const trace_span&) = delete;
+        trace_span& operator=(const trace_span&) = delete;
+
+    private:
+        tracer* m_tracer;
+        const char* m_name;
+    };
+
+    // Returns the CPU time used by the calling thread
+    std::chrono::nanoseconds thread_cpu_time()
+    {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec time;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+#else
+        // No per-thread CPU clock; fall back to wall time
+        return std::chrono::steady_clock::now().time_since_epoch();
+#endif
+    }
+
     static constexpr const char* SELF_KEY_NAME = "script_self";
+
+    // Identifies the snapshot format
+    static constexpr std::string_view SNAPSHOT_MAGIC = "APSN\x01";
+
+    // Name of the module of \ref open_vector_math
+    static constexpr const char* VECTOR_MATH_NAME = "vmath";
+
+    // Metatable of the buffers created by the string_buffer() builtin; their userdata holds a std::string
+    static constexpr const char* STRING_BUFFER_METATABLE = "apolo.string_buffer";
+
+    std::string& check_string_buffer(lua_State* state, int index)
+    {
+        return *static_cast<std::string*>(luaL_checkudata(state, index, STRING_BUFFER_METATABLE));
+    }
+
+    // Appends the value at index to the buffer; values other than strings and buffers are converted like tostring()
+    void append_value(lua_State* state, std::string& buffer, int index)
+    {
+        std::size_t size = 0;
+        if (lua_type(state, index) == LUA_TSTRING)
+        {
+            const char* data = lua_tolstring(state, index, &size);
+            buffer.append(data, size);
+        }
+        else if (const auto* other = static_cast<std::string*>(luaL_testudata(state, index, STRING_BUFFER_METATABLE)))
+        {
+            // Reserve first, as the buffer may be appended to itself
+            size = other->size();
+            buffer.reserve(buffer.size() + size);
+            buffer.append(other->data(), size);
+        }
+        else
+        {
+            const char* data = luaL_tolstring(state, index, &size);
+            buffer.append(data, size);
+            lua_pop(state, 1);
+        }
+    }
+
+    // buffer:append(...) appends all arguments and returns the buffer
+    int string_buffer_append(lua_State* state)
+    {
+        auto& buffer = check_string_buffer(state, 1);
+        return catch_exceptions(state, [&]{
+            const int top = lua_gettop(state);
+            for (int i = 2; i <= top; ++i)
+            {
+                append_value(state, buffer, i);
+            }
+            lua_settop(state, 1);
+            return 1;
+        });
+    }
+
+    // buffer:appendf(format, ...) appends the result of string.format(format, ...) and returns the buffer
+    int string_buffer_appendf(lua_State* state)
+    {
+        auto& buffer = check_string_buffer(state, 1);
+        luaL_checktype(state, 2, LUA_TSTRING);
+
+        // The format function is captured from the string library when loading the builtins, or on
+        // first use if the library is loaded lazily, so scripts can't replace it
+        if (lua_isnil(state, lua_upvalueindex(1)))
+        {
+            luaL_requiref(state, LUA_STRLIBNAME, &luaopen_string, 0);
+            lua_getfield(state, -1, "format");
+            lua_replace(state, lua_upvalueindex(1));
+            lua_pop(state, 1);
+        }
+        lua_pushvalue(state, lua_upvalueindex(1));
+        lua_insert(state, 2);
+        lua_call(state, lua_gettop(state) - 2, 1);
+        return catch_exceptions(state, [&]{
+            append_value(state, buffer, 2);
+            lua_settop(state, 1);
+            return 1;
+        });
+    }
+
+    int string_buffer_tostring(lua_State* state)
+    {
+        const auto& buffer = check_string_buffer(state, 1);
+        lua_pushlstring(state, buffer.data(), buffer.size());
+        return 1;
+    }
+
+    int string_buffer_len(lua_State* state)
+    {
+        lua_pushinteger(state, static_cast<lua_Integer>(check_string_buffer(state, 1).size()));
+        return 1;
+    }
+
+    int string_buffer_gc(lua_State* state)
+    {
+        using std::string;
+        check_string_buffer(state, 1).~string();
+        return 0;
+    }
+
+    int builtin_string_buffer(lua_State* state)
+    {
+        const lua_Integer capacity = luaL_optinteger(state, 1, 0);
+        luaL_argcheck(state, capacity >= 0, 1, "negative capacity");
+
+        void* memory = lua_newuserdata(state, sizeof(std::string));
+        auto* buffer = new (memory) std::string();
+        luaL_setmetatable(state, STRING_BUFFER_METATABLE);
+        return catch_exceptions(state, [&]{
+            buffer->reserve(static_cast<std::size_t>(capacity));
+            return 1;
+        });
+    }
+
+    int builtin_yield(lua_State* state)
+    {
+        return lua_yield(state, lua_gettop(state));
+    }
 }
 
 namespace detail
 {
+    const value* memo_cache::find(const std::vector<value>& arguments)
+    {
+        const auto it = m_index.find(&arguments);
+        if (it == m_index.end())
+        {
+            ++m_statistics.misses;
+            return nullptr;
+        }
+        ++m_statistics.hits;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return &it->second->result;
+    }
+
+    void memo_cache::insert(std::vector<value> arguments, value result)
+    {
+        if (m_index.count(&arguments) != 0)
+        {
+            return;
+        }
+        if (m_entries.size() >= m_capacity)
+        {
+            m_index.erase(&m_entries.back().arguments);
+            m_entries.pop_back();
+            ++m_statistics.evictions;
+        }
+        m_entries.push_front({std::move(arguments), std::move(result)});
+        m_index.emplace(&m_entries.front().arguments, m_entries.begin());
+    }
+
+    void memo_cache::clear()
+    {
+        m_index.clear();
+        m_entries.clear();
+    }
+
+    memoization_statistics memo_cache::statistics() const
+    {
+        auto statistics = m_statistics;
+        statistics.size = m_entries.size();
+        return statistics;
+    }
+
+    std::size_t memo_cache::arguments_hash::operator()(const std::vector<value>* arguments) const
+    {
+        std::size_t hash = arguments->size();
+        for (const auto& argument : *arguments)
+        {
+            hash = hash_combine(hash, argument.hash());
+        }
+        return hash;
+    }
+
+    call_timer::call_timer(lua_State& state, int nargs, std::string function, std::chrono::nanoseconds threshold)
+        : m_threshold(threshold)
+    {
+        m_record.function = std::move(function);
+        m_record.run_time = {};
+        m_record.resumes = 0;
+        m_record.failed = false;
+
+        // Summarize the arguments, truncating long strings
+        static constexpr std::size_t MAX_ARGUMENT_LENGTH = 32;
+        m_record.arguments = "(";
+        for (int i = -nargs; i < 0; ++i)
+        {
+            std::size_t length;
+            const bool is_string = (lua_type(&state, i) == LUA_TSTRING);
+            const char* str = luaL_tolstring(&state, i, &length);
+            if (is_string)
+            {
+                m_record.arguments += '"';
+                m_record.arguments.append(str, std::min(length, MAX_ARGUMENT_LENGTH));
+                m_record.arguments += (length > MAX_ARGUMENT_LENGTH) ? "...\"" : "\"";
+            }
+            else
+            {
+                m_record.arguments.append(str, length);
+            }
+            lua_pop(&state, 1);
+            if (i < -1)
+            {
+                m_record.arguments += ", ";
+            }
+        }
+        m_record.arguments += ")";
+
+        // A finished call has no stack left, so remember where the function is defined
+        lua_Debug ar;
+        lua_pushvalue(&state, -nargs - 1);
+        lua_getinfo(&state, ">S", &ar);
+        m_location = "stack traceback:\n\t" + std::string(ar.short_src) + ":" + std::to_string(ar.linedefined) +
+                     ": in function '" + m_record.function + "'";
+
+        m_start = clock::now();
+    }
+
+    void call_timer::resume_started()
+    {
+        m_resume_start = clock::now();
+        ++m_record.resumes;
+    }
+
+    void call_timer::resume_finished(lua_State& state, int result)
+    {
+        const auto duration = clock::now() - m_resume_start;
+        m_record.run_time += duration;
+        m_record.failed = (result != LUA_OK && result != LUA_YIELD);
+        if (duration <= m_slowest_resume)
+        {
+            return;
+        }
+
+        m_slowest_resume = duration;
+        if (result == LUA_OK)
+        {
+            m_record.traceback = m_location;
+        }
+        else
+        {
+            // The stack of yielded threads and threads that raised an error is intact
+            luaL_traceback(&state, &state, nullptr, 0);
+            m_record.traceback = lua_tostring(&state, -1);
+            lua_pop(&state, 1);
+        }
+    }
+
+    bool call_timer::finished(slow_call& record)
+    {
+        m_record.duration = clock::now() - m_start;
+        if (m_record.duration < m_threshold)
+        {
+            return false;
+        }
+        record = std::move(m_record);
+        return true;
+    }
+
+    void call_statistics::record(std::chrono::nanoseconds duration, bool failed) noexcept
+    {
+        const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(duration.count(), 0));
+
+        // Bucket i holds durations below 2^(i+1), i.e. the index of the highest set bit
+        std::size_t bucket = 0;
+        for (auto bits = ns >> 1; bits != 0 && bucket + 1 < BUCKETS; bits >>= 1)
+        {
+            ++bucket;
+        }
+
+        m_calls.fetch_add(1, std::memory_order_relaxed);
+        if (failed)
+        {
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_total_time.fetch_add(static_cast<std::int64_t>(ns), std::memory_order_relaxed);
+        m_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void call_statistics::reset() noexcept
+    {
+        m_calls.store(0, std::memory_order_relaxed);
+        m_errors.store(0, std::memory_order_relaxed);
+        m_total_time.store(0, std::memory_order_relaxed);
+        for (auto& bucket : m_histogram)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
     value read_value(lua_State& state, int index)
     {
         switch (lua_type(&state, index))
@@ -87,20 +497,47 @@ namespace detail
 
     long long read_integer(lua_State& state, int index)
     {
-        if (!lua_isnumber(&state, index))
+        // Read integers directly, so large values keep their precision
+        int is_number = 0;
+        const lua_Integer integer = lua_tointegerx(&state, index, &is_number);
+        if (is_number != 0)
+        {
+            return static_cast<long long>(integer);
+        }
+
+        const lua_Number number = lua_tonumberx(&state, index, &is_number);
+        if (is_number == 0)
         {
             throw runtime_error("Wrong arguments to function");
         }
-        return static_cast<long long>(lua_tonumber(&state, index));
+        return static_cast<long long>(number);
     }
 
     double read_double(lua_State& state, int index)
     {
-        if (!lua_isnumber(&state, index))
+        int is_number = 0;
+        const lua_Number number = lua_tonumberx(&state, index, &is_number);
+        if (is_number == 0)
+        {
+            throw runtime_error("Wrong arguments to function");
+        }
+        return static_cast<double>(number);
+    }
+
+    std::string_view read_string_view(lua_State& state, int index)
+    {
+        if (const auto* buffer = static_cast<const std::string*>(luaL_testudata(&state, index, STRING_BUFFER_METATABLE)))
+        {
+            return *buffer;
+        }
+
+        if (lua_type(&state, index) != LUA_TSTRING)
         {
             throw runtime_error("Wrong arguments to function");
         }
-        return static_cast<double>(lua_tonumber(&state, index));
+        std::size_t size = 0;
+        const char* data = lua_tolstring(&state, index, &size);
+        return {data, size};
     }
 
     std::string read_string(lua_State& state, int index)
@@ -124,8 +561,71 @@ const type_registry::object_type_info_base* type_registry::get_object_type(std::
     return (it != m_object_types.end()) ? it->second.get() : nullptr;
 }
 
-thread::thread(lua_State& state, int nargs)
-    : m_nargs(nargs)
+std::vector<binding_statistics> type_registry::statistics() const
+{
+    std::vector<binding_statistics> result;
+    const auto add = [&](const detail::lua_callback& callback, std::string type) {
+        const auto& statistics = callback.statistics();
+        std::vector<std::uint64_t> histogram(detail::call_statistics::BUCKETS);
+        for (std::size_t i = 0; i < histogram.size(); ++i)
+        {
+            histogram[i] = statistics.bucket(i);
+        }
+        result.push_back({callback.name(), std::move(type), statistics.calls(), statistics.errors(),
+                          statistics.total_time(), std::move(histogram)});
+    };
+
+    for (const auto& [name, callback] : m_free_functions)
+    {
+        add(*callback, "");
+    }
+    for (const auto& [type, info] : m_object_types)
+    {
+        for (const auto& [name, callback] : info->methods())
+        {
+            add(*callback, type.name());
+        }
+    }
+
+    std::sort(result.begin(), result.end(), [](const binding_statistics& a, const binding_statistics& b) {
+        return a.total_time > b.total_time;
+    });
+    return result;
+}
+
+void type_registry::reset_statistics()
+{
+    for (const auto& [name, callback] : m_free_functions)
+    {
+        callback->statistics().reset();
+    }
+    for (const auto& [type, info] : m_object_types)
+    {
+        for (const auto& [name, callback] : info->methods())
+        {
+            callback->statistics().reset();
+        }
+    }
+}
+
+std::chrono::nanoseconds binding_statistics::latency_percentile(double fraction) const
+{
+    const auto target = static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(calls)));
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < latency_histogram.size(); ++i)
+    {
+        count += latency_histogram[i];
+        if (count >= target)
+        {
+            return std::chrono::nanoseconds(std::int64_t{2} << i);
+        }
+    }
+    return std::chrono::nanoseconds(std::int64_t{2} << (latency_histogram.size() - 1));
+}
+
+thread::thread(lua_State& state, int nargs, script* owner, const std::string& function)
+    : m_owner(owner)
+    , m_nargs(nargs)
 {
     // Create the new thread
     m_state = lua_newthread(&state);
@@ -133,16 +633,45 @@ thread::thread(lua_State& state, int nargs)
 
     // Move the callable plus arguments over
     lua_xmove(&state, m_state, nargs + 1);
+
+    if (m_owner != nullptr)
+    {
+        const auto& config = m_owner->m_configuration;
+        if (config.slow_call_threshold().count() > 0 && config.slow_call_function())
+        {
+            m_timer = std::make_unique<detail::call_timer>(*m_state, nargs, function, config.slow_call_threshold());
+        }
+    }
 }
 
 thread::status thread::run() noexcept
 {
     if (is_runnable())
     {
+        if (m_owner != nullptr)
+        {
+            m_owner->thread_resuming();
+        }
+
         try
         {
             // Resume/start the function
-            switch (lua_resume(m_state, nullptr, std::max(0, m_nargs)))
+            if (m_timer != nullptr)
+            {
+                m_timer->resume_started();
+            }
+            const bool metered = (m_owner != nullptr && m_owner->begin_usage());
+            const int result = lua_resume(m_state, nullptr, std::max(0, m_nargs));
+            if (metered)
+            {
+                m_owner->end_usage();
+            }
+            if (m_timer != nullptr)
+            {
+                m_timer->resume_finished(*m_state, result);
+            }
+
+            switch (result)
             {
             case LUA_OK:
             {
@@ -155,27 +684,71 @@ thread::status thread::run() noexcept
                 }
                 m_promise.set_value(value);
                 m_nargs = -1;
+                finished();
                 break;
             }
             case LUA_YIELD:
                 // We don't care about the yield arguments
                 lua_pop(m_state, lua_gettop(m_state));
                 m_nargs = -1;
+                if (m_owner != nullptr)
+                {
+                    m_waiting = std::move(m_owner->m_waiting_fetch);
+                }
                 return status::yielded;
             case LUA_ERRMEM:
                 throw std::bad_alloc();
             default:
+                if (m_owner != nullptr && m_owner->m_usage_accounting)
+                {
+                    // Aborted by the quota check
+                    m_owner->check_quota();
+                }
                 throw runtime_error(lua_tostring(m_state, -1));
             }
         }
         catch (...)
         {
             m_promise.set_exception(std::current_exception());
+            finished();
         }
     }
     return status::finished;
 }
 
+void thread::finished() noexcept
+{
+    slow_call record;
+    if (m_timer != nullptr && m_timer->finished(record))
+    {
+        try
+        {
+            m_owner->m_configuration.slow_call_function()(record);
+        }
+        catch (...)
+        {
+            // The sink must not break the call
+        }
+    }
+    m_timer.reset();
+}
+
+bool thread::is_deprioritized() const
+{
+    return m_owner != nullptr && m_owner->m_usage_accounting &&
+           m_owner->m_configuration.usage_quota().action == quota_action::deprioritize && m_owner->quota_exceeded();
+}
+
+bool thread::is_waiting() const
+{
+    return m_waiting.valid() && m_waiting.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+bool thread::wait_for(std::chrono::nanoseconds timeout) const
+{
+    return !m_waiting.valid() || m_waiting.wait_for(timeout) == std::future_status::ready;
+}
+
 bool thread::is_runnable() const
 {
     switch (lua_status(m_state))
@@ -191,23 +764,78 @@ bool thread::is_runnable() const
 
 void cooperative_executor::add_thread(thread thread)
 {
-    threads.push(std::move(thread));
+    threads.push_back(std::move(thread));
 }
 
 // Runs all added threads until they finish
 void cooperative_executor::run()
 {
-    while (!threads.empty())
+    for (;;)
     {
-        auto thread = std::move(threads.front());
-        threads.pop();
-
-        // Run the thread
-        switch (thread.run())
+        if (m_pass == 0)
         {
-        case thread::status::yielded:
+            // A pass over the queue ended; queue the waiting threads whose data is ready
+            queue_ready_threads();
+            if (m_head == threads.size())
+            {
+                if (!m_deprioritized.empty())
+                {
+                    // Only threads of scripts over their quota are left; run each of them once
+                    m_promoted = m_deprioritized.size();
+                    std::move(m_deprioritized.begin(), m_deprioritized.end(), std::back_inserter(threads));
+                    m_deprioritized.clear();
+                }
+                else if (!m_waiting.empty())
+                {
+                    // All threads wait; block until the data of one is ready
+                    wait_for_any();
+                    queue_ready_threads();
+                }
+                else
+                {
+                    break;
+                }
+            }
+            m_pass = threads.size() - m_head;
+        }
+        --m_pass;
+
+        // Move the thread out, since running it may add threads
+        auto thread = std::move(threads[m_head++]);
+
+        // Reclaim the space of threads that have been taken from the queue
+        if (m_head * 2 >= threads.size())
+        {
+            threads.erase(threads.begin(), threads.begin() + m_head);
+            m_head = 0;
+        }
+
+        const bool promoted = (m_promoted > 0);
+        if (promoted)
+        {
+            --m_promoted;
+        }
+
+        // Resuming a thread that waits for data would only yield again
+        if (thread.is_waiting())
+        {
+            m_waiting.push_back(std::move(thread));
+            continue;
+        }
+
+        // Threads of scripts over their quota only run if no other threads can
+        if (!promoted && thread.is_deprioritized())
+        {
+            m_deprioritized.push_back(std::move(thread));
+            continue;
+        }
+
+        // Run the thread
+        switch (thread.run())
+        {
+        case thread::status::yielded:
             // Push the thread back on the queue
-            threads.push(std::move(thread));
+            threads.push_back(std::move(thread));
             break;
 
         case thread::status::finished:
@@ -217,6 +845,47 @@ void cooperative_executor::run()
     }
 }
 
+void cooperative_executor::queue_ready_threads()
+{
+    auto waiting = m_waiting.begin();
+    for (auto& thread : m_waiting)
+    {
+        if (thread.is_waiting())
+        {
+            if (&*waiting != &thread)
+            {
+                *waiting = std::move(thread);
+            }
+            ++waiting;
+        }
+        else
+        {
+            threads.push_back(std::move(thread));
+        }
+    }
+    m_waiting.erase(waiting, m_waiting.end());
+}
+
+void cooperative_executor::wait_for_any() const
+{
+    // There's no way to wait for any of several futures, so wait for each in turn for a short time
+    constexpr auto slice = std::chrono::milliseconds(1);
+    for (;;)
+    {
+        for (const auto& thread : m_waiting)
+        {
+            if (thread.wait_for(std::chrono::nanoseconds(0)))
+            {
+                return;
+            }
+        }
+        if (m_waiting.front().wait_for(slice))
+        {
+            return;
+        }
+    }
+}
+
 template <typename Whitelist>
 static bool contains(const Whitelist& whitelist, const char* value)
 {
@@ -262,27 +931,157 @@ static constexpr std::array<const char*, 10> baselib_whitelist =
     "assert", "pairs", "ipairs", "next", "select", "tonumber", "tostring", "type", "_G", "_VERSION"
 }};
 
-
-void script::load_builtins()
+static void load_base_library(lua_State& state)
 {
     // The "base" lib is special because:
     // a) it loads directly into the global table, and
     // b) it contains several methods with are undesired in a sandboxed environment
     // So we call it and then filter out the undesired methods
-    luaopen_base(m_state.get());
-    lua_pop(m_state.get(), 1);
-    filter_global_table(m_state.get(), baselib_whitelist);
+    luaopen_base(&state);
+    lua_pop(&state, 1);
+    filter_global_table(&state, baselib_whitelist);
+}
+
+// Loads a builtin library on first use of its global. This is the __index of the global table,
+// with an upvalue that's true if the vmath module is enabled.
+static int lazy_library_index(lua_State* state)
+{
+    if (lua_type(state, 2) != LUA_TSTRING)
+    {
+        return 0;
+    }
 
-    // Import the normal builtin libraries
+    const char* name = lua_tostring(state, 2);
     for (const auto& lib : s_builtin_libs)
     {
-        luaL_requiref(m_state.get(), lib.name, lib.func, 1);
-        lua_pop(m_state.get(), 1);
+        if (std::strcmp(lib.name, name) == 0)
+        {
+            luaL_requiref(state, lib.name, lib.func, 1);
+            return 1;
+        }
     }
+    if (lua_toboolean(state, lua_upvalueindex(1)) && std::strcmp(name, VECTOR_MATH_NAME) == 0)
+    {
+        luaL_requiref(state, VECTOR_MATH_NAME, &open_vector_math, 1);
+        return 1;
+    }
+    return 0;
+}
 
-    // Add our custom global methods
-    lua_pushcfunction(m_state.get(), &script::builtin_yield);
-    lua_setglobal(m_state.get(), "yield");
+// Loads the string library when a string is first indexed, e.g. for a method call. This is the
+// __index of the metatable of strings until the library replaces that metatable with its own.
+static int lazy_string_index(lua_State* state)
+{
+    // The library isn't stored as global, in case the script uses the name for something else
+    luaL_requiref(state, LUA_STRLIBNAME, &luaopen_string, 0);
+    lua_pushvalue(state, 2);
+    lua_gettable(state, -2);
+    return 1;
+}
+
+static void load_lazy_libraries(lua_State& state, bool vector_math)
+{
+    lua_pushglobaltable(&state);
+    lua_createtable(&state, 0, 1);
+    lua_pushboolean(&state, vector_math);
+    lua_pushcclosure(&state, &lazy_library_index, 1);
+    lua_setfield(&state, -2, "__index");
+    lua_setmetatable(&state, -2);
+    lua_pop(&state, 1);
+
+    lua_pushliteral(&state, "");
+    lua_createtable(&state, 0, 1);
+    lua_pushcfunction(&state, &lazy_string_index);
+    lua_setfield(&state, -2, "__index");
+    lua_setmetatable(&state, -2);
+    lua_pop(&state, 1);
+}
+
+namespace detail
+{
+    void load_sandboxed_libraries(lua_State& state)
+    {
+        load_base_library(state);
+
+        // Import the normal builtin libraries
+        for (const auto& lib : s_builtin_libs)
+        {
+            luaL_requiref(&state, lib.name, lib.func, 1);
+            lua_pop(&state, 1);
+        }
+    }
+
+    void push_callback(lua_State& state, const lua_callback& callback, bool instrumented)
+    {
+        // The callbacks are owned by the registry, which outlives the state
+        lua_pushlightuserdata(&state, const_cast<lua_callback*>(&callback));
+        lua_pushcclosure(&state, instrumented ? &lua_instrumented_trampoline : &lua_trampoline, 1);
+    }
+
+    void load_builtins(lua_State& state, const configuration& config)
+    {
+        if (config.lazy_builtins())
+        {
+            load_base_library(state);
+            load_lazy_libraries(state, config.vector_math());
+        }
+        else
+        {
+            load_sandboxed_libraries(state);
+        }
+
+        // Add our custom global methods
+        lua_pushcfunction(&state, &builtin_yield);
+        lua_setglobal(&state, "yield");
+
+        // The methods of string buffers
+        static const std::array<luaL_Reg, 4> string_buffer_metamethods =
+        {{
+            {"__gc", &string_buffer_gc},
+            {"__len", &string_buffer_len},
+            {"__tostring", &string_buffer_tostring},
+            {nullptr, nullptr},
+        }};
+        static const std::array<luaL_Reg, 3> string_buffer_methods =
+        {{
+            {"append", &string_buffer_append},
+            {"tostring", &string_buffer_tostring},
+            {nullptr, nullptr},
+        }};
+
+        luaL_newmetatable(&state, STRING_BUFFER_METATABLE);
+        luaL_setfuncs(&state, string_buffer_metamethods.data(), 0);
+        lua_createtable(&state, 0, static_cast<int>(string_buffer_methods.size()));
+        luaL_setfuncs(&state, string_buffer_methods.data(), 0);
+        if (config.lazy_builtins())
+        {
+            lua_pushnil(&state);
+        }
+        else
+        {
+            lua_getglobal(&state, LUA_STRLIBNAME);
+            lua_getfield(&state, -1, "format");
+            lua_remove(&state, -2);
+        }
+        lua_pushcclosure(&state, &string_buffer_appendf, 1);
+        lua_setfield(&state, -2, "appendf");
+        lua_setfield(&state, -2, "__index");
+        lua_pop(&state, 1);
+
+        lua_pushcfunction(&state, &builtin_string_buffer);
+        lua_setglobal(&state, "string_buffer");
+
+        if (config.vector_math() && !config.lazy_builtins())
+        {
+            luaL_requiref(&state, VECTOR_MATH_NAME, &open_vector_math, 1);
+            lua_pop(&state, 1);
+        }
+    }
+}
+
+void script::load_builtins()
+{
+    detail::load_builtins(*m_state, m_configuration);
 
     lua_pushcfunction(m_state.get(), &script::builtin_require);
     lua_setglobal(m_state.get(), "require");
@@ -291,46 +1090,343 @@ void script::load_builtins()
 script::script(const std::string& name, const std::vector<char>& buffer, const configuration& config, std::shared_ptr<type_registry> registry)
     : m_configuration(config)
     , m_registry(std::move(registry))
-    , m_state(create_lua_state())
+    , m_state(create_lua_state(m_allocations))
+    , m_profiler(*m_state)
+{
+    trace_span span(m_configuration.tracer().get(), "script", [&]{
+        return trace_arguments{{"name", name}, {"size", static_cast<long long>(buffer.size())}};
+    });
+    initialize();
+    run(buffer, name);
+    finish_construction();
+}
+
+script::script(const std::string& name, const script_snapshot& snapshot, const configuration& config, std::shared_ptr<type_registry> registry)
+    : m_configuration(config)
+    , m_registry(std::move(registry))
+    , m_state(create_lua_state(m_allocations))
+    , m_profiler(*m_state)
+{
+    trace_span span(m_configuration.tracer().get(), "script", [&]{
+        return trace_arguments{{"name", name}, {"snapshot_size", static_cast<long long>(snapshot.data().size())}};
+    });
+    initialize();
+    restore(snapshot, name);
+    finish_construction();
+}
+
+script::script(const configuration& config, std::shared_ptr<type_registry> registry)
+    : m_configuration(config)
+    , m_registry(std::move(registry))
+    , m_state(create_lua_state(m_allocations))
+    , m_profiler(*m_state)
+{
+    initialize();
+}
+
+struct detail::pending_script
+{
+    std::unique_ptr<script> instance;
+    std::string name;
+    script_data buffer;
+    std::promise<std::unique_ptr<script>> promise;
+    std::exception_ptr error;
+    bool finished = false;
+
+    // Owned by the thread that runs the chunk, so this runs once the thread has been released
+    ~pending_script()
+    {
+        if (finished)
+        {
+            promise.set_value(std::move(instance));
+        }
+        else
+        {
+            promise.set_exception(error != nullptr ? error : std::make_exception_ptr(runtime_error("Script construction was abandoned")));
+        }
+    }
+};
+
+std::future<std::unique_ptr<script>> script::create_async(executor& executor, const std::string& name, const script_data& buffer,
+                                                          const configuration& config, std::shared_ptr<type_registry> registry)
+{
+    auto pending = std::make_shared<detail::pending_script>();
+    pending->instance.reset(new script(config, std::move(registry)));
+    pending->name = name;
+    pending->buffer = buffer;
+    auto future = pending->promise.get_future();
+
+    lua_State* state = pending->instance->m_state.get();
+    lua_pushlightuserdata(state, pending.get());
+    lua_pushcclosure(state, &script::run_pending, 1);
+    thread t(*state, 0, pending->instance.get(), name);
+    t.m_completion = std::move(pending);
+    executor.add_thread(std::move(t));
+    return future;
+}
+
+int script::run_pending(lua_State* state)
+{
+    auto* pending = static_cast<detail::pending_script*>(lua_touserdata(state, lua_upvalueindex(1)));
+    switch (luaL_loadbuffer(state, pending->buffer.data(), pending->buffer.size(), pending->name.c_str()))
+    {
+    case LUA_OK:
+        break;
+    case LUA_ERRMEM:
+        pending->error = std::make_exception_ptr(std::bad_alloc());
+        return 0;
+    case LUA_ERRSYNTAX:
+        pending->error = std::make_exception_ptr(syntax_error(lua_tostring(state, -1)));
+        return 0;
+    default:
+        pending->error = std::make_exception_ptr(runtime_error(lua_tostring(state, -1)));
+        return 0;
+    }
+
+    // The source isn't needed anymore
+    script_data().swap(pending->buffer);
+
+    // Errors are caught, so they're reported through the future of the script rather than that of the thread
+    const auto context = reinterpret_cast<lua_KContext>(pending);
+    return finish_pending(state, lua_pcallk(state, 0, 0, 0, context, &script::finish_pending), context);
+}
+
+int script::finish_pending(lua_State* state, int status, lua_KContext context)
+{
+    // The status is LUA_YIELD if the chunk finished after yielding
+    auto* pending = reinterpret_cast<detail::pending_script*>(context);
+    switch (status)
+    {
+    case LUA_OK:
+    case LUA_YIELD:
+        pending->instance->finish_construction();
+        pending->finished = true;
+        break;
+    case LUA_ERRMEM:
+        pending->error = std::make_exception_ptr(std::bad_alloc());
+        break;
+    default:
+        pending->error = std::make_exception_ptr(runtime_error(lua_tostring(state, -1)));
+        break;
+    }
+    return 0;
+}
+
+void script::initialize()
 {
     // Store a reference to ourselves so we can get the script instance from the state.
     lua_pushlightuserdata(m_state.get(), this);
     lua_setfield(m_state.get(), LUA_REGISTRYINDEX, SELF_KEY_NAME);
 
+    // luaL_ref keeps its free list at registry[0] and ends it with nil. Ending it with 0 instead keeps the
+    // key alive when the list runs empty, so the collector never removes it and each reference taken
+    // after that doesn't reinsert it, which could rehash the registry on every call.
+    lua_pushinteger(m_state.get(), 0);
+    lua_rawseti(m_state.get(), LUA_REGISTRYINDEX, 0);
+
+    auto* tracer = m_configuration.tracer().get();
+
     // Load the built-in methods
-    load_builtins();
+    {
+        trace_span span(tracer, "load_builtins");
+        load_builtins();
+    }
 
     if (m_registry != nullptr)
     {
+        trace_span span(tracer, "register_functions", [&]{
+            return trace_arguments{{"count", static_cast<long long>(m_registry->free_functions().size())}};
+        });
+
         // Register the free functions as global functions before executing
         for (const auto& [method_name, callback] : m_registry->free_functions())
         {
-            lua_pushlightuserdata(m_state.get(), callback.get());
-            lua_pushcclosure(m_state.get(), &lua_trampoline, 1);
+            push_callback(*m_state.get(), *callback);
             lua_setglobal(m_state.get(), method_name.c_str());
         }
     }
 
-    run(buffer, name);
+    m_usage_accounting = m_configuration.usage_accounting();
+    if (m_usage_accounting)
+    {
+        // Threads inherit the hook; the profiler keeps calling it while sampling
+        lua_sethook(m_state.get(), &script::usage_hook, LUA_MASKCOUNT, script_usage::INSTRUCTION_GRANULARITY);
+    }
+
+    if (m_configuration.profiler_sample_interval() > 0)
+    {
+        m_profiler.start(m_configuration.profiler_sample_interval());
+    }
+}
+
+void script::finish_construction()
+{
+    if (m_configuration.compact_after_load())
+    {
+        trace_span span(m_configuration.tracer().get(), "compact");
+
+        // A full collection shrinks the string table by at most half, so collect until nothing changes
+        std::size_t before = 0;
+        do
+        {
+            before = m_allocations.live_bytes();
+            lua_gc(m_state.get(), LUA_GCCOLLECT, 0);
+        } while (m_allocations.live_bytes() < before);
+    }
+    m_baseline_memory = m_allocations.live_bytes();
+}
+
+bool script::is_builtin_global(lua_State& state, int index) const
+{
+    if (lua_type(&state, index) != LUA_TSTRING)
+    {
+        return false;
+    }
+
+    const char* name = lua_tostring(&state, index);
+    if (contains(baselib_whitelist, name) || std::strcmp(name, "yield") == 0 || std::strcmp(name, "require") == 0 || std::strcmp(name, "string_buffer") == 0)
+    {
+        return true;
+    }
+    if (m_configuration.vector_math() && std::strcmp(name, VECTOR_MATH_NAME) == 0)
+    {
+        return true;
+    }
+    if (std::any_of(s_builtin_libs.begin(), s_builtin_libs.end(), [&](const luaL_Reg& lib) { return std::strcmp(lib.name, name) == 0; }))
+    {
+        return true;
+    }
+    return m_registry != nullptr && m_registry->free_functions().count(name) != 0;
+}
+
+script_snapshot script::snapshot() const
+{
+    lua_State* state = m_state.get();
+    const int top = lua_gettop(state);
+    script_data data(SNAPSHOT_MAGIC.begin(), SNAPSHOT_MAGIC.end());
+
+    try
+    {
+        lua_newtable(state);
+
+        // Copy all non-builtin globals into a table, so shared values are stored once
+        lua_newtable(state);
+        lua_pushglobaltable(state);
+        lua_pushnil(state);
+        while (lua_next(state, -2) != 0)
+        {
+            if (is_builtin_global(*state, -2))
+            {
+                lua_pop(state, 1);
+                continue;
+            }
+            lua_pushvalue(state, -2);
+            lua_insert(state, -2);
+            lua_rawset(state, -5);
+        }
+        lua_pop(state, 1);
+        lua_setfield(state, -2, "globals");
+
+        lua_newtable(state);
+        lua_Integer index = 0;
+        for (const auto& libname : m_loaded_libraries)
+        {
+            lua_pushstring(state, libname.c_str());
+            lua_rawseti(state, -2, ++index);
+        }
+        lua_setfield(state, -2, "libraries");
+
+        value_writer writer(data);
+        writer.allow_functions(true);
+        writer.allow_objects(true);
+        writer.write(*state, -1);
+    }
+    catch (...)
+    {
+        lua_settop(state, top);
+        throw;
+    }
+    lua_settop(state, top);
+    return script_snapshot(std::move(data));
+}
+
+void script::restore(const script_snapshot& snapshot, const std::string& name)
+{
+    trace_span span(m_configuration.tracer().get(), "restore", [&]{ return trace_arguments{{"name", name}}; });
+
+    const auto& data = snapshot.data();
+    if (data.size() < SNAPSHOT_MAGIC.size() || !std::equal(SNAPSHOT_MAGIC.begin(), SNAPSHOT_MAGIC.end(), data.begin()))
+    {
+        throw serialization_error("Invalid snapshot for script \"" + name + "\"");
+    }
+
+    value_reader reader(data.data() + SNAPSHOT_MAGIC.size(), data.size() - SNAPSHOT_MAGIC.size());
+    reader.allow_functions(true);
+    reader.read(*m_state.get());
+    if (!reader.empty() || !lua_istable(m_state.get(), -1))
+    {
+        throw serialization_error("Invalid snapshot for script \"" + name + "\"");
+    }
+
+    // Restore the globals
+    lua_pushglobaltable(m_state.get());
+    if (lua_getfield(m_state.get(), -2, "globals") == LUA_TTABLE)
+    {
+        lua_pushnil(m_state.get());
+        while (lua_next(m_state.get(), -2) != 0)
+        {
+            lua_pushvalue(m_state.get(), -2);
+            lua_insert(m_state.get(), -2);
+            lua_rawset(m_state.get(), -5);
+        }
+    }
+    lua_pop(m_state.get(), 2);
+
+    // Restore the loaded libraries
+    if (lua_getfield(m_state.get(), -1, "libraries") == LUA_TTABLE)
+    {
+        for (lua_Integer i = 1; lua_rawgeti(m_state.get(), -1, i) == LUA_TSTRING; ++i)
+        {
+            m_loaded_libraries.insert(lua_tostring(m_state.get(), -1));
+            lua_pop(m_state.get(), 1);
+        }
+        lua_pop(m_state.get(), 1);
+    }
+    lua_pop(m_state.get(), 2);
 }
 
 void script::run(const script_data& buffer, const std::string& name)
 {
+    auto* tracer = m_configuration.tracer().get();
+
     // Load script into state
-    switch (luaL_loadbuffer(m_state.get(), buffer.data(), buffer.size(), name.c_str()))
     {
-    case LUA_OK:
-        break;
-    case LUA_ERRMEM:
-        throw std::bad_alloc();
-    case LUA_ERRSYNTAX:
-        throw syntax_error(lua_tostring(m_state.get(), -1));
-    default:
-        throw runtime_error(lua_tostring(m_state.get(), -1));
+        trace_span span(tracer, "compile", [&]{
+            return trace_arguments{{"name", name}, {"size", static_cast<long long>(buffer.size())}};
+        });
+        switch (luaL_loadbuffer(m_state.get(), buffer.data(), buffer.size(), name.c_str()))
+        {
+        case LUA_OK:
+            break;
+        case LUA_ERRMEM:
+            throw std::bad_alloc();
+        case LUA_ERRSYNTAX:
+            throw syntax_error(lua_tostring(m_state.get(), -1));
+        default:
+            throw runtime_error(lua_tostring(m_state.get(), -1));
+        }
     }
 
     // Execute top-level chunk
-    switch (lua_pcall(m_state.get(), 0, 0, 0))
+    trace_span span(tracer, "execute", [&]{ return trace_arguments{{"name", name}}; });
+    const bool metered = begin_usage();
+    const int result = lua_pcall(m_state.get(), 0, 0, 0);
+    if (metered)
+    {
+        end_usage();
+    }
+
+    switch (result)
     {
     case LUA_OK:
         break;
@@ -349,12 +1445,39 @@ void script::set_object_methods(lua_State& state, std::type_index type) const
 
     for (const auto& [name, callback] : info->methods())
     {
-        lua_pushlightuserdata(&state, callback.get());
-        lua_pushcclosure(&state, &lua_trampoline, 1);
+        push_callback(state, *callback);
         lua_setfield(&state, -2, name.c_str());
     }
 }
 
+void script::push_callback(lua_State& state, const detail::lua_callback& callback) const
+{
+    detail::push_callback(state, callback, m_registry->collect_statistics());
+}
+
+std::shared_future<script_data> detail::library_fetcher::fetch(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Fetches that finished are handed to the requires that were waiting for them; later requires fetch again
+    for (auto it = m_fetches.begin(); it != m_fetches.end();)
+    {
+        it = (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) ? m_fetches.erase(it) : std::next(it);
+    }
+
+    auto& fetch = m_fetches[name];
+    if (!fetch.valid())
+    {
+        auto future = m_load_function(name);
+        if (!future.valid())
+        {
+            throw runtime_error("cannot load library \"" + name + "\"");
+        }
+        fetch = future.share();
+    }
+    return fetch;
+}
+
 configuration script::default_configuration()
 {
     return configuration{};
@@ -376,19 +1499,31 @@ int script::builtin_require(lua_State* state)
         return luaL_error(state, "Invalid call to require()");
     }
 
-    const char* libname = lua_tostring(state, 1);
-    if (libname == nullptr)
+    if (lua_tostring(state, 1) == nullptr)
     {
         return luaL_error(state, "Missing argument to require()");
     }
+    return continue_require(state, LUA_OK, 0);
+}
 
-    return catch_exceptions(state, [&]{
-        s->load_library(libname);
-        return 0;
+int script::continue_require(lua_State* state, int, lua_KContext)
+{
+    // The library name stays at index 1 while the thread yields
+    script* s = script_from_state(*state);
+    const char* libname = lua_tostring(state, 1);
+    const int loaded = catch_exceptions(state, [&]{
+        return s->load_library(*state, libname) ? 1 : 0;
     });
+
+    // Yield outside of the scope of C++ objects, since it doesn't unwind the C++ stack
+    if (loaded == 0)
+    {
+        return lua_yieldk(state, 0, 0, &script::continue_require);
+    }
+    return 0;
 }
 
-void script::load_library(const std::string& libname)
+bool script::load_library(lua_State& state, const std::string& libname)
 {
     const std::string sanitized_libname = trim(libname);
     if (sanitized_libname.empty())
@@ -397,23 +1532,170 @@ void script::load_library(const std::string& libname)
     }
 
     const script_load_function load_fn = m_configuration.load_function();
-    if (!load_fn)
+    const auto& fetcher = m_configuration.m_library_fetcher;
+    if (!load_fn && fetcher == nullptr)
     {
         throw apolo::runtime_error("cannot load libraries");
     }
 
-    if (m_loaded_libraries.find(sanitized_libname) == m_loaded_libraries.end())
+    if (m_loaded_libraries.find(sanitized_libname) != m_loaded_libraries.end())
+    {
+        return true;
+    }
+
+    auto* tracer = m_configuration.tracer().get();
+    if (fetcher != nullptr)
     {
-        // Library hasn't been loaded yet -- load it
+        // Threads that require the library while it's fetched wait for the same fetch
+        auto pending = m_pending_libraries.find(sanitized_libname);
+        if (pending == m_pending_libraries.end())
+        {
+            trace_span load_span(tracer, "load_function", [&]{ return trace_arguments{{"library", sanitized_libname}}; });
+            pending = m_pending_libraries.emplace(sanitized_libname, fetcher->fetch(sanitized_libname)).first;
+        }
+
+        if (lua_isyieldable(&state))
+        {
+            if (pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                // The thread takes the fetch when it yielded, so its executor can wait for it
+                m_waiting_fetch = pending->second;
+                return false;
+            }
+        }
+        else
+        {
+            pending->second.wait();
+        }
+
+        // The first thread to see the fetch finished runs the library
+        const auto fetch = std::move(pending->second);
+        m_pending_libraries.erase(pending);
         m_loaded_libraries.insert(sanitized_libname);
 
-        run(load_fn(sanitized_libname), sanitized_libname);
+        trace_span span(tracer, "require", [&]{ return trace_arguments{{"library", sanitized_libname}}; });
+        run(fetch.get(), sanitized_libname);
+        return true;
+    }
+
+    // Library hasn't been loaded yet -- load it
+    m_loaded_libraries.insert(sanitized_libname);
+
+    trace_span span(tracer, "require", [&]{ return trace_arguments{{"library", sanitized_libname}}; });
+
+    script_data buffer;
+    {
+        trace_span load_span(tracer, "load_function", [&]{ return trace_arguments{{"library", sanitized_libname}}; });
+        buffer = load_fn(sanitized_libname);
+    }
+    run(buffer, sanitized_libname);
+    return true;
+}
+
+void script::thread_resuming()
+{
+    m_profiler.resume();
+}
+
+bool script::begin_usage()
+{
+    if (!m_usage_accounting)
+    {
+        return false;
+    }
+
+    // Nested runs, e.g. of libraries, are accounted by the outermost run
+    if (m_usage_depth++ == 0)
+    {
+        m_usage_cpu_start = thread_cpu_time();
+        m_usage_wall_start = std::chrono::steady_clock::now();
+    }
+    return true;
+}
+
+void script::end_usage()
+{
+    if (--m_usage_depth == 0)
+    {
+        m_usage.cpu_time += thread_cpu_time() - m_usage_cpu_start;
+        m_usage.wall_time += std::chrono::steady_clock::now() - m_usage_wall_start;
+    }
+}
+
+script_usage script::usage() const
+{
+    auto usage = m_usage;
+    if (m_usage_depth > 0)
+    {
+        // Include the running code
+        usage.cpu_time += thread_cpu_time() - m_usage_cpu_start;
+        usage.wall_time += std::chrono::steady_clock::now() - m_usage_wall_start;
+    }
+    return usage;
+}
+
+void script::reset_usage()
+{
+    m_usage = {};
+    m_usage_cpu_start = thread_cpu_time();
+    m_usage_wall_start = std::chrono::steady_clock::now();
+}
+
+bool script::quota_exceeded() const
+{
+    const auto& quota = m_configuration.usage_quota();
+    if (quota.instructions > 0 && m_usage.instructions >= quota.instructions)
+    {
+        return true;
     }
+
+    // Only read the clock if needed, as this is called from the instruction hook
+    return quota.cpu_time.count() > 0 && usage().cpu_time >= quota.cpu_time;
 }
 
-int script::builtin_yield(lua_State* state)
+void script::mark_pure(const std::string& name, std::size_t capacity)
 {
-    return lua_yield(state, lua_gettop(state));
+    if (capacity == 0)
+    {
+        throw runtime_error("The results cache of a pure function needs a capacity");
+    }
+    m_memoized.try_emplace(name, capacity);
+}
+
+memoization_statistics script::memoization(const std::string& name) const
+{
+    const auto it = m_memoized.find(name);
+    if (it == m_memoized.end())
+    {
+        throw runtime_error("Function \"" + name + "\" is not marked as pure");
+    }
+    return it->second.statistics();
+}
+
+void script::invalidate_memoized()
+{
+    for (auto& [name, cache] : m_memoized)
+    {
+        cache.clear();
+    }
+}
+
+void script::check_quota() const
+{
+    if (m_configuration.usage_quota().action == quota_action::reject && quota_exceeded())
+    {
+        throw quota_exceeded_error("Script exceeded its usage quota");
+    }
+}
+
+void script::usage_hook(lua_State* state, lua_Debug*)
+{
+    script* s = script_from_state(*state);
+    s->m_usage.instructions += static_cast<std::uint64_t>(lua_gethookcount(state));
+    if (s->m_configuration.usage_quota().action == quota_action::reject && s->quota_exceeded())
+    {
+        luaL_error(state, "Script exceeded its usage quota");
+    }
 }
 
 }
@@ -0,0 +1,57 @@
+#include <apolo/bulk_construction.h>
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+namespace apolo
+{
+
+std::vector<script_construction> construct_scripts(const std::vector<script_definition>& definitions, std::size_t threads)
+{
+    std::vector<script_construction> results(definitions.size());
+
+    // Threads take the next definition until there are none left, so long constructions don't hold up the others
+    std::atomic<std::size_t> next{0};
+    const auto work = [&] {
+        for (std::size_t i = next++; i < definitions.size(); i = next++)
+        {
+            const auto& definition = definitions[i];
+            try
+            {
+                results[i].instance = std::make_unique<script>(definition.name, definition.buffer, definition.config, definition.registry);
+            }
+            catch (...)
+            {
+                results[i].error = std::current_exception();
+            }
+        }
+    };
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, definitions.size());
+
+    std::vector<std::thread> workers;
+    try
+    {
+        for (std::size_t i = 1; i < threads; ++i)
+        {
+            workers.emplace_back(work);
+        }
+    }
+    catch (const std::system_error&)
+    {
+        // The calling thread constructs whatever the threads that could be started don't
+    }
+    work();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    return results;
+}
+
+}
@@ -0,0 +1,311 @@
+#include <apolo/expression_set.h>
+#include <algorithm>
+
+namespace apolo
+{
+
+namespace
+{
+    // Stack index of the table with the compiled expressions in the Lua state of a set
+    constexpr int EXPRESSIONS_INDEX = 1;
+
+    // Stack index of the table with the batch functions of the expressions, by expression index
+    constexpr int BATCH_FUNCTIONS_INDEX = 2;
+
+    // Stack index of the table with the tables of a block of results and column values, reused by all batches
+    constexpr int BATCH_TABLES_INDEX = 3;
+
+    // Number of rows that a batch function evaluates between calls into C++. A multiple of 64, so
+    // blocks start at a word of the selection bitmap.
+    constexpr std::size_t BLOCK_ROWS = 1024;
+
+    // State of the evaluation of a batch, shared with the batch function through load_block
+    struct batch
+    {
+        const std::vector<column>& columns;
+        std::size_t rows;
+        double* results;
+        std::uint64_t* selection;
+        std::size_t position = 0;
+    };
+
+    // Pops the error message of a failed call or compilation
+    std::string pop_error(lua_State& state)
+    {
+        const char* message = lua_tostring(&state, -1);
+        std::string result = (message != nullptr) ? message : "unknown error";
+        lua_pop(&state, 1);
+        return result;
+    }
+}
+
+expression_set::expression_set(std::vector<std::string> parameters, std::shared_ptr<type_registry> registry)
+    : m_parameters(std::move(parameters))
+    , m_registry(std::move(registry))
+    , m_state(luaL_newstate())
+{
+    if (m_state == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    detail::load_sandboxed_libraries(*m_state);
+    if (m_registry != nullptr)
+    {
+        for (const auto& [name, callback] : m_registry->free_functions())
+        {
+            detail::push_callback(*m_state, *callback, m_registry->collect_statistics());
+            lua_setglobal(m_state.get(), name.c_str());
+        }
+    }
+    lua_newtable(m_state.get());
+    lua_newtable(m_state.get());
+    lua_newtable(m_state.get());
+
+    // Every expression is compiled as the body of a function with the parameters as arguments,
+    // so they're locals in the expression instead of globals
+    m_prefix = "return function(";
+    for (std::size_t i = 0; i < m_parameters.size(); ++i)
+    {
+        m_prefix += (i == 0 ? "" : ", ") + m_parameters[i];
+    }
+    m_prefix += ") return (";
+    m_suffix = "\n) end";
+
+    const std::string check = m_prefix + "nil" + m_suffix;
+    if (luaL_loadbufferx(m_state.get(), check.data(), check.size(), "=parameters", "t") != LUA_OK)
+    {
+        throw runtime_error("Invalid parameter names: " + pop_error(*m_state));
+    }
+    lua_pop(m_state.get(), 1);
+}
+
+expression_set::handle expression_set::add(const std::string& expression)
+{
+    // All expressions share the chunk name, so it's stored once
+    const std::string source = m_prefix + expression + m_suffix;
+    if (luaL_loadbufferx(m_state.get(), source.data(), source.size(), "=expression", "t") != LUA_OK)
+    {
+        throw runtime_error("Invalid expression '" + expression + "': " + pop_error(*m_state));
+    }
+
+    // Running the chunk returns the function of the expression
+    call(0);
+    if (!lua_isfunction(m_state.get(), -1))
+    {
+        lua_pop(m_state.get(), 1);
+        throw runtime_error("Invalid expression: " + expression);
+    }
+    lua_rawseti(m_state.get(), EXPRESSIONS_INDEX, static_cast<lua_Integer>(++m_size));
+    m_expressions.push_back(expression);
+    return {static_cast<int>(m_size)};
+}
+
+void expression_set::evaluate_batch(handle expression, const std::vector<column>& columns, std::size_t rows, array_view<double> results)
+{
+    if (results.size() < rows)
+    {
+        throw runtime_error("Results have less elements than rows");
+    }
+    run_batch(expression, columns, rows, results.data(), nullptr);
+}
+
+void expression_set::test_batch(handle expression, const std::vector<column>& columns, std::size_t rows, array_view<std::uint64_t> selection)
+{
+    if (selection.size() < (rows + 63) / 64)
+    {
+        throw runtime_error("Selection has less bits than rows");
+    }
+    run_batch(expression, columns, rows, nullptr, selection.data());
+}
+
+std::size_t expression_set::memory() const
+{
+    const int kilobytes = lua_gc(m_state.get(), LUA_GCCOUNT, 0);
+    const int bytes = lua_gc(m_state.get(), LUA_GCCOUNTB, 0);
+    return static_cast<std::size_t>(kilobytes) * 1024 + static_cast<std::size_t>(bytes);
+}
+
+void expression_set::push_function(handle expression, std::size_t arguments)
+{
+    if (expression.index < 1 || static_cast<std::size_t>(expression.index) > m_size)
+    {
+        throw runtime_error("Invalid expression handle");
+    }
+    if (arguments != m_parameters.size())
+    {
+        throw runtime_error("Wrong number of arguments to expression");
+    }
+    if (!lua_checkstack(m_state.get(), static_cast<int>(arguments) + 1))
+    {
+        throw runtime_error("Too many arguments to expression");
+    }
+    lua_rawgeti(m_state.get(), EXPRESSIONS_INDEX, expression.index);
+}
+
+void expression_set::run_batch(handle expression, const std::vector<column>& columns, std::size_t rows, double* results, std::uint64_t* selection)
+{
+    if (columns.size() != m_parameters.size())
+    {
+        throw runtime_error("Wrong number of columns for expression");
+    }
+    for (const auto& column : columns)
+    {
+        if (column.size() < rows)
+        {
+            throw runtime_error("Column has less elements than rows");
+        }
+    }
+    if (!lua_checkstack(m_state.get(), static_cast<int>(columns.size()) + 3))
+    {
+        throw runtime_error("Too many columns for expression");
+    }
+
+    push_batch_function(expression, selection != nullptr);
+    batch context{columns, rows, results, selection};
+    lua_pushlightuserdata(m_state.get(), &context);
+    lua_pushcclosure(m_state.get(), &load_block, 1);
+    for (std::size_t i = 1; i <= columns.size() + 1; ++i)
+    {
+        if (lua_rawgeti(m_state.get(), BATCH_TABLES_INDEX, static_cast<lua_Integer>(i)) == LUA_TNIL)
+        {
+            lua_pop(m_state.get(), 1);
+            lua_createtable(m_state.get(), static_cast<int>(BLOCK_ROWS), 0);
+            lua_pushvalue(m_state.get(), -1);
+            lua_rawseti(m_state.get(), BATCH_TABLES_INDEX, static_cast<lua_Integer>(i));
+        }
+    }
+    call(columns.size() + 2);
+    lua_pop(m_state.get(), 1);
+}
+
+void expression_set::push_batch_function(handle expression, bool selection)
+{
+    if (expression.index < 1 || static_cast<std::size_t>(expression.index) > m_size)
+    {
+        throw runtime_error("Invalid expression handle");
+    }
+
+    // Batch functions for selections are stored at the negated index of the expression
+    const lua_Integer key = selection ? -expression.index : expression.index;
+    if (lua_rawgeti(m_state.get(), BATCH_FUNCTIONS_INDEX, key) != LUA_TNIL)
+    {
+        return;
+    }
+    lua_pop(m_state.get(), 1);
+
+    // The expression is inlined in the loop over the rows. Names of the loop start with more
+    // underscores than any parameter, so they don't clash with the parameters.
+    std::size_t underscores = 1;
+    for (const auto& parameter : m_parameters)
+    {
+        underscores = std::max(underscores, parameter.find_first_not_of('_') + 1);
+    }
+    const std::string prefix(underscores, '_');
+    std::string arguments = prefix + "results";
+    std::string parameters;
+    std::string values;
+    for (std::size_t i = 0; i < m_parameters.size(); ++i)
+    {
+        const std::string column = prefix + "c" + std::to_string(i + 1);
+        arguments += ", " + column;
+        parameters += (i == 0 ? "" : ", ") + m_parameters[i];
+        values += (i == 0 ? "" : ", ") + column + "[" + prefix + "i]";
+    }
+    const std::string row = m_parameters.empty() ? "" : "local " + parameters + " = " + values + "\n";
+    const std::string& code = m_expressions[static_cast<std::size_t>(expression.index) - 1];
+
+    // For a selection, the loop sets the bits of a word of the bitmap per 64 rows instead of
+    // storing a result per row
+    std::string loop;
+    if (selection)
+    {
+        loop = "for " + prefix + "w = 0, (" + prefix + "n - 1) // 64 do\n"
+               "local " + prefix + "word, " + prefix + "base = 0, " + prefix + "w * 64\n"
+               "local " + prefix + "last = " + prefix + "base + 64\n"
+               "if " + prefix + "last > " + prefix + "n then " + prefix + "last = " + prefix + "n end\n"
+               "for " + prefix + "i = " + prefix + "base + 1, " + prefix + "last do\n" + row +
+               "if (" + code + "\n) then " + prefix + "word = " + prefix + "word | (1 << (" + prefix + "i - " + prefix + "base - 1)) end\n"
+               "end\n" +
+               prefix + "results[" + prefix + "w + 1] = " + prefix + "word\n"
+               "end\n";
+    }
+    else
+    {
+        loop = "for " + prefix + "i = 1, " + prefix + "n do\n" + row +
+               prefix + "results[" + prefix + "i] = (" + code + "\n)\n"
+               "end\n";
+    }
+    const std::string source = "return function(" + prefix + "load, " + arguments + ")\n"
+                               "local " + prefix + "n = " + prefix + "load(0, " + arguments + ")\n"
+                               "while " + prefix + "n > 0 do\n" + loop +
+                               prefix + "n = " + prefix + "load(" + prefix + "n, " + arguments + ")\n"
+                               "end\n"
+                               "end";
+    if (luaL_loadbufferx(m_state.get(), source.data(), source.size(), "=expression", "t") != LUA_OK)
+    {
+        throw runtime_error("Invalid expression: " + pop_error(*m_state));
+    }
+    call(0);
+    lua_pushvalue(m_state.get(), -1);
+    lua_rawseti(m_state.get(), BATCH_FUNCTIONS_INDEX, key);
+}
+
+int expression_set::load_block(lua_State* state)
+{
+    // Called by a batch function with the number of rows of the block it evaluated, the table of
+    // results (or words of the selection) and the tables of the columns. Stores the results and
+    // loads the next block.
+    auto& context = *static_cast<batch*>(lua_touserdata(state, lua_upvalueindex(1)));
+    const auto count = static_cast<std::size_t>(lua_tointeger(state, 1));
+    if (context.results != nullptr)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            lua_rawgeti(state, 2, static_cast<lua_Integer>(i + 1));
+            int is_number = 0;
+            double result = lua_tonumberx(state, -1, &is_number);
+            if (is_number == 0)
+            {
+                if (!lua_isboolean(state, -1) && !lua_isnil(state, -1))
+                {
+                    return luaL_error(state, "Result of row %d is not a number", static_cast<int>(context.position + i));
+                }
+                result = lua_toboolean(state, -1);
+            }
+            context.results[context.position + i] = result;
+            lua_pop(state, 1);
+        }
+    }
+    else
+    {
+        for (std::size_t word = 0; word * 64 < count; ++word)
+        {
+            lua_rawgeti(state, 2, static_cast<lua_Integer>(word + 1));
+            context.selection[context.position / 64 + word] = static_cast<std::uint64_t>(lua_tointeger(state, -1));
+            lua_pop(state, 1);
+        }
+    }
+    context.position += count;
+
+    const std::size_t rows = std::min(BLOCK_ROWS, context.rows - context.position);
+    for (std::size_t i = 0; i < context.columns.size(); ++i)
+    {
+        const auto& column = context.columns[i];
+        lua_pushvalue(state, static_cast<int>(i) + 3);
+        column.m_load(*state, column.m_data, context.position, rows);
+        lua_pop(state, 1);
+    }
+    lua_pushinteger(state, static_cast<lua_Integer>(rows));
+    return 1;
+}
+
+void expression_set::call(std::size_t arguments)
+{
+    if (lua_pcall(m_state.get(), static_cast<int>(arguments), 1, 0) != LUA_OK)
+    {
+        throw runtime_error(pop_error(*m_state));
+    }
+}
+
+}
@@ -0,0 +1,280 @@
+#include <apolo/profiler.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace apolo
+{
+
+namespace
+{
+    // Key for the running profiler in the Lua registry; only its address is used
+    char s_registry_key;
+
+    // Frame names cannot contain the separators of the folded stacks format
+    std::string sanitize(std::string name)
+    {
+        std::replace_if(name.begin(), name.end(), [](char c) { return c == ';' || c == '\n'; }, '_');
+        return name;
+    }
+
+    // Returns the name of the source of a function, as given when loading it
+    std::string source_name(const lua_Debug& ar)
+    {
+        const char* source = ar.source;
+        if (*source == '=' || *source == '@')
+        {
+            return source + 1;
+        }
+        return (std::strchr(source, '\n') == nullptr) ? source : ar.short_src;
+    }
+
+    // Finds the name of the global variable holding the function on top of the stack
+    const char* global_name(lua_State& state)
+    {
+        const char* name = nullptr;
+        lua_pushglobaltable(&state);
+        lua_pushnil(&state);
+        while (name == nullptr && lua_next(&state, -2) != 0)
+        {
+            if (lua_type(&state, -2) == LUA_TSTRING && lua_rawequal(&state, -1, -4))
+            {
+                name = lua_tostring(&state, -2);
+                lua_pop(&state, 1);
+            }
+            lua_pop(&state, 1);
+        }
+        lua_pop(&state, 1);
+        return name;
+    }
+
+    std::vector<std::string> split_frames(const std::string& stack)
+    {
+        std::vector<std::string> frames;
+        std::string::size_type begin = 0;
+        for (auto end = stack.find(';'); end != std::string::npos; end = stack.find(';', begin))
+        {
+            frames.push_back(stack.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        frames.push_back(stack.substr(begin));
+        return frames;
+    }
+}
+
+sampling_profiler::~sampling_profiler()
+{
+    stop();
+}
+
+void sampling_profiler::start(int instructions)
+{
+    assert(instructions > 0);
+
+    lua_pushlightuserdata(&m_state, this);
+    lua_rawsetp(&m_state, LUA_REGISTRYINDEX, &s_registry_key);
+
+    if (!m_running)
+    {
+        m_previous_hook = lua_gethook(&m_state);
+        m_previous_mask = lua_gethookmask(&m_state);
+        m_previous_count = lua_gethookcount(&m_state);
+    }
+
+    // Threads created from the state inherit the hook
+    lua_sethook(&m_state, &sampling_profiler::hook, LUA_MASKCOUNT, instructions);
+    m_running = true;
+    resume();
+}
+
+void sampling_profiler::stop()
+{
+    if (m_running)
+    {
+        lua_sethook(&m_state, m_previous_hook, m_previous_mask, m_previous_count);
+        lua_pushnil(&m_state);
+        lua_rawsetp(&m_state, LUA_REGISTRYINDEX, &s_registry_key);
+        m_running = false;
+    }
+}
+
+void sampling_profiler::resume()
+{
+    if (m_running)
+    {
+        m_last_sample = clock::now();
+        m_native_time = std::chrono::nanoseconds(0);
+    }
+}
+
+sampling_profiler* sampling_profiler::from_state(lua_State& state)
+{
+    if (lua_gethook(&state) != &sampling_profiler::hook)
+    {
+        return nullptr;
+    }
+
+    lua_rawgetp(&state, LUA_REGISTRYINDEX, &s_registry_key);
+    auto* profiler = static_cast<sampling_profiler*>(lua_touserdata(&state, -1));
+    lua_pop(&state, 1);
+    return profiler;
+}
+
+void sampling_profiler::hook(lua_State* state, lua_Debug* ar)
+{
+    auto* profiler = from_state(*state);
+    if (profiler == nullptr)
+    {
+        // The thread was created during an earlier profiling session; give it the current hook
+        lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+        lua_State* main = lua_tothread(state, -1);
+        lua_pop(state, 1);
+        lua_sethook(state, lua_gethook(main), lua_gethookmask(main), lua_gethookcount(main));
+        return;
+    }
+
+    profiler->sample(*state);
+    if (profiler->m_previous_hook != nullptr && (profiler->m_previous_mask & LUA_MASKCOUNT) != 0)
+    {
+        profiler->m_previous_hook(state, ar);
+    }
+}
+
+void sampling_profiler::sample(lua_State& state)
+{
+    const auto now = clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_last_sample) - m_native_time;
+    m_stacks[stack(state, 0)] += std::max(elapsed, std::chrono::nanoseconds(0));
+    m_last_sample = now;
+    m_native_time = std::chrono::nanoseconds(0);
+
+    // Native functions take the stack of their next call again
+    m_native_stacks.clear();
+}
+
+std::string sampling_profiler::frame_name(lua_State& state, const lua_Debug& ar)
+{
+    const char* name = ar.name;
+    if (name == nullptr && *ar.what == 'L')
+    {
+        // The function a thread was started with has no caller to name it; find it in the globals instead
+        const auto [it, inserted] = m_function_names.try_emplace(lua_topointer(&state, -1));
+        if (inserted)
+        {
+            const char* global = global_name(state);
+            it->second = (global != nullptr) ? global : "?";
+        }
+        name = it->second.c_str();
+    }
+    else if (name == nullptr)
+    {
+        name = "?";
+    }
+
+    switch (*ar.what)
+    {
+    case 'C':
+        return sanitize(name);
+    case 'm':
+        return sanitize("main (" + source_name(ar) + ")");
+    default:
+        return sanitize(std::string(name) + " (" + source_name(ar) + ":" + std::to_string(ar.linedefined) + ")");
+    }
+}
+
+void sampling_profiler::record_native(lua_State& state, const std::string& name, std::chrono::nanoseconds duration)
+{
+    auto& time = m_native_stacks[&name];
+    if (time == nullptr)
+    {
+        auto folded = stack(state, 1);
+        if (!folded.empty())
+        {
+            folded += ';';
+        }
+        folded += sanitize(name);
+
+        // References to the elements of an unordered_map stay valid when it rehashes
+        time = &m_stacks[folded];
+    }
+    *time += duration;
+
+    // The native time is not attributed to the next sample
+    m_native_time += duration;
+}
+
+std::string sampling_profiler::stack(lua_State& state, int level)
+{
+    lua_Debug ar;
+    int depth = level;
+    while (lua_getstack(&state, depth, &ar) != 0)
+    {
+        ++depth;
+    }
+
+    // Folded stacks start with the outermost frame
+    std::string folded;
+    for (int i = depth - 1; i >= level; --i)
+    {
+        lua_getstack(&state, i, &ar);
+        lua_getinfo(&state, "Snf", &ar);
+        if (!folded.empty())
+        {
+            folded += ';';
+        }
+        folded += frame_name(state, ar);
+        lua_pop(&state, 1);
+    }
+    return folded;
+}
+
+std::string sampling_profiler::folded_stacks() const
+{
+    std::vector<std::string> lines;
+    lines.reserve(m_stacks.size());
+    for (const auto& [stack, time] : m_stacks)
+    {
+        lines.push_back(stack + " " + std::to_string(time.count()) + "\n");
+    }
+    std::sort(lines.begin(), lines.end());
+
+    std::string result;
+    for (const auto& line : lines)
+    {
+        result += line;
+    }
+    return result;
+}
+
+std::vector<sampling_profiler::function_time> sampling_profiler::functions() const
+{
+    std::unordered_map<std::string, function_time> functions;
+    for (const auto& [stack, time] : m_stacks)
+    {
+        const auto frames = split_frames(stack);
+        for (auto it = frames.begin(); it != frames.end(); ++it)
+        {
+            // Count recursive functions only once towards the total time
+            if (std::find(frames.begin(), it, *it) != it)
+            {
+                continue;
+            }
+            auto& function = functions.try_emplace(*it, function_time{*it, {}, {}}).first->second;
+            function.total += time;
+        }
+        functions[frames.back()].self += time;
+    }
+
+    std::vector<function_time> result;
+    result.reserve(functions.size());
+    for (auto& [name, function] : functions)
+    {
+        result.push_back(std::move(function));
+    }
+    std::sort(result.begin(), result.end(), [](const function_time& a, const function_time& b) {
+        return a.self > b.self;
+    });
+    return result;
+}
+
+}
@@ -0,0 +1,162 @@
+#include <apolo/script_host.h>
+
+namespace apolo
+{
+
+namespace
+{
+    // Pops the error message of a failed call or compilation
+    std::string pop_error(lua_State& state)
+    {
+        const char* message = lua_tostring(&state, -1);
+        std::string result = (message != nullptr) ? message : "unknown error";
+        lua_pop(&state, 1);
+        return result;
+    }
+
+    int read_only_newindex(lua_State* state)
+    {
+        return luaL_error(state, "attempt to modify a read-only table");
+    }
+
+    // Iterates the table behind a read-only proxy, with the 'next' function and the table as upvalues
+    int read_only_pairs(lua_State* state)
+    {
+        lua_pushvalue(state, lua_upvalueindex(1));
+        lua_pushvalue(state, lua_upvalueindex(2));
+        lua_pushnil(state);
+        return 3;
+    }
+
+    // Pushes an empty table that reads from the table at \p index, and can't be modified
+    void push_read_only_proxy(lua_State& state, int index)
+    {
+        index = lua_absindex(&state, index);
+        lua_newtable(&state);
+        lua_createtable(&state, 0, 4);
+        lua_pushvalue(&state, index);
+        lua_setfield(&state, -2, "__index");
+        lua_pushcfunction(&state, &read_only_newindex);
+        lua_setfield(&state, -2, "__newindex");
+        lua_getglobal(&state, "next");
+        lua_pushvalue(&state, index);
+        lua_pushcclosure(&state, &read_only_pairs, 2);
+        lua_setfield(&state, -2, "__pairs");
+        lua_pushboolean(&state, 0);
+        lua_setfield(&state, -2, "__metatable");
+        lua_setmetatable(&state, -2);
+    }
+
+    // Replaces the library tables in the global table with read-only proxies
+    void protect_libraries(lua_State& state)
+    {
+        lua_pushglobaltable(&state);
+        lua_pushnil(&state);
+        while (lua_next(&state, -2) != 0)
+        {
+            // Changing existing fields during the traversal is allowed
+            if (lua_istable(&state, -1) && !lua_rawequal(&state, -1, -3))
+            {
+                lua_pushvalue(&state, -2);
+                push_read_only_proxy(state, -2);
+                lua_rawset(&state, -5);
+            }
+            lua_pop(&state, 1);
+        }
+        lua_pop(&state, 1);
+    }
+}
+
+void environment::push_function(const std::string& name, std::size_t arguments)
+{
+    if (!lua_checkstack(m_state, static_cast<int>(arguments) + 2))
+    {
+        throw runtime_error("Too many arguments to function \"" + name + "\"");
+    }
+
+    // Functions that aren't defined by the script are looked up in the builtins
+    m_globals.push(*m_state);
+    lua_getfield(m_state, -1, name.c_str());
+    lua_remove(m_state, -2);
+    if (!lua_isfunction(m_state, -1))
+    {
+        lua_pop(m_state, 1);
+        throw runtime_error("Calling undefined function \"" + name + "\"");
+    }
+}
+
+script_host::script_host(const configuration& config, std::shared_ptr<type_registry> registry)
+    : m_registry(std::move(registry))
+    , m_state(luaL_newstate())
+{
+    if (m_state == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    // The global table of the state holds the builtins. They're all loaded, so they can be protected.
+    configuration builtins = config;
+    builtins.lazy_builtins(false);
+    detail::load_builtins(*m_state, builtins);
+    if (m_registry != nullptr)
+    {
+        for (const auto& [name, callback] : m_registry->free_functions())
+        {
+            detail::push_callback(*m_state, *callback, m_registry->collect_statistics());
+            lua_setglobal(m_state.get(), name.c_str());
+        }
+    }
+    protect_libraries(*m_state);
+
+    // Globals that an environment doesn't set are read from the builtins. Without __newindex,
+    // assignments always set the environment's own globals.
+    lua_createtable(m_state.get(), 0, 2);
+    lua_pushglobaltable(m_state.get());
+    lua_setfield(m_state.get(), -2, "__index");
+    lua_pushboolean(m_state.get(), 0);
+    lua_setfield(m_state.get(), -2, "__metatable");
+    m_environment_metatable = detail::lua_ref::pop_from_stack(*m_state);
+}
+
+environment script_host::create(const std::string& name, const script_data& buffer)
+{
+    lua_State* state = m_state.get();
+    switch (luaL_loadbufferx(state, buffer.data(), buffer.size(), name.c_str(), "t"))
+    {
+    case LUA_OK:
+        break;
+    case LUA_ERRMEM:
+        lua_pop(state, 1);
+        throw std::bad_alloc();
+    case LUA_ERRSYNTAX:
+        throw syntax_error(pop_error(*state));
+    default:
+        throw runtime_error(pop_error(*state));
+    }
+
+    // The globals of the environment, where '_G' refers to them instead of the builtins
+    lua_createtable(state, 0, 1);
+    lua_pushvalue(state, -1);
+    lua_setfield(state, -2, "_G");
+    m_environment_metatable.push(*state);
+    lua_setmetatable(state, -2);
+    lua_pushvalue(state, -1);
+    auto globals = detail::lua_ref::pop_from_stack(*state);
+
+    // The only upvalue of a main chunk is its _ENV
+    lua_setupvalue(state, -2, 1);
+    if (lua_pcall(state, 0, 0, 0) != LUA_OK)
+    {
+        throw runtime_error(pop_error(*state));
+    }
+    return environment(*state, name, std::move(globals));
+}
+
+std::size_t script_host::memory() const
+{
+    const int kilobytes = lua_gc(m_state.get(), LUA_GCCOUNT, 0);
+    const int bytes = lua_gc(m_state.get(), LUA_GCCOUNTB, 0);
+    return static_cast<std::size_t>(kilobytes) * 1024 + static_cast<std::size_t>(bytes);
+}
+
+}
@@ -0,0 +1,536 @@
+#include <apolo/serialization.h>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace apolo
+{
+
+namespace
+{
+    // Tags that precede each encoded value
+    enum tag : std::uint8_t
+    {
+        TAG_NIL,
+        TAG_FALSE,
+        TAG_TRUE,
+        TAG_INTEGER,
+        TAG_NUMBER,
+        TAG_STRING,
+        TAG_TABLE,
+        TAG_REFERENCE,
+        TAG_FUNCTION,
+        TAG_OBJECT,
+    };
+
+    // Prefix of the metatable names of registered object types, see detail::metatable_name
+    static constexpr std::string_view OBJECT_TYPE_PREFIX = "ObjectType:";
+
+    // Maximum nesting depth of tables, to protect the native stack against deeply nested (or malicious) data
+    static constexpr int MAX_DEPTH = 200;
+
+    // Stack slots needed while writing or reading a single table level
+    static constexpr int STACK_PER_LEVEL = 4;
+
+    // Returns true if the key at \p index falls in the sequence part [1, length] of a table
+    bool is_sequence_key(lua_State& state, int index, lua_Integer length)
+    {
+        if (!lua_isinteger(&state, index))
+        {
+            return false;
+        }
+        const auto key = lua_tointeger(&state, index);
+        return key >= 1 && key <= length;
+    }
+
+    void check_stack(lua_State& state)
+    {
+        if (!lua_checkstack(&state, STACK_PER_LEVEL))
+        {
+            throw serialization_error("Out of Lua stack space");
+        }
+    }
+}
+
+void value_writer::write(const value& value)
+{
+    value.visit(detail::overloaded{
+        [&](std::nullptr_t) { write_tag(TAG_NIL); },
+        [&](bool x) { write_tag(x ? TAG_TRUE : TAG_FALSE); },
+        [&](long long x) { write_tag(TAG_INTEGER); write_integer(x); },
+        [&](double x) { write_tag(TAG_NUMBER); write_double(x); },
+        [&](const std::string& x) { write_tag(TAG_STRING); write_string(x.data(), x.size()); },
+        [&](std::type_index, std::uintptr_t) {
+            throw serialization_error("Cannot serialize native object reference");
+        },
+    });
+}
+
+void value_writer::write(lua_State& state, int index)
+{
+    const int top = lua_gettop(&state);
+    index = lua_absindex(&state, index);
+
+    // Table references are only shared within a single written value
+    m_references.clear();
+    try
+    {
+        write_lua(state, index, 0);
+    }
+    catch (...)
+    {
+        lua_settop(&state, top);
+        throw;
+    }
+}
+
+void value_writer::write_lua(lua_State& state, int index, int depth)
+{
+    switch (lua_type(&state, index))
+    {
+    case LUA_TNIL:
+        write_tag(TAG_NIL);
+        break;
+
+    case LUA_TBOOLEAN:
+        write_tag(lua_toboolean(&state, index) ? TAG_TRUE : TAG_FALSE);
+        break;
+
+    case LUA_TNUMBER:
+        if (lua_isinteger(&state, index))
+        {
+            write_tag(TAG_INTEGER);
+            write_integer(lua_tointeger(&state, index));
+        }
+        else
+        {
+            write_tag(TAG_NUMBER);
+            write_double(lua_tonumber(&state, index));
+        }
+        break;
+
+    case LUA_TSTRING:
+    {
+        std::size_t size;
+        const char* data = lua_tolstring(&state, index, &size);
+        write_tag(TAG_STRING);
+        write_string(data, size);
+        break;
+    }
+
+    case LUA_TTABLE:
+        write_table(state, index, depth + 1);
+        break;
+
+    case LUA_TFUNCTION:
+        if (m_allow_functions && !lua_iscfunction(&state, index))
+        {
+            write_function(state, index);
+            break;
+        }
+        throw serialization_error("Cannot serialize native or disallowed function");
+
+    case LUA_TUSERDATA:
+        if (m_allow_objects)
+        {
+            write_object(state, index);
+            break;
+        }
+        throw serialization_error("Cannot serialize userdata");
+
+    default:
+        throw serialization_error(std::string("Cannot serialize value of type ") + luaL_typename(&state, index));
+    }
+}
+
+bool value_writer::write_reference(lua_State& state, int index)
+{
+    // Tables and functions we've already written are written as a reference to the earlier one
+    const auto [it, inserted] = m_references.emplace(lua_topointer(&state, index), m_references.size());
+    if (inserted)
+    {
+        return false;
+    }
+    write_tag(TAG_REFERENCE);
+    write_varint(it->second);
+    return true;
+}
+
+void value_writer::write_table(lua_State& state, int index, int depth)
+{
+    if (depth > MAX_DEPTH)
+    {
+        throw serialization_error("Tables nested too deeply");
+    }
+
+    if (write_reference(state, index))
+    {
+        return;
+    }
+
+    check_stack(state);
+    write_tag(TAG_TABLE);
+
+    // Count the fields outside the sequence part, so the reader can presize the table
+    const auto length = static_cast<lua_Integer>(lua_rawlen(&state, index));
+    std::uint64_t fields = 0;
+    lua_pushnil(&state);
+    while (lua_next(&state, index) != 0)
+    {
+        if (!is_sequence_key(state, -2, length))
+        {
+            ++fields;
+        }
+        lua_pop(&state, 1);
+    }
+    write_varint(static_cast<std::uint64_t>(length));
+    write_varint(fields);
+
+    // Write the sequence part as plain values
+    for (lua_Integer i = 1; i <= length; ++i)
+    {
+        lua_rawgeti(&state, index, i);
+        write_lua(state, lua_gettop(&state), depth);
+        lua_pop(&state, 1);
+    }
+
+    // Write the remaining fields as key/value pairs
+    lua_pushnil(&state);
+    while (lua_next(&state, index) != 0)
+    {
+        const int top = lua_gettop(&state);
+        if (!is_sequence_key(state, top - 1, length))
+        {
+            write_lua(state, top - 1, depth);
+            write_lua(state, top, depth);
+        }
+        lua_pop(&state, 1);
+    }
+}
+
+void value_writer::write_function(lua_State& state, int index)
+{
+    if (write_reference(state, index))
+    {
+        return;
+    }
+
+    // Loading bytecode binds the first upvalue to the global table, so that is the only upvalue we can restore
+    check_stack(state);
+    for (int i = 1; lua_getupvalue(&state, index, i) != nullptr; ++i)
+    {
+        lua_pushglobaltable(&state);
+        const bool is_global_table = lua_rawequal(&state, -1, -2) != 0;
+        lua_pop(&state, 2);
+        if (!is_global_table)
+        {
+            throw serialization_error("Cannot serialize function with upvalues other than the global table");
+        }
+    }
+
+    std::string bytecode;
+    lua_pushvalue(&state, index);
+    lua_dump(&state, [](lua_State*, const void* data, std::size_t size, void* ud) {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(data), size);
+        return 0;
+    }, &bytecode, 0);
+    lua_pop(&state, 1);
+
+    write_tag(TAG_FUNCTION);
+    write_string(bytecode.data(), bytecode.size());
+}
+
+void value_writer::write_object(lua_State& state, int index)
+{
+    std::size_t size = 0;
+    const char* name = nullptr;
+    if (luaL_getmetafield(&state, index, "__name") == LUA_TSTRING)
+    {
+        name = lua_tolstring(&state, -1, &size);
+    }
+
+    if (name == nullptr || std::string_view(name, size).substr(0, OBJECT_TYPE_PREFIX.size()) != OBJECT_TYPE_PREFIX)
+    {
+        lua_pop(&state, name != nullptr ? 1 : 0);
+        throw serialization_error("Cannot serialize userdata that is not a registered object");
+    }
+
+    write_tag(TAG_OBJECT);
+    write_string(name, size);
+    lua_pop(&state, 1);
+}
+
+void value_writer::write_tag(std::uint8_t tag)
+{
+    m_buffer.push_back(static_cast<char>(tag));
+}
+
+void value_writer::write_varint(std::uint64_t value)
+{
+    // LEB128: 7 bits per byte, high bit set on all but the last byte
+    while (value >= 0x80)
+    {
+        m_buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    m_buffer.push_back(static_cast<char>(value));
+}
+
+void value_writer::write_integer(long long value)
+{
+    // Zig-zag encoding so small negative numbers stay small
+    const auto bits = static_cast<std::uint64_t>(value);
+    write_varint((bits << 1) ^ (value < 0 ? ~std::uint64_t{0} : 0));
+}
+
+void value_writer::write_double(double value)
+{
+    static_assert(sizeof(double) == sizeof(std::uint64_t));
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+
+    // Always store little-endian, regardless of the host
+    char bytes[sizeof bits];
+    for (auto& byte : bytes)
+    {
+        byte = static_cast<char>(bits & 0xFF);
+        bits >>= 8;
+    }
+    m_buffer.insert(m_buffer.end(), std::begin(bytes), std::end(bytes));
+}
+
+void value_writer::write_string(const char* data, std::size_t size)
+{
+    write_varint(size);
+    m_buffer.insert(m_buffer.end(), data, data + size);
+}
+
+value value_reader::read()
+{
+    switch (read_tag())
+    {
+    case TAG_NIL:
+        return value();
+    case TAG_FALSE:
+        return value(false);
+    case TAG_TRUE:
+        return value(true);
+    case TAG_INTEGER:
+        return value(read_integer());
+    case TAG_NUMBER:
+        return value(read_double());
+    case TAG_STRING:
+        return value(std::string(read_string()));
+    case TAG_TABLE:
+    case TAG_REFERENCE:
+        throw serialization_error("Cannot deserialize table into a value");
+    case TAG_FUNCTION:
+    case TAG_OBJECT:
+        throw serialization_error("Cannot deserialize function or object into a value");
+    }
+    throw serialization_error("Invalid serialized data");
+}
+
+void value_reader::read(lua_State& state)
+{
+    const int top = lua_gettop(&state);
+    check_stack(state);
+    try
+    {
+        // Keep the tables and functions we've created so far for references
+        lua_newtable(&state);
+        m_references = 0;
+        read_lua(state, top + 1, 0);
+        lua_remove(&state, top + 1);
+    }
+    catch (...)
+    {
+        lua_settop(&state, top);
+        throw;
+    }
+}
+
+void value_reader::read_lua(lua_State& state, int references, int depth)
+{
+    switch (read_tag())
+    {
+    case TAG_NIL:
+        lua_pushnil(&state);
+        break;
+
+    case TAG_FALSE:
+        lua_pushboolean(&state, 0);
+        break;
+
+    case TAG_TRUE:
+        lua_pushboolean(&state, 1);
+        break;
+
+    case TAG_INTEGER:
+        lua_pushinteger(&state, static_cast<lua_Integer>(read_integer()));
+        break;
+
+    case TAG_NUMBER:
+        lua_pushnumber(&state, static_cast<lua_Number>(read_double()));
+        break;
+
+    case TAG_STRING:
+    {
+        auto str = read_string();
+        lua_pushlstring(&state, str.data(), str.size());
+        break;
+    }
+
+    case TAG_TABLE:
+        read_table(state, references, depth + 1);
+        break;
+
+    case TAG_REFERENCE:
+    {
+        const auto id = read_varint();
+        if (id >= m_references)
+        {
+            throw serialization_error("Invalid reference in serialized data");
+        }
+        lua_rawgeti(&state, references, static_cast<lua_Integer>(id + 1));
+        break;
+    }
+
+    case TAG_FUNCTION:
+        read_function(state, references);
+        break;
+
+    case TAG_OBJECT:
+        // Native objects cannot be restored; skip the type name
+        read_string();
+        lua_pushnil(&state);
+        break;
+
+    default:
+        throw serialization_error("Invalid serialized data");
+    }
+}
+
+void value_reader::read_table(lua_State& state, int references, int depth)
+{
+    if (depth > MAX_DEPTH)
+    {
+        throw serialization_error("Tables nested too deeply");
+    }
+    check_stack(state);
+
+    // Every element takes at least one byte, so this also guards against bogus sizes
+    const auto length = read_varint();
+    const auto fields = read_varint();
+    if (length > remaining() || fields > remaining() / 2)
+    {
+        throw serialization_error("Unexpected end of serialized data");
+    }
+
+    constexpr std::uint64_t max_size = std::numeric_limits<int>::max();
+    lua_createtable(&state, static_cast<int>(std::min(length, max_size)), static_cast<int>(std::min(fields, max_size)));
+    const int table = lua_gettop(&state);
+
+    // Register the table before reading its contents, so it can refer to itself
+    lua_pushvalue(&state, table);
+    lua_rawseti(&state, references, static_cast<lua_Integer>(++m_references));
+
+    for (std::uint64_t i = 1; i <= length; ++i)
+    {
+        read_lua(state, references, depth);
+        lua_rawseti(&state, table, static_cast<lua_Integer>(i));
+    }
+
+    for (std::uint64_t i = 0; i < fields; ++i)
+    {
+        read_lua(state, references, depth);
+        if (lua_isnil(&state, -1) || (lua_type(&state, -1) == LUA_TNUMBER && std::isnan(lua_tonumber(&state, -1))))
+        {
+            throw serialization_error("Invalid table key in serialized data");
+        }
+        read_lua(state, references, depth);
+        lua_rawset(&state, table);
+    }
+}
+
+void value_reader::read_function(lua_State& state, int references)
+{
+    if (!m_allow_functions)
+    {
+        throw serialization_error("Cannot deserialize function");
+    }
+
+    auto bytecode = read_string();
+    if (luaL_loadbufferx(&state, bytecode.data(), bytecode.size(), "=snapshot", "b") != LUA_OK)
+    {
+        std::string message = lua_tostring(&state, -1);
+        lua_pop(&state, 1);
+        throw serialization_error(message);
+    }
+
+    lua_pushvalue(&state, -1);
+    lua_rawseti(&state, references, static_cast<lua_Integer>(++m_references));
+}
+
+std::uint8_t value_reader::read_tag()
+{
+    return static_cast<std::uint8_t>(*consume(1));
+}
+
+std::uint64_t value_reader::read_varint()
+{
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        const auto byte = static_cast<std::uint8_t>(*consume(1));
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw serialization_error("Invalid integer in serialized data");
+}
+
+long long value_reader::read_integer()
+{
+    const auto bits = read_varint();
+    return static_cast<long long>((bits >> 1) ^ (~(bits & 1) + 1));
+}
+
+double value_reader::read_double()
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(consume(sizeof(std::uint64_t)));
+    std::uint64_t bits = 0;
+    for (int i = sizeof(std::uint64_t) - 1; i >= 0; --i)
+    {
+        bits = (bits << 8) | bytes[i];
+    }
+
+    double value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+std::string_view value_reader::read_string()
+{
+    const auto size = read_varint();
+    if (size > remaining())
+    {
+        throw serialization_error("Unexpected end of serialized data");
+    }
+    return std::string_view(consume(static_cast<std::size_t>(size)), static_cast<std::size_t>(size));
+}
+
+const char* value_reader::consume(std::size_t size)
+{
+    if (size > remaining())
+    {
+        throw serialization_error("Unexpected end of serialized data");
+    }
+    const char* data = m_data;
+    m_data += size;
+    return data;
+}
+
+}
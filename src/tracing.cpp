@@ -0,0 +1,109 @@
+#include <apolo/tracing.h>
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <unordered_map>
+
+namespace apolo
+{
+
+namespace
+{
+    void write_string(std::ostream& stream, std::string_view str)
+    {
+        stream << '"';
+        for (char c : str)
+        {
+            switch (c)
+            {
+            case '"': stream << "\\\""; break;
+            case '\\': stream << "\\\\"; break;
+            case '\n': stream << "\\n"; break;
+            case '\t': stream << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    stream << escaped;
+                }
+                else
+                {
+                    stream << c;
+                }
+            }
+        }
+        stream << '"';
+    }
+}
+
+void chrome_trace_writer::begin(std::string_view name, const trace_arguments& arguments, clock::time_point time)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_events.push_back({std::string(name), 'B', std::this_thread::get_id(), time, arguments});
+}
+
+void chrome_trace_writer::end(std::string_view name, clock::time_point time)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_events.push_back({std::string(name), 'E', std::this_thread::get_id(), time, {}});
+}
+
+void chrome_trace_writer::write(std::ostream& stream) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Chrome expects small numeric thread ids
+    std::unordered_map<std::thread::id, int> threads;
+
+    // Timestamps are in microseconds, with nanosecond precision
+    const auto flags = stream.flags();
+    const auto precision = stream.precision(3);
+    stream << std::fixed;
+
+    stream << "{\"traceEvents\":[";
+    for (std::size_t i = 0; i < m_events.size(); ++i)
+    {
+        const auto& entry = m_events[i];
+        const auto tid = threads.try_emplace(entry.thread, static_cast<int>(threads.size()) + 1).first->second;
+        const auto ts = std::chrono::duration<double, std::micro>(entry.time - m_start).count();
+
+        stream << (i > 0 ? ",\n" : "\n") << "{\"name\":";
+        write_string(stream, entry.name);
+        stream << ",\"cat\":\"apolo\",\"ph\":\"" << entry.phase << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << tid;
+        if (!entry.arguments.empty())
+        {
+            stream << ",\"args\":{";
+            for (std::size_t j = 0; j < entry.arguments.size(); ++j)
+            {
+                const auto& [key, value] = entry.arguments[j];
+                stream << (j > 0 ? "," : "");
+                write_string(stream, key);
+                stream << ':';
+                if (const auto* number = std::get_if<long long>(&value))
+                {
+                    stream << *number;
+                }
+                else
+                {
+                    write_string(stream, std::get<std::string>(value));
+                }
+            }
+            stream << '}';
+        }
+        stream << '}';
+    }
+    stream << "\n]}\n";
+
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+std::string chrome_trace_writer::json() const
+{
+    std::ostringstream stream;
+    write(stream);
+    return stream.str();
+}
+
+}
@@ -0,0 +1,777 @@
+#include <apolo/vector_math.h>
+#include <apolo/apolo.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#define APOLO_VMATH_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace apolo
+{
+
+namespace
+{
+    //
+    // Four floats, the unit of all arithmetic.
+    // Vectors with fewer components keep their unused lanes at zero, so sums over all lanes are valid.
+    //
+#ifdef APOLO_VMATH_SSE
+    using float4 = __m128;
+
+    inline float4 load(const float* data) { return _mm_loadu_ps(data); }
+    inline void store(float* data, float4 v) { _mm_storeu_ps(data, v); }
+    inline float4 make(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+    inline float4 splat(float x) { return _mm_set1_ps(x); }
+    inline float4 add(float4 a, float4 b) { return _mm_add_ps(a, b); }
+    inline float4 sub(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+    inline float4 mul(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+    inline float4 div(float4 a, float4 b) { return _mm_div_ps(a, b); }
+    inline float first(float4 v) { return _mm_cvtss_f32(v); }
+
+    template <int X, int Y, int Z, int W>
+    inline float4 shuffle(float4 v)
+    {
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(W, Z, Y, X));
+    }
+
+    inline void transpose(float4& c0, float4& c1, float4& c2, float4& c3)
+    {
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    }
+#else
+    struct float4
+    {
+        float v[4];
+    };
+
+    inline float4 load(const float* data) { return {{data[0], data[1], data[2], data[3]}}; }
+    inline void store(float* data, float4 v) { std::memcpy(data, v.v, sizeof(v.v)); }
+    inline float4 make(float x, float y, float z, float w) { return {{x, y, z, w}}; }
+    inline float4 splat(float x) { return {{x, x, x, x}}; }
+    inline float4 add(float4 a, float4 b) { return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+    inline float4 sub(float4 a, float4 b) { return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}}; }
+    inline float4 mul(float4 a, float4 b) { return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+    inline float4 div(float4 a, float4 b) { return {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}}; }
+    inline float first(float4 v) { return v.v[0]; }
+
+    template <int X, int Y, int Z, int W>
+    inline float4 shuffle(float4 v)
+    {
+        return {{v.v[X], v.v[Y], v.v[Z], v.v[W]}};
+    }
+
+    inline void transpose(float4& c0, float4& c1, float4& c2, float4& c3)
+    {
+        const float4 r0{{c0.v[0], c1.v[0], c2.v[0], c3.v[0]}};
+        const float4 r1{{c0.v[1], c1.v[1], c2.v[1], c3.v[1]}};
+        const float4 r2{{c0.v[2], c1.v[2], c2.v[2], c3.v[2]}};
+        const float4 r3{{c0.v[3], c1.v[3], c2.v[3], c3.v[3]}};
+        c0 = r0;
+        c1 = r1;
+        c2 = r2;
+        c3 = r3;
+    }
+#endif
+
+    // Returns the sum of all lanes in every lane
+    inline float4 horizontal_sum(float4 v)
+    {
+        const float4 pairs = add(v, shuffle<1, 0, 3, 2>(v));
+        return add(pairs, shuffle<2, 3, 0, 1>(pairs));
+    }
+
+    inline float dot(float4 a, float4 b)
+    {
+        return first(horizontal_sum(mul(a, b)));
+    }
+
+    // Cross product of the first three lanes; the last lane of the result is zero if it is in either input
+    inline float4 cross(float4 a, float4 b)
+    {
+        const float4 result = sub(mul(a, shuffle<1, 2, 0, 3>(b)), mul(shuffle<1, 2, 0, 3>(a), b));
+        return shuffle<1, 2, 0, 3>(result);
+    }
+
+    // Hamilton product of quaternions (x, y, z, w)
+    inline float4 quat_mul(float4 a, float4 b)
+    {
+        float4 result = mul(shuffle<3, 3, 3, 3>(a), b);
+        result = add(result, mul(mul(shuffle<0, 0, 0, 0>(a), shuffle<3, 2, 1, 0>(b)), make(1, -1, 1, -1)));
+        result = add(result, mul(mul(shuffle<1, 1, 1, 1>(a), shuffle<2, 3, 0, 1>(b)), make(1, 1, -1, -1)));
+        return add(result, mul(mul(shuffle<2, 2, 2, 2>(a), shuffle<1, 0, 3, 2>(b)), make(-1, 1, 1, -1)));
+    }
+
+    // Rotates the vector in the first three lanes of v by a unit quaternion
+    inline float4 quat_rotate(float4 q, float4 v)
+    {
+        const float4 axis = mul(q, make(1, 1, 1, 0));
+        const float4 t = mul(cross(axis, v), splat(2));
+        return add(add(v, mul(shuffle<3, 3, 3, 3>(q), t)), cross(axis, t));
+    }
+
+    enum class kind : unsigned char
+    {
+        vec2,
+        vec3,
+        vec4,
+        quat,
+        mat4,
+    };
+
+    const char* kind_name(kind type)
+    {
+        switch (type)
+        {
+        case kind::vec2: return "vec2";
+        case kind::vec3: return "vec3";
+        case kind::vec4: return "vec4";
+        case kind::quat: return "quat";
+        default:         return "mat4";
+        }
+    }
+
+    int component_count(kind type)
+    {
+        return (type == kind::vec2) ? 2 : (type == kind::vec3) ? 3 : (type == kind::mat4) ? 16 : 4;
+    }
+
+    // The userdata of vectors and quaternions
+    struct vector_value
+    {
+        kind type;
+        float data[4];
+    };
+
+    // The userdata of matrices, with the columns one after the other
+    struct matrix_value
+    {
+        kind type;
+        float data[16];
+    };
+
+    // Clears the lanes that a vector type doesn't use
+    float4 mask(kind type, float4 v)
+    {
+        switch (type)
+        {
+        case kind::vec2: return mul(v, make(1, 1, 0, 0));
+        case kind::vec3: return mul(v, make(1, 1, 1, 0));
+        default:         return v;
+        }
+    }
+
+    // Returns the kind of the vmath value at index, or null if it's another value.
+    // All functions have the metatable of vmath values as first upvalue.
+    const kind* to_value(lua_State* state, int index)
+    {
+        const void* data = lua_touserdata(state, index);
+        if (data == nullptr || !lua_getmetatable(state, index))
+        {
+            return nullptr;
+        }
+        const bool is_value = lua_rawequal(state, -1, lua_upvalueindex(1));
+        lua_pop(state, 1);
+        return is_value ? static_cast<const kind*>(data) : nullptr;
+    }
+
+    const vector_value& check_vector(lua_State* state, int arg, kind type)
+    {
+        const kind* value = to_value(state, arg);
+        if (value == nullptr || *value != type)
+        {
+            luaL_argerror(state, arg, lua_pushfstring(state, "%s expected", kind_name(type)));
+        }
+        return *reinterpret_cast<const vector_value*>(value);
+    }
+
+    // Checks for a vector or quaternion of any type
+    const vector_value& check_any_vector(lua_State* state, int arg)
+    {
+        const kind* value = to_value(state, arg);
+        if (value == nullptr || *value == kind::mat4)
+        {
+            luaL_argerror(state, arg, "vector expected");
+        }
+        return *reinterpret_cast<const vector_value*>(value);
+    }
+
+    const matrix_value& check_matrix(lua_State* state, int arg)
+    {
+        const kind* value = to_value(state, arg);
+        if (value == nullptr || *value != kind::mat4)
+        {
+            luaL_argerror(state, arg, "mat4 expected");
+        }
+        return *reinterpret_cast<const matrix_value*>(value);
+    }
+
+    float check_float(lua_State* state, int arg)
+    {
+        return static_cast<float>(luaL_checknumber(state, arg));
+    }
+
+    void push_vector(lua_State* state, kind type, float4 v)
+    {
+        auto* value = static_cast<vector_value*>(lua_newuserdata(state, sizeof(vector_value)));
+        value->type = type;
+        store(value->data, v);
+        lua_pushvalue(state, lua_upvalueindex(1));
+        lua_setmetatable(state, -2);
+    }
+
+    void push_matrix(lua_State* state, const float4 (&columns)[4])
+    {
+        auto* value = static_cast<matrix_value*>(lua_newuserdata(state, sizeof(matrix_value)));
+        value->type = kind::mat4;
+        for (int i = 0; i < 4; ++i)
+        {
+            store(value->data + 4 * i, columns[i]);
+        }
+        lua_pushvalue(state, lua_upvalueindex(1));
+        lua_setmetatable(state, -2);
+    }
+
+    float4 load_vector(const vector_value& value)
+    {
+        return load(value.data);
+    }
+
+    void load_matrix(const matrix_value& value, float4 (&columns)[4])
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            columns[i] = load(value.data + 4 * i);
+        }
+    }
+
+    inline float4 transform(const float4 (&columns)[4], float4 v)
+    {
+        float4 result = mul(columns[0], shuffle<0, 0, 0, 0>(v));
+        result = add(result, mul(columns[1], shuffle<1, 1, 1, 1>(v)));
+        result = add(result, mul(columns[2], shuffle<2, 2, 2, 2>(v)));
+        return add(result, mul(columns[3], shuffle<3, 3, 3, 3>(v)));
+    }
+
+    //
+    // Constructors
+    //
+
+    int vmath_vec2(lua_State* state)
+    {
+        push_vector(state, kind::vec2, make(check_float(state, 1), check_float(state, 2), 0, 0));
+        return 1;
+    }
+
+    int vmath_vec3(lua_State* state)
+    {
+        push_vector(state, kind::vec3, make(check_float(state, 1), check_float(state, 2), check_float(state, 3), 0));
+        return 1;
+    }
+
+    int vmath_vec4(lua_State* state)
+    {
+        push_vector(state, kind::vec4, make(check_float(state, 1), check_float(state, 2), check_float(state, 3), check_float(state, 4)));
+        return 1;
+    }
+
+    // quat() is the identity rotation
+    int vmath_quat(lua_State* state)
+    {
+        if (lua_gettop(state) == 0)
+        {
+            push_vector(state, kind::quat, make(0, 0, 0, 1));
+        }
+        else
+        {
+            push_vector(state, kind::quat, make(check_float(state, 1), check_float(state, 2), check_float(state, 3), check_float(state, 4)));
+        }
+        return 1;
+    }
+
+    // mat4() is the identity matrix; otherwise it takes the 16 elements in column-major order
+    int vmath_mat4(lua_State* state)
+    {
+        float4 columns[4] = {make(1, 0, 0, 0), make(0, 1, 0, 0), make(0, 0, 1, 0), make(0, 0, 0, 1)};
+        if (lua_gettop(state) != 0)
+        {
+            float data[16];
+            for (int i = 0; i < 16; ++i)
+            {
+                data[i] = check_float(state, i + 1);
+            }
+            for (int i = 0; i < 4; ++i)
+            {
+                columns[i] = load(data + 4 * i);
+            }
+        }
+        push_matrix(state, columns);
+        return 1;
+    }
+
+    int vmath_axis_angle(lua_State* state)
+    {
+        const float4 axis = load_vector(check_vector(state, 1, kind::vec3));
+        const float angle = check_float(state, 2);
+        const float length = std::sqrt(dot(axis, axis));
+        luaL_argcheck(state, length > 0, 1, "zero-length axis");
+
+        const float4 rotation = mul(axis, splat(std::sin(angle / 2) / length));
+        push_vector(state, kind::quat, add(rotation, make(0, 0, 0, std::cos(angle / 2))));
+        return 1;
+    }
+
+    int vmath_translation(lua_State* state)
+    {
+        const float4 offset = load_vector(check_vector(state, 1, kind::vec3));
+        const float4 columns[4] = {make(1, 0, 0, 0), make(0, 1, 0, 0), make(0, 0, 1, 0), add(offset, make(0, 0, 0, 1))};
+        push_matrix(state, columns);
+        return 1;
+    }
+
+    int vmath_scaling(lua_State* state)
+    {
+        const float4 scale = load_vector(check_vector(state, 1, kind::vec3));
+        const float4 columns[4] = {
+            mul(scale, make(1, 0, 0, 0)), mul(scale, make(0, 1, 0, 0)), mul(scale, make(0, 0, 1, 0)), make(0, 0, 0, 1)
+        };
+        push_matrix(state, columns);
+        return 1;
+    }
+
+    // Rotation matrix of a unit quaternion
+    int vmath_rotation(lua_State* state)
+    {
+        const float* q = check_vector(state, 1, kind::quat).data;
+        const float x = q[0], y = q[1], z = q[2], w = q[3];
+        const float4 columns[4] = {
+            make(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0),
+            make(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0),
+            make(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0),
+            make(0, 0, 0, 1),
+        };
+        push_matrix(state, columns);
+        return 1;
+    }
+
+    //
+    // Functions of values
+    //
+
+    const vector_value& check_same_vectors(lua_State* state)
+    {
+        const auto& a = check_any_vector(state, 1);
+        check_vector(state, 2, a.type);
+        return a;
+    }
+
+    int vmath_dot(lua_State* state)
+    {
+        const auto& value = check_same_vectors(state);
+        lua_pushnumber(state, dot(load_vector(value), load_vector(check_any_vector(state, 2))));
+        return 1;
+    }
+
+    int vmath_cross(lua_State* state)
+    {
+        const float4 a = load_vector(check_vector(state, 1, kind::vec3));
+        const float4 b = load_vector(check_vector(state, 2, kind::vec3));
+        push_vector(state, kind::vec3, cross(a, b));
+        return 1;
+    }
+
+    int vmath_length(lua_State* state)
+    {
+        const float4 v = load_vector(check_any_vector(state, 1));
+        lua_pushnumber(state, std::sqrt(dot(v, v)));
+        return 1;
+    }
+
+    int vmath_normalize(lua_State* state)
+    {
+        const auto& value = check_any_vector(state, 1);
+        const float4 v = load_vector(value);
+        const float length = std::sqrt(dot(v, v));
+        luaL_argcheck(state, length > 0, 1, "zero-length vector");
+        push_vector(state, value.type, div(v, splat(length)));
+        return 1;
+    }
+
+    int vmath_lerp(lua_State* state)
+    {
+        const auto& value = check_same_vectors(state);
+        const float4 a = load_vector(value);
+        const float4 b = load_vector(check_any_vector(state, 2));
+        push_vector(state, value.type, add(a, mul(sub(b, a), splat(check_float(state, 3)))));
+        return 1;
+    }
+
+    int vmath_conjugate(lua_State* state)
+    {
+        push_vector(state, kind::quat, mul(load_vector(check_vector(state, 1, kind::quat)), make(-1, -1, -1, 1)));
+        return 1;
+    }
+
+    int vmath_transpose(lua_State* state)
+    {
+        float4 columns[4];
+        load_matrix(check_matrix(state, 1), columns);
+        transpose(columns[0], columns[1], columns[2], columns[3]);
+        push_matrix(state, columns);
+        return 1;
+    }
+
+    // m:get(row, column), 1-based
+    int vmath_get(lua_State* state)
+    {
+        const auto& matrix = check_matrix(state, 1);
+        const lua_Integer row = luaL_checkinteger(state, 2);
+        const lua_Integer column = luaL_checkinteger(state, 3);
+        luaL_argcheck(state, row >= 1 && row <= 4, 2, "row out of range");
+        luaL_argcheck(state, column >= 1 && column <= 4, 3, "column out of range");
+        lua_pushnumber(state, matrix.data[(column - 1) * 4 + (row - 1)]);
+        return 1;
+    }
+
+    //
+    // Metamethods
+    //
+
+    int vmath_add(lua_State* state)
+    {
+        const auto& value = check_same_vectors(state);
+        push_vector(state, value.type, add(load_vector(value), load_vector(check_any_vector(state, 2))));
+        return 1;
+    }
+
+    int vmath_sub(lua_State* state)
+    {
+        const auto& value = check_same_vectors(state);
+        push_vector(state, value.type, sub(load_vector(value), load_vector(check_any_vector(state, 2))));
+        return 1;
+    }
+
+    int vmath_unm(lua_State* state)
+    {
+        const auto& value = check_any_vector(state, 1);
+        push_vector(state, value.type, sub(splat(0), load_vector(value)));
+        return 1;
+    }
+
+    int vmath_mul(lua_State* state)
+    {
+        // Scaling, with the number on either side
+        if (lua_type(state, 1) == LUA_TNUMBER || lua_type(state, 2) == LUA_TNUMBER)
+        {
+            const int number = (lua_type(state, 1) == LUA_TNUMBER) ? 1 : 2;
+            const auto& value = check_any_vector(state, 3 - number);
+            push_vector(state, value.type, mul(load_vector(value), splat(check_float(state, number))));
+            return 1;
+        }
+
+        const kind* a = to_value(state, 1);
+        const kind* b = to_value(state, 2);
+        if (a == nullptr || b == nullptr)
+        {
+            return luaL_error(state, "attempt to multiply a %s with a %s", luaL_typename(state, 1), luaL_typename(state, 2));
+        }
+
+        if (*a == kind::mat4)
+        {
+            float4 columns[4];
+            load_matrix(check_matrix(state, 1), columns);
+            if (*b == kind::mat4)
+            {
+                float4 other[4];
+                load_matrix(check_matrix(state, 2), other);
+                const float4 result[4] = {
+                    transform(columns, other[0]), transform(columns, other[1]), transform(columns, other[2]), transform(columns, other[3])
+                };
+                push_matrix(state, result);
+            }
+            else if (*b == kind::vec4)
+            {
+                push_vector(state, kind::vec4, transform(columns, load_vector(check_any_vector(state, 2))));
+            }
+            else if (*b == kind::vec3)
+            {
+                // Vectors are transformed as points
+                const float4 point = add(load_vector(check_any_vector(state, 2)), make(0, 0, 0, 1));
+                push_vector(state, kind::vec3, mask(kind::vec3, transform(columns, point)));
+            }
+            else
+            {
+                return luaL_error(state, "attempt to multiply a mat4 with a %s", kind_name(*b));
+            }
+        }
+        else if (*a == kind::quat && *b == kind::quat)
+        {
+            push_vector(state, kind::quat, quat_mul(load_vector(check_any_vector(state, 1)), load_vector(check_any_vector(state, 2))));
+        }
+        else if (*a == kind::quat && *b == kind::vec3)
+        {
+            push_vector(state, kind::vec3, mask(kind::vec3, quat_rotate(load_vector(check_any_vector(state, 1)), load_vector(check_any_vector(state, 2)))));
+        }
+        else if (*a == *b && *a != kind::quat)
+        {
+            push_vector(state, *a, mul(load_vector(check_any_vector(state, 1)), load_vector(check_any_vector(state, 2))));
+        }
+        else
+        {
+            return luaL_error(state, "attempt to multiply a %s with a %s", kind_name(*a), kind_name(*b));
+        }
+        return 1;
+    }
+
+    int vmath_div(lua_State* state)
+    {
+        const auto& value = check_any_vector(state, 1);
+        push_vector(state, value.type, mask(value.type, div(load_vector(value), splat(check_float(state, 2)))));
+        return 1;
+    }
+
+    int vmath_eq(lua_State* state)
+    {
+        const kind* a = to_value(state, 1);
+        const kind* b = to_value(state, 2);
+        bool equal = (a != nullptr && b != nullptr && *a == *b);
+        if (equal)
+        {
+            const float* x = (*a == kind::mat4) ? reinterpret_cast<const matrix_value*>(a)->data : reinterpret_cast<const vector_value*>(a)->data;
+            const float* y = (*b == kind::mat4) ? reinterpret_cast<const matrix_value*>(b)->data : reinterpret_cast<const vector_value*>(b)->data;
+            equal = std::equal(x, x + component_count(*a), y);
+        }
+        lua_pushboolean(state, equal);
+        return 1;
+    }
+
+    int vmath_tostring(lua_State* state)
+    {
+        const kind* value = to_value(state, 1);
+        luaL_argcheck(state, value != nullptr, 1, "vmath value expected");
+        const float* data = (*value == kind::mat4) ? reinterpret_cast<const matrix_value*>(value)->data : reinterpret_cast<const vector_value*>(value)->data;
+
+        luaL_Buffer buffer;
+        luaL_buffinit(state, &buffer);
+        luaL_addstring(&buffer, kind_name(*value));
+        for (int i = 0; i < component_count(*value); ++i)
+        {
+            luaL_addstring(&buffer, (i == 0) ? "(" : ", ");
+            lua_pushfstring(state, "%f", static_cast<lua_Number>(data[i]));
+            luaL_addvalue(&buffer);
+        }
+        luaL_addchar(&buffer, ')');
+        luaL_pushresult(&buffer);
+        return 1;
+    }
+
+    // Components are named x, y, z and w; other keys are looked up in the module, for method calls
+    int vmath_index(lua_State* state)
+    {
+        const kind* value = to_value(state, 1);
+        std::size_t length = 0;
+        const char* key = lua_tolstring(state, 2, &length);
+        if (value != nullptr && *value != kind::mat4 && key != nullptr && length == 1)
+        {
+            const int component = (key[0] == 'w') ? 3 : key[0] - 'x';
+            if (component >= 0 && component < component_count(*value))
+            {
+                lua_pushnumber(state, reinterpret_cast<const vector_value*>(value)->data[component]);
+                return 1;
+            }
+        }
+
+        lua_pushvalue(state, 2);
+        lua_rawget(state, lua_upvalueindex(2));
+        return 1;
+    }
+
+    //
+    // Batch operations on arrays of floats
+    //
+
+    struct float_array
+    {
+        const float* data;
+        std::size_t size;
+    };
+
+    array_view<float>& check_array(lua_State* state, int arg)
+    {
+        return *static_cast<array_view<float>*>(luaL_checkudata(state, arg, detail::array_view_metatable_name<float>()));
+    }
+
+    // Accepts read-only and mutable arrays
+    float_array check_input_array(lua_State* state, int arg)
+    {
+        if (const auto* view = static_cast<array_view<float>*>(luaL_testudata(state, arg, detail::array_view_metatable_name<float>())))
+        {
+            return {view->data(), view->size()};
+        }
+        const auto& view = *static_cast<array_view<const float>*>(luaL_checkudata(state, arg, detail::array_view_metatable_name<const float>()));
+        return {view.data(), view.size()};
+    }
+
+    // Checks the arrays of 3-component vectors of a batch operation, and returns the number of vectors
+    std::size_t check_vec3_arrays(lua_State* state, const float_array& input, const array_view<float>& output)
+    {
+        luaL_argcheck(state, input.size % 3 == 0, 2, "size is not a multiple of 3");
+        luaL_argcheck(state, output.size() == input.size, 3, "size differs from the input");
+        return input.size / 3;
+    }
+
+    inline float4 load_vec3(const float* data, float w)
+    {
+        return make(data[0], data[1], data[2], w);
+    }
+
+    inline void store_vec3(float* data, float4 v)
+    {
+        float result[4];
+        store(result, v);
+        std::memcpy(data, result, 3 * sizeof(float));
+    }
+
+    int vmath_transform_points(lua_State* state)
+    {
+        float4 columns[4];
+        load_matrix(check_matrix(state, 1), columns);
+        const auto input = check_input_array(state, 2);
+        auto& output = check_array(state, 3);
+        const std::size_t count = check_vec3_arrays(state, input, output);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            store_vec3(output.data() + 3 * i, transform(columns, load_vec3(input.data + 3 * i, 1)));
+        }
+        return 0;
+    }
+
+    int vmath_rotate_vectors(lua_State* state)
+    {
+        const float4 rotation = load_vector(check_vector(state, 1, kind::quat));
+        const auto input = check_input_array(state, 2);
+        auto& output = check_array(state, 3);
+        const std::size_t count = check_vec3_arrays(state, input, output);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            store_vec3(output.data() + 3 * i, quat_rotate(rotation, load_vec3(input.data + 3 * i, 0)));
+        }
+        return 0;
+    }
+
+    int vmath_add_scaled(lua_State* state)
+    {
+        auto& target = check_array(state, 1);
+        const auto source = check_input_array(state, 2);
+        const float factor = check_float(state, 3);
+        luaL_argcheck(state, source.size == target.size(), 2, "size differs from the target");
+
+        float* out = target.data();
+        const float* in = source.data;
+        std::size_t i = 0;
+#if defined(__AVX__)
+        const __m256 factor8 = _mm256_set1_ps(factor);
+        for (; i + 8 <= source.size; i += 8)
+        {
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), factor8)));
+        }
+#endif
+        const float4 factor4 = splat(factor);
+        for (; i + 4 <= source.size; i += 4)
+        {
+            store(out + i, add(load(out + i), mul(load(in + i), factor4)));
+        }
+        for (; i < source.size; ++i)
+        {
+            out[i] += in[i] * factor;
+        }
+        return 0;
+    }
+
+    // Vectors of zero length are left as they are
+    int vmath_normalize_all(lua_State* state)
+    {
+        auto& vectors = check_array(state, 1);
+        luaL_argcheck(state, vectors.size() % 3 == 0, 1, "size is not a multiple of 3");
+
+        for (std::size_t i = 0; i < vectors.size(); i += 3)
+        {
+            const float4 v = load_vec3(vectors.data() + i, 0);
+            const float length = std::sqrt(dot(v, v));
+            if (length > 0)
+            {
+                store_vec3(vectors.data() + i, div(v, splat(length)));
+            }
+        }
+        return 0;
+    }
+
+    const luaL_Reg s_metamethods[] = {
+        {"__add", &vmath_add},
+        {"__sub", &vmath_sub},
+        {"__mul", &vmath_mul},
+        {"__div", &vmath_div},
+        {"__unm", &vmath_unm},
+        {"__eq", &vmath_eq},
+        {"__tostring", &vmath_tostring},
+        {"__index", &vmath_index},
+        {nullptr, nullptr},
+    };
+
+    const luaL_Reg s_functions[] = {
+        {"vec2", &vmath_vec2},
+        {"vec3", &vmath_vec3},
+        {"vec4", &vmath_vec4},
+        {"quat", &vmath_quat},
+        {"mat4", &vmath_mat4},
+        {"axis_angle", &vmath_axis_angle},
+        {"translation", &vmath_translation},
+        {"scaling", &vmath_scaling},
+        {"rotation", &vmath_rotation},
+        {"dot", &vmath_dot},
+        {"cross", &vmath_cross},
+        {"length", &vmath_length},
+        {"normalize", &vmath_normalize},
+        {"lerp", &vmath_lerp},
+        {"conjugate", &vmath_conjugate},
+        {"transpose", &vmath_transpose},
+        {"get", &vmath_get},
+        {"transform_points", &vmath_transform_points},
+        {"rotate_vectors", &vmath_rotate_vectors},
+        {"add_scaled", &vmath_add_scaled},
+        {"normalize_all", &vmath_normalize_all},
+        {nullptr, nullptr},
+    };
+}
+
+int open_vector_math(lua_State* state)
+{
+    lua_newtable(state);
+    const int metatable = lua_gettop(state);
+    lua_createtable(state, 0, static_cast<int>(std::size(s_functions) - 1));
+    const int module = lua_gettop(state);
+
+    // All functions get the metatable, to recognize values, and the module, to look up methods
+    for (const int table : {metatable, module})
+    {
+        lua_pushvalue(state, table);
+        lua_pushvalue(state, metatable);
+        lua_pushvalue(state, module);
+        luaL_setfuncs(state, (table == metatable) ? s_metamethods : s_functions, 2);
+        lua_pop(state, 1);
+    }
+
+    lua_remove(state, metatable);
+    return 1;
+}
+
+}
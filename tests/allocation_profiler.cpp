@@ -0,0 +1,91 @@
+#include "common.h"
+
+using apolo::allocation_profiler;
+
+namespace
+{
+    const allocation_profiler::type_allocations* find(const std::vector<allocation_profiler::type_allocations>& types, const std::string& type)
+    {
+        for (const auto& entry : types)
+        {
+            if (entry.type == type)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+}
+
+TEST(allocation_profiler, tracks_live_bytes)
+{
+    apolo::script script("dummy", S("data = {} function fill() for i = 1, 1000 do data[i] = {} end end function clear() data = {} end"));
+    EXPECT_GT(script.allocations().live_bytes(), 0u);
+    EXPECT_FALSE(script.allocations().running());
+
+    const auto before = script.allocations().live_bytes();
+    script.call("fill");
+    EXPECT_GT(script.allocations().live_bytes(), before + 1000 * sizeof(void*));
+
+    // Nothing is recorded unless started
+    EXPECT_TRUE(script.allocations().size_classes().empty());
+    EXPECT_TRUE(script.allocations().types().empty());
+}
+
+TEST(allocation_profiler, records_object_types)
+{
+    apolo::script script("dummy", S(R"(
+        function make_tables() local t = {} for i = 1, 100 do t[i] = {} end return 1 end
+        function make_strings() local t = {} for i = 1, 100 do t[i] = tostring(i) .. "abc" end return 1 end
+        function make_closures() local t = {} for i = 1, 100 do t[i] = function() return i end end return 1 end
+    )"));
+
+    auto& allocations = script.allocations();
+    allocations.start();
+    script.call("make_tables");
+    allocations.stop();
+    EXPECT_FALSE(allocations.running());
+    const auto table_types = allocations.types();
+    const auto* tables = find(table_types, "table");
+    ASSERT_NE(nullptr, tables);
+    EXPECT_GE(tables->allocations, 101u);
+    EXPECT_EQ(nullptr, find(table_types, "function"));
+
+    allocations.reset();
+    allocations.start();
+    script.call("make_strings");
+    script.call("make_closures");
+    allocations.stop();
+    const auto types = allocations.types();
+    ASSERT_NE(nullptr, find(types, "string"));
+    EXPECT_GE(find(types, "string")->allocations, 100u);
+    ASSERT_NE(nullptr, find(types, "function"));
+    EXPECT_GE(find(types, "function")->allocations, 100u);
+    EXPECT_GE(types[0].bytes, types.back().bytes);
+}
+
+TEST(allocation_profiler, records_size_classes_and_rate)
+{
+    apolo::script script("dummy", S("function make() local s = string.rep('x', 100000) return 1 end"));
+
+    auto& allocations = script.allocations();
+    allocations.start(std::chrono::seconds(10));
+    script.call("make");
+    allocations.stop();
+
+    const auto size_classes = allocations.size_classes();
+    ASSERT_FALSE(size_classes.empty());
+    std::uint64_t bytes = 0;
+    bool found_large = false;
+    for (const auto& size_class : size_classes)
+    {
+        bytes += size_class.bytes;
+        found_large = found_large || (size_class.max_size >= 100000 && size_class.max_size < 2 * 131072 && size_class.allocations > 0);
+    }
+    EXPECT_TRUE(found_large);
+    EXPECT_GE(allocations.peak_bytes(), 100000u);
+
+    ASSERT_EQ(1u, allocations.timeline().size());
+    EXPECT_EQ(bytes, allocations.timeline()[0].bytes);
+    EXPECT_GT(allocations.bytes_per_second(), 0.0);
+}
@@ -0,0 +1,201 @@
+#include "common.h"
+#include <cstdlib>
+#include <new>
+
+//
+// Regression tests for the number of heap allocations on hot paths.
+//
+// Heap allocations are counted by replacing the global operator new for the test binary, and
+// Lua allocations via the script's allocation profiler. The expected counts are exact, so any
+// additional allocation on these paths fails the test.
+//
+
+namespace
+{
+    thread_local bool t_counting = false;
+    thread_local std::size_t t_allocations = 0;
+
+    struct allocation_count
+    {
+        std::size_t native;
+        std::size_t lua;
+    };
+
+    std::size_t lua_allocations(apolo::script& script)
+    {
+        std::size_t count = 0;
+        for (const auto& size_class : script.allocations().size_classes())
+        {
+            count += size_class.allocations;
+        }
+        return count;
+    }
+
+    // Counts the allocations made by \p function
+    template <typename Function>
+    allocation_count count_allocations(apolo::script& script, Function&& function)
+    {
+        // Use a long interval, so the rate timeline doesn't allocate
+        auto& profiler = script.allocations();
+        profiler.reset();
+        profiler.start(std::chrono::hours(1));
+        const auto lua_before = lua_allocations(script);
+
+        t_allocations = 0;
+        t_counting = true;
+        function();
+        t_counting = false;
+
+        profiler.stop();
+        return {t_allocations, lua_allocations(script) - lua_before};
+    }
+
+    // Counts the allocations made by \p function after running it once, to exclude one-time allocations
+    template <typename Function>
+    allocation_count steady_state_allocations(apolo::script& script, Function&& function)
+    {
+        count_allocations(script, function);
+        return count_allocations(script, function);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    if (t_counting)
+    {
+        ++t_allocations;
+    }
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+    class Object
+    {
+    public:
+        int get() const { return m_value; }
+        void set(int value) { m_value = value; }
+
+    private:
+        int m_value = 0;
+    };
+
+    const char* const SCRIPT = R"(
+        function nop() end
+        function sum(n) local s = 0 for i = 1, n do s = s + add(i, 0.5, "short") end return s end
+        function store(o) object = o end
+        function methods(n) for i = 1, n do object:set(object:get() + 1) end end
+        function ticks(n) for i = 1, n do yield() end end
+    )";
+
+    std::shared_ptr<apolo::type_registry> make_registry()
+    {
+        const auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_free_function("add", [](int a, double b, const std::string& c) {
+            return a + b + static_cast<double>(c.size());
+        });
+        registry->add_object_type<Object>()
+            .WithMethod("get", &Object::get)
+            .WithMethod("set", &Object::set);
+        return registry;
+    }
+}
+
+// A call allocates the executor's queue and the promise's state and result, and a Lua thread with its stack
+TEST(allocations, call)
+{
+    apolo::script script("dummy", S(SCRIPT), make_registry());
+
+    const auto count = steady_state_allocations(script, [&]{ script.call("nop"); });
+    EXPECT_EQ(3u, count.native);
+    EXPECT_EQ(3u, count.lua);
+}
+
+TEST(allocations, arguments)
+{
+    apolo::script script("dummy", S(SCRIPT), make_registry());
+
+    // Reading arguments of registered functions doesn't allocate, so the number of calls doesn't matter
+    const auto one = steady_state_allocations(script, [&]{ script.call("sum", 1); });
+    const auto many = steady_state_allocations(script, [&]{ script.call("sum", 1000); });
+    EXPECT_EQ(3u, one.native);
+    EXPECT_EQ(4u, one.lua);
+    EXPECT_EQ(one.native, many.native);
+    EXPECT_EQ(one.lua, many.lua);
+}
+
+TEST(allocations, methods)
+{
+    apolo::script script("dummy", S(SCRIPT), make_registry());
+    script.call("store", std::make_shared<Object>());
+
+    // Method calls don't allocate, so the number of calls doesn't matter
+    const auto one = steady_state_allocations(script, [&]{ script.call("methods", 1); });
+    const auto many = steady_state_allocations(script, [&]{ script.call("methods", 1000); });
+    EXPECT_EQ(3u, one.native);
+    EXPECT_EQ(4u, one.lua);
+    EXPECT_EQ(one.native, many.native);
+    EXPECT_EQ(one.lua, many.lua);
+}
+
+TEST(allocations, executor_ticks)
+{
+    apolo::script script("dummy", S(SCRIPT), make_registry());
+
+    // Resuming yielded threads doesn't allocate, so the number of yields doesn't matter
+    const auto one = steady_state_allocations(script, [&]{ script.call("ticks", 1); });
+    const auto many = steady_state_allocations(script, [&]{ script.call("ticks", 1000); });
+    EXPECT_EQ(3u, one.native);
+    EXPECT_EQ(4u, one.lua);
+    EXPECT_EQ(one.native, many.native);
+    EXPECT_EQ(one.lua, many.lua);
+}
+
+TEST(allocations, executor_ticks_with_many_threads)
+{
+    apolo::script script("dummy", S(SCRIPT), make_registry());
+
+    const auto run = [&](int yields) {
+        apolo::cooperative_executor executor;
+        std::vector<std::future<apolo::value>> futures;
+        futures.reserve(10);
+        for (int i = 0; i < 10; ++i)
+        {
+            futures.push_back(script.call_async(executor, "ticks", yields));
+        }
+        executor.run();
+    };
+
+    // The executor's queue is reused while cycling through the threads
+    const auto one = steady_state_allocations(script, [&]{ run(1); });
+    const auto many = steady_state_allocations(script, [&]{ run(1000); });
+    EXPECT_EQ(one.native, many.native);
+    EXPECT_EQ(one.lua, many.lua);
+}
+
+TEST(allocations, array_view_elements)
+{
+    apolo::script script("dummy", S("function store(v) view = v end function sum(n) local s = 0 for i = 1, n do s = s + view[i] end return s end"));
+    std::vector<double> values(1000, 1.0);
+    script.call("store", apolo::array_view<const double>(values));
+
+    // Accessing elements doesn't allocate, so the number of accesses doesn't matter
+    const auto one = steady_state_allocations(script, [&]{ script.call("sum", 1); });
+    const auto many = steady_state_allocations(script, [&]{ script.call("sum", 1000); });
+    EXPECT_EQ(one.native, many.native);
+    EXPECT_EQ(one.lua, many.lua);
+}
@@ -0,0 +1,83 @@
+#include "common.h"
+
+TEST(array_view, reads_elements)
+{
+    apolo::script script("dummy", S(R"(
+        function sum(view) local s = 0 for i = 1, #view do s = s + view[i] end return s end
+        function outside(view) return view[0] == nil and view[#view + 1] == nil and view.x == nil end
+    )"));
+
+    std::vector<double> values{1.5, 2.5, 3.0};
+    EXPECT_EQ(7.0, script.call("sum", apolo::array_view<const double>(values)).as<double>());
+    EXPECT_TRUE(script.call("outside", apolo::array_view<const double>(values)).as<bool>());
+
+    std::array<int, 4> integers{1, 2, 3, 4};
+    EXPECT_EQ(10, script.call("sum", apolo::array_view<int>(integers)).as<long long>());
+}
+
+TEST(array_view, writes_elements)
+{
+    apolo::script script("dummy", S(R"(
+        function scale(view, factor) for i = 1, #view do view[i] = view[i] * factor end end
+        function write(view, index, value) view[index] = value end
+    )"));
+
+    std::vector<float> values{1.0f, 2.0f};
+    script.call("scale", apolo::array_view<float>(values), 3);
+    EXPECT_EQ((std::vector<float>{3.0f, 6.0f}), values);
+
+    std::vector<std::uint8_t> bytes(2);
+    script.call("write", apolo::array_view<std::uint8_t>(bytes), 2, 255);
+    EXPECT_EQ(255, bytes[1]);
+    EXPECT_THROW(script.call("write", apolo::array_view<std::uint8_t>(bytes), 1, 256), apolo::runtime_error);
+    EXPECT_THROW(script.call("write", apolo::array_view<std::uint8_t>(bytes), 1, 1.5), apolo::runtime_error);
+    EXPECT_THROW(script.call("write", apolo::array_view<std::uint8_t>(bytes), 3, 1), apolo::runtime_error);
+    EXPECT_THROW(script.call("write", apolo::array_view<const std::uint8_t>(bytes), 1, 1), apolo::runtime_error);
+}
+
+TEST(array_view, passes_views_to_and_from_registered_functions)
+{
+    std::vector<long long> samples{1, 2, 3};
+
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("samples", [&]() { return apolo::array_view<long long>(samples); });
+    registry->add_free_function("total", [](apolo::array_view<const long long> view) {
+        long long total = 0;
+        for (std::size_t i = 0; i < view.size(); ++i)
+        {
+            total += view.data()[i];
+        }
+        return total;
+    });
+    registry->add_free_function("fill", [](apolo::array_view<long long> view, long long value) {
+        std::fill(view.data(), view.data() + view.size(), value);
+    });
+
+    apolo::script script("dummy", S(R"(
+        function test() local v = samples() v[1] = 10 return total(v) end
+        function test_fill() fill(samples(), 7) end
+        function test_const(v) fill(v, 1) end
+    )"), registry);
+
+    EXPECT_EQ(15, script.call("test").as<long long>());
+    EXPECT_EQ(10, samples[0]);
+
+    script.call("test_fill");
+    EXPECT_EQ((std::vector<long long>{7, 7, 7}), samples);
+
+    // Read-only views can't be passed as mutable views
+    EXPECT_THROW(script.call("test_const", apolo::array_view<const long long>(samples)), apolo::runtime_error);
+}
+
+TEST(array_view, keeps_owner_alive)
+{
+    apolo::script script("dummy", S("function store(v) stored = v end function get(i) return stored[i] end"));
+
+    auto values = std::make_shared<std::vector<double>>(std::vector<double>{4.0, 5.0});
+    script.call("store", apolo::array_view<double>(values->data(), values->size(), values));
+
+    std::weak_ptr<std::vector<double>> weak = values;
+    values.reset();
+    EXPECT_FALSE(weak.expired());
+    EXPECT_EQ(5.0, script.call("get", 2).as<double>());
+}
@@ -0,0 +1,71 @@
+#include "common.h"
+#include <apolo/bulk_construction.h>
+
+TEST(bulk_construction, constructs_in_order)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("twice", [](int x) { return 2 * x; });
+
+    std::vector<apolo::script_definition> definitions;
+    for (int i = 0; i < 50; ++i)
+    {
+        const std::string source = "x = twice(" + std::to_string(i) + ") function get() return x end";
+        definitions.push_back({"script" + std::to_string(i), S(source.c_str()), {}, registry});
+    }
+
+    auto results = apolo::construct_scripts(definitions, 4);
+    ASSERT_EQ(definitions.size(), results.size());
+    for (int i = 0; i < 50; ++i)
+    {
+        ASSERT_NE(nullptr, results[i].instance);
+        EXPECT_EQ(nullptr, results[i].error);
+        EXPECT_EQ(2 * i, results[i].instance->call("get").as<long long int>());
+    }
+}
+
+TEST(bulk_construction, failures_are_reported_separately)
+{
+    std::vector<apolo::script_definition> definitions{
+        {"good", S("x = 1"), {}, nullptr},
+        {"syntax", S("function foo("), {}, nullptr},
+        {"runtime", S("unknown_function()"), {}, nullptr},
+        {"also_good", S("y = 2"), {}, nullptr},
+    };
+
+    auto results = apolo::construct_scripts(definitions, 2);
+    ASSERT_EQ(4u, results.size());
+    EXPECT_NE(nullptr, results[0].instance);
+    EXPECT_NE(nullptr, results[3].instance);
+
+    EXPECT_EQ(nullptr, results[1].instance);
+    EXPECT_THROW(std::rethrow_exception(results[1].error), apolo::syntax_error);
+    EXPECT_EQ(nullptr, results[2].instance);
+    EXPECT_THROW(std::rethrow_exception(results[2].error), apolo::runtime_error);
+}
+
+TEST(bulk_construction, shared_registry_collects_statistics)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("foo", [] {});
+    registry->collect_statistics(true);
+
+    std::vector<apolo::script_definition> definitions(100, {"dummy", S("for i = 1, 10 do foo() end"), {}, registry});
+    auto results = apolo::construct_scripts(definitions, 8);
+    for (const auto& result : results)
+    {
+        EXPECT_NE(nullptr, result.instance);
+    }
+
+    auto statistics = registry->statistics();
+    ASSERT_EQ(1u, statistics.size());
+    EXPECT_EQ(1000u, statistics[0].calls);
+}
+
+TEST(bulk_construction, more_threads_than_scripts)
+{
+    EXPECT_TRUE(apolo::construct_scripts({}).empty());
+
+    auto results = apolo::construct_scripts({{"dummy", S("x = 1"), {}, nullptr}}, 16);
+    ASSERT_EQ(1u, results.size());
+    EXPECT_NE(nullptr, results[0].instance);
+}
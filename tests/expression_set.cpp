@@ -0,0 +1,163 @@
+#include "common.h"
+#include <apolo/expression_set.h>
+
+TEST(expression_set, evaluates_expressions)
+{
+    apolo::expression_set set({"price", "region"});
+    const auto cheap = set.add("price < 10");
+    const auto eu = set.add(R"(price > 10 and region == "EU")");
+    const auto total = set.add("price * 1.2");
+    const auto upper = set.add("string.upper(region)");
+    EXPECT_EQ(4u, set.size());
+
+    EXPECT_TRUE(set.test(cheap, 5, "US"));
+    EXPECT_FALSE(set.test(cheap, 15, "US"));
+    EXPECT_TRUE(set.test(eu, 12.5, "EU"));
+    EXPECT_FALSE(set.test(eu, 12.5, std::string("US")));
+    EXPECT_DOUBLE_EQ(12.0, set.evaluate(total, 10, "EU").as<double>());
+    EXPECT_EQ("EU", set.evaluate(upper, 0, "eu").as<std::string>());
+}
+
+TEST(expression_set, parameters_are_not_globals)
+{
+    apolo::expression_set set({"x"});
+    const auto local = set.add("x");
+    const auto global = set.add("_G.x");
+
+    EXPECT_EQ(3, set.evaluate(local, 3).as<long long>());
+    EXPECT_EQ(apolo::value(nullptr), set.evaluate(global, 3));
+}
+
+TEST(expression_set, calls_registered_functions)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("discount", [](double price) { return price * 0.5; });
+
+    apolo::expression_set set({"price"}, registry);
+    const auto expression = set.add("discount(price) > 10");
+    EXPECT_TRUE(set.test(expression, 30));
+    EXPECT_FALSE(set.test(expression, 10));
+}
+
+TEST(expression_set, sandboxed)
+{
+    apolo::expression_set set({});
+    EXPECT_EQ(apolo::value(nullptr), set.evaluate(set.add("os")));
+    EXPECT_EQ(apolo::value(nullptr), set.evaluate(set.add("load")));
+    EXPECT_EQ(2, set.evaluate(set.add("math.max(1, 2)")).as<long long>());
+}
+
+TEST(expression_set, errors)
+{
+    EXPECT_THROW(apolo::expression_set({"end"}), apolo::runtime_error);
+
+    apolo::expression_set set({"x"});
+    EXPECT_THROW(set.add("x >"), apolo::runtime_error);
+    EXPECT_EQ(0u, set.size());
+
+    const auto expression = set.add("x + 1");
+    EXPECT_THROW(set.evaluate(expression, "a"), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate(expression), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate(expression, 1, 2), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate(apolo::expression_set::handle{2}, 1), apolo::runtime_error);
+
+    // The set is still usable after errors
+    EXPECT_EQ(2, set.evaluate(expression, 1).as<long long>());
+}
+
+TEST(expression_set, trailing_comments)
+{
+    apolo::expression_set set({"x"});
+    EXPECT_EQ(4, set.evaluate(set.add("x * 2 -- double"), 2).as<long long>());
+}
+
+TEST(expression_set, evaluate_batch)
+{
+    // Spans several blocks of rows and a partial last block
+    constexpr std::size_t rows = 2500;
+    std::vector<double> prices(rows);
+    std::vector<std::string> regions(rows);
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        prices[i] = static_cast<double>(i % 20);
+        regions[i] = (i % 3 == 0) ? "EU" : "US";
+    }
+
+    apolo::expression_set set({"price", "region"});
+    const auto total = set.add(R"(region == "EU" and price * 2 or price)");
+    const auto eu = set.add(R"(price > 10 and region == "EU")");
+
+    std::vector<double> results(rows);
+    set.evaluate_batch(total, {prices, regions}, rows, results);
+    set.evaluate_batch(eu, {prices, regions}, rows - 1, apolo::array_view<double>(results.data(), rows - 1));
+    for (std::size_t i = 0; i + 1 < rows; ++i)
+    {
+        ASSERT_EQ(set.test(eu, prices[i], regions[i]) ? 1.0 : 0.0, results[i]) << i;
+    }
+    EXPECT_EQ(set.evaluate(total, prices[rows - 1], regions[rows - 1]).as<double>(), results[rows - 1]);
+}
+
+TEST(expression_set, test_batch)
+{
+    constexpr std::size_t rows = 1100;
+    std::vector<int> quantities(rows);
+    std::vector<std::string_view> regions(rows, "EU");
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        quantities[i] = static_cast<int>(i);
+    }
+
+    apolo::expression_set set({"quantity", "region"});
+    const auto odd = set.add(R"(quantity % 2 == 1 and region == "EU")");
+
+    std::vector<std::uint64_t> selection((rows + 63) / 64, ~std::uint64_t(0));
+    set.test_batch(odd, {apolo::column(quantities.data()), regions}, rows, selection);
+    for (std::size_t i = 0; i < selection.size() * 64; ++i)
+    {
+        ASSERT_EQ(i < rows && i % 2 == 1, ((selection[i / 64] >> (i % 64)) & 1) != 0) << i;
+    }
+
+    // No rows
+    set.test_batch(odd, {quantities, regions}, 0, apolo::array_view<std::uint64_t>(nullptr, 0));
+}
+
+TEST(expression_set, batch_parameter_names)
+{
+    // Parameters named like the variables of the loop over the rows
+    apolo::expression_set set({"_results", "__i"});
+    const std::vector<double> a{1, 2, 3};
+    const bool flags[] = {true, false, true};
+    std::vector<double> results(3);
+    set.evaluate_batch(set.add("__i and _results or -_results"), {a, apolo::column(flags)}, 3, results);
+    EXPECT_EQ((std::vector<double>{1, -2, 3}), results);
+
+    apolo::expression_set constants({});
+    constants.evaluate_batch(constants.add("7"), {}, 3, results);
+    EXPECT_EQ((std::vector<double>{7, 7, 7}), results);
+}
+
+TEST(expression_set, batch_errors)
+{
+    apolo::expression_set set({"x"});
+    const auto increment = set.add("x + 1");
+    const auto name = set.add("tostring(x)");
+    const std::vector<double> values{1, 2, 3};
+    std::vector<double> results(3);
+    std::vector<std::uint64_t> selection(1);
+
+    EXPECT_THROW(set.evaluate_batch(increment, {values, values}, 3, results), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate_batch(increment, {values}, 4, results), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate_batch(increment, {apolo::column(values.data())}, 4, results), apolo::runtime_error);
+    EXPECT_THROW(set.test_batch(increment, {values}, 3, apolo::array_view<std::uint64_t>(nullptr, 0)), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate_batch(apolo::expression_set::handle{3}, {values}, 3, results), apolo::runtime_error);
+    EXPECT_THROW(set.evaluate_batch(name, {values}, 3, results), apolo::runtime_error);
+
+    const std::vector<std::string> strings{"a", "b", "c"};
+    EXPECT_THROW(set.evaluate_batch(increment, {strings}, 3, results), apolo::runtime_error);
+
+    // The set is still usable after errors
+    set.evaluate_batch(increment, {values}, 3, results);
+    EXPECT_EQ((std::vector<double>{2, 3, 4}), results);
+    set.test_batch(name, {values}, 3, selection);
+    EXPECT_EQ(7u, selection[0]);
+}
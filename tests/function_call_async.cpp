@@ -27,3 +27,22 @@ TEST(function_call, call_async_with_yield_finishes)
     executor.run();
     EXPECT_EQ(3, future.get().as<long long int>());
 }
+
+TEST(function_call, many_yielding_threads_survive_garbage_collection)
+{
+    // Allocate in every step so the garbage collector runs while threads are suspended
+    apolo::script script("dummy", S("function foo(n) local t = {} for i = 1, n do t[i] = { i } yield() end return #t end"));
+
+    apolo::cooperative_executor executor;
+    std::vector<std::future<apolo::value>> futures;
+    for (int i = 0; i < 200; ++i)
+    {
+        futures.push_back(script.call_async(executor, "foo", 50));
+    }
+    executor.run();
+
+    for (auto& future : futures)
+    {
+        EXPECT_EQ(50, future.get().as<long long int>());
+    }
+}
@@ -0,0 +1,117 @@
+#include "common.h"
+#include <map>
+
+TEST(generator, iterates_ranges)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("numbers", []() { return apolo::iterate(std::vector<int>{10, 20, 30}); });
+    registry->add_free_function("names", []() {
+        return apolo::iterate(std::map<std::string, double>{{"a", 1.5}, {"b", 2.5}});
+    });
+
+    apolo::script script("dummy", S(R"(
+        function sum() local s = 0 for i, v in numbers() do s = s + i * v end return s end
+        function join() local s = "" for k, v in names() do s = s .. k .. "=" .. tostring(v) .. ";" end return s end
+    )"), registry);
+
+    EXPECT_EQ(140, script.call("sum").as<long long>());
+    EXPECT_EQ("a=1.5;b=2.5;", script.call("join").as<std::string>());
+}
+
+TEST(generator, pulls_elements_lazily)
+{
+    int pulled = 0;
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("naturals", [&]() {
+        return apolo::make_generator([&pulled, n = 0]() mutable -> std::optional<int> {
+            ++pulled;
+            return ++n;
+        });
+    });
+
+    apolo::script script("dummy", S(R"(
+        function find(target) for _, v in naturals() do if v == target then return v end end end
+    )"), registry);
+
+    EXPECT_EQ(1000, script.call("find", 1000).as<long long>());
+    EXPECT_EQ(1000, pulled);
+}
+
+TEST(generator, iterates_iterator_pairs)
+{
+    const std::vector<std::string> words{"lazy", "iterator"};
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("words", [&]() { return apolo::iterate(words.begin(), words.end()); });
+
+    apolo::script script("dummy", S(R"(
+        function count() local n = 0 for _, w in words() do n = n + #w end return n end
+    )"), registry);
+
+    EXPECT_EQ(12, script.call("count").as<long long>());
+}
+
+TEST(generator, iterates_lvalue_ranges_in_place)
+{
+    // A range that counts how often it's copied
+    struct counted_range
+    {
+        counted_range(std::vector<int> values, int& copies) : m_values(std::move(values)), m_copies(copies) {}
+        counted_range(const counted_range& other) : m_values(other.m_values), m_copies(other.m_copies) { ++m_copies; }
+
+        auto begin() const { return m_values.begin(); }
+        auto end() const { return m_values.end(); }
+
+        std::vector<int> m_values;
+        int& m_copies;
+    };
+
+    int copies = 0;
+    const counted_range range({1, 2, 3}, copies);
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("numbers", [&]() { return apolo::iterate(range); });
+
+    apolo::script script("dummy", S(R"(
+        function first() for _, v in numbers() do return v end end
+    )"), registry);
+
+    EXPECT_EQ(1, script.call("first").as<long long>());
+    EXPECT_EQ(0, copies);
+}
+
+TEST(generator, reports_errors)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("failing", []() {
+        return apolo::make_generator([]() -> std::optional<int> { throw std::runtime_error("generator failed"); });
+    });
+
+    apolo::script script("dummy", S("function test() for _ in failing() do end end"), registry);
+
+    try
+    {
+        script.call("test");
+        FAIL() << "expected an exception";
+    }
+    catch (const apolo::runtime_error& e)
+    {
+        EXPECT_THAT(e.what(), ::testing::HasSubstr("generator failed"));
+    }
+}
+
+TEST(generator, releases_state)
+{
+    auto owner = std::make_shared<int>(0);
+    std::weak_ptr<int> weak = owner;
+
+    {
+        const auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_free_function("items", [owner]() {
+            return apolo::make_generator([owner]() -> std::optional<int> { return *owner; });
+        });
+        owner.reset();
+
+        apolo::script script("dummy", S("function test() for _ in items() do return end end"), registry);
+        script.call("test");
+    }
+    EXPECT_TRUE(weak.expired());
+}
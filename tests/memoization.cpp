@@ -0,0 +1,138 @@
+#include "common.h"
+
+namespace
+{
+    // A pure function that counts how often it runs
+    const char* const TAX_SCRIPT = R"(
+        runs = 0
+        function tax(region, category)
+            runs = runs + 1
+            if region == "EU" then return category * 2 end
+            return category
+        end
+        function count() return runs end
+        function fail(x) runs = runs + 1; error("failed") end
+    )";
+
+    long long runs(apolo::script& script)
+    {
+        return script.call("count").as<long long>();
+    }
+}
+
+TEST(memoization, caches_results_of_pure_functions)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    script.mark_pure("tax");
+
+    EXPECT_EQ(6, script.call("tax", "EU", 3).as<long long>());
+    EXPECT_EQ(6, script.call("tax", "EU", 3).as<long long>());
+    EXPECT_EQ(3, script.call("tax", std::string("US"), 3).as<long long>());
+    EXPECT_EQ(3, script.call("tax", "US", 3).as<long long>());
+    EXPECT_EQ(2, runs(script));
+
+    // Integers and floats are different arguments
+    EXPECT_EQ(6.0, script.call("tax", "EU", 3.0).as<double>());
+    EXPECT_EQ(3, runs(script));
+
+    const auto statistics = script.memoization("tax");
+    EXPECT_EQ(2u, statistics.hits);
+    EXPECT_EQ(3u, statistics.misses);
+    EXPECT_EQ(0u, statistics.evictions);
+    EXPECT_EQ(3u, statistics.size);
+    EXPECT_DOUBLE_EQ(0.4, statistics.hit_ratio());
+}
+
+TEST(memoization, functions_are_not_pure_by_default)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    script.call("tax", "EU", 3);
+    script.call("tax", "EU", 3);
+    EXPECT_EQ(2, runs(script));
+    EXPECT_THROW(script.memoization("tax"), apolo::runtime_error);
+}
+
+TEST(memoization, evicts_least_recently_used)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    script.mark_pure("tax", 2);
+
+    script.call("tax", "EU", 1);
+    script.call("tax", "EU", 2);
+    script.call("tax", "EU", 1);
+    script.call("tax", "EU", 3);
+    EXPECT_EQ(3, runs(script));
+
+    // (EU, 2) was evicted, (EU, 1) was used more recently
+    script.call("tax", "EU", 1);
+    EXPECT_EQ(3, runs(script));
+    script.call("tax", "EU", 2);
+    EXPECT_EQ(4, runs(script));
+
+    const auto statistics = script.memoization("tax");
+    EXPECT_EQ(2u, statistics.evictions);
+    EXPECT_EQ(2u, statistics.size);
+}
+
+TEST(memoization, invalidate)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    script.mark_pure("tax");
+    script.call("tax", "EU", 1);
+    script.invalidate_memoized();
+    EXPECT_EQ(0u, script.memoization("tax").size);
+
+    script.call("tax", "EU", 1);
+    EXPECT_EQ(2, runs(script));
+    EXPECT_EQ(2u, script.memoization("tax").misses);
+}
+
+TEST(memoization, failed_calls_are_not_cached)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    script.mark_pure("fail");
+    EXPECT_THROW(script.call("fail", 1), apolo::runtime_error);
+    EXPECT_THROW(script.call("fail", 1), apolo::runtime_error);
+    EXPECT_EQ(2, runs(script));
+    EXPECT_EQ(0u, script.memoization("fail").size);
+}
+
+TEST(memoization, arguments_that_are_not_values)
+{
+    apolo::script script("dummy", S(R"(
+        runs = 0
+        function sum(values) runs = runs + 1; return values[1] + values[2] end
+    )"));
+    script.mark_pure("sum");
+
+    std::vector<double> values{1, 2};
+    EXPECT_EQ(3.0, script.call("sum", apolo::array_view<double>(values)).as<double>());
+    values[1] = 3;
+    EXPECT_EQ(4.0, script.call("sum", apolo::array_view<double>(values)).as<double>());
+    EXPECT_EQ(0u, script.memoization("sum").misses);
+}
+
+TEST(memoization, arguments_that_are_objects)
+{
+    struct item
+    {
+        int price() const { return m_price; }
+        int m_price;
+    };
+
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_object_type<item>().WithMethod("price", &item::price);
+    apolo::script script("dummy", S("function price(x) return x:price() end"), registry);
+    script.mark_pure("price");
+
+    // A later object can have the address of a freed one, so objects are never cache keys
+    EXPECT_EQ(1, script.call("price", std::make_shared<item>(item{1})).as<long long>());
+    EXPECT_EQ(2, script.call("price", std::make_shared<item>(item{2})).as<long long>());
+    EXPECT_EQ(0u, script.memoization("price").misses);
+}
+
+TEST(memoization, invalid_capacity)
+{
+    apolo::script script("dummy", S(TAX_SCRIPT));
+    EXPECT_THROW(script.mark_pure("tax", 0), apolo::runtime_error);
+}
@@ -0,0 +1,74 @@
+#include "common.h"
+
+namespace
+{
+    // Runs a script with the minimal footprint profile and returns the result of calling 'test'
+    apolo::value run(const char* code, apolo::configuration config = apolo::configuration::minimal_footprint())
+    {
+        apolo::script script("dummy", S(code), config);
+        return script.call("test");
+    }
+}
+
+TEST(minimal_footprint, libraries_are_loaded_on_use)
+{
+    EXPECT_EQ("ABC", run(R"(function test() return string.upper("abc") end)").as<std::string>());
+    EXPECT_EQ("ABC", run(R"(function test() return ("abc"):upper() end)").as<std::string>());
+    EXPECT_EQ("a,b", run(R"(function test() return table.concat({"a", "b"}, ",") end)").as<std::string>());
+    EXPECT_EQ(3, run("function test() return math.max(1, 3) end").as<long long>());
+    EXPECT_EQ(2, run(R"(function test() return utf8.len("\u{20AC}x") end)").as<long long>());
+    EXPECT_EQ(apolo::value(nullptr), run("function test() return undefined end"));
+
+    auto config = apolo::configuration::minimal_footprint();
+    config.vector_math(true);
+    EXPECT_EQ(3.0, run("function test() return vmath.vec3(1, 2, 3).z end", config).as<double>());
+    EXPECT_EQ(apolo::value(nullptr), run("function test() return vmath end"));
+}
+
+TEST(minimal_footprint, string_methods_with_shadowed_library)
+{
+    // Loading the library for a method call doesn't replace the script's global
+    EXPECT_EQ("X5", run(R"(
+        string = 5
+        function test() return ("x"):upper() .. tostring(string) end
+    )").as<std::string>());
+
+    EXPECT_EQ("x=1", run(R"(function test()
+        local buffer = string_buffer()
+        buffer:appendf("%s=%d", "x", 1)
+        return buffer:tostring()
+    end)").as<std::string>());
+}
+
+TEST(minimal_footprint, snapshot)
+{
+    apolo::script original("dummy", S(R"(
+        data = {"a", "b"}
+        function test() return string.upper(table.concat(data)) end
+    )"), apolo::configuration::minimal_footprint());
+
+    apolo::script restored("dummy", original.snapshot(), apolo::configuration::minimal_footprint(), nullptr);
+    EXPECT_EQ("AB", restored.call("test").as<std::string>());
+}
+
+TEST(minimal_footprint, baseline_memory)
+{
+    const char* code = R"(
+        local garbage = {}
+        for i = 1, 1000 do garbage[i] = "temporary " .. tostring(i) end
+        function test() return 1 end
+    )";
+
+    apolo::script regular("dummy", S(code));
+    apolo::script minimal("dummy", S(code), apolo::configuration::minimal_footprint());
+    EXPECT_LT(0u, minimal.baseline_memory());
+    EXPECT_LT(minimal.baseline_memory(), regular.baseline_memory());
+    EXPECT_EQ(minimal.baseline_memory(), minimal.allocations().live_bytes());
+
+    // Loading libraries on use saves more than compaction alone
+    apolo::configuration compact_only;
+    compact_only.compact_after_load(true);
+    apolo::script compacted("dummy", S(code), compact_only);
+    EXPECT_LT(minimal.baseline_memory(), compacted.baseline_memory());
+    EXPECT_LT(compacted.baseline_memory(), regular.baseline_memory());
+}
@@ -0,0 +1,76 @@
+#include "common.h"
+#include <thread>
+
+using ::testing::HasSubstr;
+using ::testing::StartsWith;
+
+namespace
+{
+    const char* const BUSY_SCRIPT = R"(
+        function busy() local s = 0 for i = 1, 200000 do s = s + i end return s end
+        function outer() local s = busy() return s end
+    )";
+}
+
+TEST(profiler, not_running_by_default)
+{
+    apolo::script script("dummy", S(BUSY_SCRIPT));
+    EXPECT_FALSE(script.profiler().running());
+    script.call("outer");
+    EXPECT_EQ("", script.profiler().folded_stacks());
+}
+
+TEST(profiler, samples_lua_stacks)
+{
+    apolo::script script("dummy", S(BUSY_SCRIPT));
+    script.profiler().start(100);
+    EXPECT_TRUE(script.profiler().running());
+    script.call("outer");
+    script.profiler().stop();
+    EXPECT_FALSE(script.profiler().running());
+
+    EXPECT_THAT(script.profiler().folded_stacks(), HasSubstr("outer (dummy:3);busy (dummy:2) "));
+
+    const auto functions = script.profiler().functions();
+    ASSERT_EQ(2u, functions.size());
+    EXPECT_EQ("busy (dummy:2)", functions[0].name);
+    EXPECT_EQ("outer (dummy:3)", functions[1].name);
+    EXPECT_EQ(functions[0].self, functions[0].total);
+    EXPECT_GE(functions[1].total, functions[0].total);
+
+    // No more samples after stopping
+    const auto folded = script.profiler().folded_stacks();
+    script.call("outer");
+    EXPECT_EQ(folded, script.profiler().folded_stacks());
+
+    script.profiler().reset();
+    EXPECT_EQ("", script.profiler().folded_stacks());
+}
+
+TEST(profiler, native_functions_by_registered_name)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("native_sleep", []() -> void {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    });
+
+    apolo::script script("dummy", S("function foo() native_sleep() end"), registry);
+    script.profiler().start();
+    script.call("foo");
+
+    EXPECT_THAT(script.profiler().folded_stacks(), HasSubstr("foo (dummy:1);native_sleep "));
+    const auto functions = script.profiler().functions();
+    ASSERT_FALSE(functions.empty());
+    EXPECT_EQ("native_sleep", functions[0].name);
+    EXPECT_GE(functions[0].self, std::chrono::milliseconds(2));
+}
+
+TEST(profiler, configuration_profiles_top_level_chunk)
+{
+    apolo::configuration configuration;
+    configuration.profiler_sample_interval(100);
+
+    apolo::script script("dummy", S("local s = 0 for i = 1, 100000 do s = s + i end"), configuration);
+    EXPECT_TRUE(script.profiler().running());
+    EXPECT_THAT(script.profiler().folded_stacks(), StartsWith("main (dummy) "));
+}
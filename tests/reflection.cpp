@@ -0,0 +1,83 @@
+#include "common.h"
+
+namespace
+{
+    struct position
+    {
+        double x;
+        double y;
+    };
+
+    struct order
+    {
+        long long id;
+        std::string symbol;
+        double price;
+        int quantity;
+        bool active;
+        position location;
+        std::vector<int> fills;
+    };
+}
+
+template <>
+struct apolo::reflect<position>
+{
+    static constexpr auto fields = std::make_tuple(
+        apolo::field("x", &position::x),
+        apolo::field("y", &position::y));
+};
+
+template <>
+struct apolo::reflect<order>
+{
+    static constexpr auto fields = std::make_tuple(
+        apolo::field("id", &order::id),
+        apolo::field("symbol", &order::symbol),
+        apolo::field("price", &order::price),
+        apolo::field("quantity", &order::quantity),
+        apolo::field("active", &order::active),
+        apolo::field("location", &order::location),
+        apolo::field("fills", &order::fills));
+};
+
+TEST(reflection, pushes_structs_as_tables)
+{
+    apolo::script script("dummy", S(R"(
+        function describe(o)
+            return o.symbol .. ":" .. tostring(o.id) .. ":" .. tostring(o.price * o.quantity) .. ":" ..
+                   tostring(o.active) .. ":" .. tostring(o.location.y) .. ":" .. tostring(#o.fills)
+        end
+    )"));
+
+    const order o{42, "ABC", 1.5, 4, true, {1.0, 2.0}, {3, 1}};
+    EXPECT_EQ("ABC:42:6.0:true:2.0:2", script.call("describe", o).as<std::string>());
+}
+
+TEST(reflection, reads_and_returns_structs)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("fill", [](order o) {
+        o.quantity -= 1;
+        o.fills.push_back(1);
+        o.active = o.quantity > 0;
+        return o;
+    });
+    registry->add_free_function("total", [](const order& o) { return o.price * o.quantity; });
+
+    apolo::script script("dummy", S(R"(
+        function test()
+            local o = { id = 1, symbol = "X", price = 2.5, quantity = 1, active = true, location = { x = 0, y = 0 }, fills = {} }
+            local filled = fill(o)
+            return tostring(filled.active) .. ":" .. tostring(filled.quantity) .. ":" .. tostring(#filled.fills)
+        end
+        function test_total() return total({ id = 1, symbol = "X", price = 2.5, quantity = 4, active = true, location = { x = 0, y = 0 }, fills = {} }) end
+        function test_missing() return total({ id = 1, symbol = "X", price = 2.5 }) end
+        function test_wrong_type() return total({ id = 1, symbol = "X", price = "2.5", quantity = 4, active = true, location = { x = 0, y = 0 }, fills = {} }) end
+    )"), registry);
+
+    EXPECT_EQ("false:0:1", script.call("test").as<std::string>());
+    EXPECT_EQ(10.0, script.call("test_total").as<double>());
+    EXPECT_THROW(script.call("test_missing"), apolo::runtime_error);
+    EXPECT_THROW(script.call("test_wrong_type"), apolo::runtime_error);
+}
@@ -77,3 +77,19 @@ TEST(register_global_function, throws_non_exception_in_function)
     });
     EXPECT_THROW(apolo::script("dummy", S("foo()"), registry), apolo::runtime_error);
 }
+
+TEST(register_global_function, returns_value)
+{
+    struct counter
+    {
+        int add(int amount) { return m_total += amount; }
+        int m_total = 0;
+    };
+
+    counter c;
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("answer", []() { return 42; });
+    registry->add_free_function("add", c, &counter::add);
+    apolo::script script("dummy", S("function test() return answer() + add(2) + add(3) end"), registry);
+    EXPECT_EQ(49, script.call("test").as<long long int>());
+}
@@ -0,0 +1,203 @@
+#include "common.h"
+#include <thread>
+
+namespace
+{
+    const char* const LIBRARY = "function lib_value() return 42 end";
+
+    // Loads libraries whose data is delivered by a call to 'deliver' from a script
+    class async_loader
+    {
+    public:
+        async_loader()
+        {
+            configuration.async_load_function([this](const std::string& name) {
+                names.push_back(name);
+                return promise.get_future();
+            });
+            registry->add_free_function("deliver", [this] { promise.set_value(S(LIBRARY)); });
+            registry->add_free_function("step", [this](const std::string& name) { steps.push_back(name); });
+        }
+
+        std::promise<apolo::script_data> promise;
+        std::vector<std::string> names;
+        std::vector<std::string> steps;
+        apolo::configuration configuration;
+        std::shared_ptr<apolo::type_registry> registry = std::make_shared<apolo::type_registry>();
+    };
+}
+
+TEST(require_async, require_yields_until_loaded)
+{
+    async_loader loader;
+    apolo::script script("dummy", S("function a() require('lib') step('a') return lib_value() end "
+                                     "function b() step('b') deliver() end"), loader.configuration, loader.registry);
+
+    apolo::cooperative_executor executor;
+    auto a = script.call_async(executor, "a");
+    auto b = script.call_async(executor, "b");
+    executor.run();
+
+    EXPECT_EQ(42, a.get().as<long long int>());
+    EXPECT_EQ((std::vector<std::string>{"b", "a"}), loader.steps);
+}
+
+TEST(require_async, concurrent_requires_share_fetch)
+{
+    async_loader loader;
+    apolo::script script("dummy", S("function a() require('lib') return lib_value() end "
+                                     "function b() deliver() end"), loader.configuration, loader.registry);
+
+    apolo::cooperative_executor executor;
+    auto first = script.call_async(executor, "a");
+    auto second = script.call_async(executor, "a");
+    script.call_async(executor, "b");
+    executor.run();
+
+    EXPECT_EQ(42, first.get().as<long long int>());
+    EXPECT_EQ(42, second.get().as<long long int>());
+    EXPECT_EQ((std::vector<std::string>{"lib"}), loader.names);
+}
+
+TEST(require_async, scripts_share_fetch)
+{
+    async_loader loader;
+
+    apolo::cooperative_executor executor;
+    auto first = apolo::script::create_async(executor, "first", S("require(' lib ') x = lib_value()"), loader.configuration, loader.registry);
+    auto second = apolo::script::create_async(executor, "second", S("require('lib') x = lib_value()"), loader.configuration, loader.registry);
+    auto third = apolo::script::create_async(executor, "third", S("deliver()"), loader.configuration, loader.registry);
+    executor.run();
+
+    EXPECT_NE(nullptr, first.get());
+    EXPECT_NE(nullptr, second.get());
+    EXPECT_NE(nullptr, third.get());
+    EXPECT_EQ((std::vector<std::string>{"lib"}), loader.names);
+}
+
+TEST(require_async, waits_outside_of_threads)
+{
+    async_loader loader;
+    loader.promise.set_value(S(LIBRARY));
+
+    apolo::script script("dummy", S("require('lib') function foo() return lib_value() end"), loader.configuration, loader.registry);
+    EXPECT_EQ(42, script.call("foo").as<long long int>());
+    EXPECT_EQ((std::vector<std::string>{"lib"}), loader.names);
+}
+
+TEST(require_async, load_error)
+{
+    async_loader loader;
+    loader.promise.set_exception(std::make_exception_ptr(apolo::runtime_error("not found")));
+
+    apolo::script script("dummy", S("function foo() require('lib') end"), loader.configuration, loader.registry);
+    EXPECT_THROW(script.call("foo"), apolo::runtime_error);
+}
+
+TEST(require_async, takes_precedence)
+{
+    async_loader loader;
+    loader.promise.set_value(S(LIBRARY));
+    loader.configuration.load_function([](const std::string&) -> apolo::script_data { throw apolo::runtime_error("not called"); });
+
+    EXPECT_NO_THROW(apolo::script("dummy", S("require('lib')"), loader.configuration, loader.registry));
+    EXPECT_TRUE(loader.configuration.async_load_function());
+
+    loader.configuration.async_load_function(nullptr);
+    EXPECT_FALSE(loader.configuration.async_load_function());
+    EXPECT_THROW(apolo::script("dummy", S("require('lib')"), loader.configuration), apolo::runtime_error);
+}
+
+TEST(require_async, executor_blocks_while_fetching)
+{
+    apolo::configuration configuration;
+    configuration.usage_accounting(true);
+    configuration.async_load_function([](const std::string&) {
+        return std::async(std::launch::async, [] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return S(LIBRARY);
+        });
+    });
+    apolo::script script("dummy", S("function foo() require('lib') return lib_value() end"), configuration);
+    script.reset_usage();
+
+    apolo::cooperative_executor executor;
+    auto future = script.call_async(executor, "foo");
+    executor.run();
+    EXPECT_EQ(42, future.get().as<long long int>());
+
+    // The waiting thread isn't resumed until the library arrived
+    EXPECT_LT(script.usage().wall_time, std::chrono::milliseconds(25));
+}
+
+TEST(require_async, waiting_thread_resumes_while_others_yield)
+{
+    apolo::configuration configuration;
+    configuration.async_load_function([](const std::string&) {
+        return std::async(std::launch::async, [] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            return S(LIBRARY);
+        });
+    });
+    apolo::script script("dummy", S(R"(
+        loaded = false
+        function a() require('lib') loaded = true end
+        function b()
+            local yields = 0
+            while not loaded do
+                yields = yields + 1
+                if yields > 1000000 then error("the waiting thread was never resumed") end
+                yield()
+            end
+        end
+    )"), configuration);
+
+    apolo::cooperative_executor executor;
+    auto a = script.call_async(executor, "a");
+    auto b = script.call_async(executor, "b");
+    executor.run();
+    EXPECT_NO_THROW(a.get());
+    EXPECT_NO_THROW(b.get());
+}
+
+TEST(require_async, waiting_thread_resumes_while_deprioritized_threads_yield)
+{
+    apolo::configuration configuration;
+    configuration.async_load_function([](const std::string&) {
+        return std::async(std::launch::async, [] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            return S(LIBRARY);
+        });
+    });
+    bool loaded = false;
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("loaded", [&] { return loaded; });
+    registry->add_free_function("set_loaded", [&] { loaded = true; });
+    apolo::script waiting("waiting", S("function a() require('lib') set_loaded() end"), configuration, registry);
+
+    apolo::usage_quota quota;
+    quota.instructions = 1000;
+    quota.action = apolo::quota_action::deprioritize;
+    apolo::configuration greedy_configuration;
+    greedy_configuration.usage_quota(quota);
+    apolo::script greedy("greedy", S(R"(
+        function busy() local s = 0 for i = 1, 100000 do s = s + i end end
+        function b()
+            local yields = 0
+            while not loaded() do
+                yields = yields + 1
+                if yields > 1000000 then error("the waiting thread was never resumed") end
+                yield()
+            end
+        end
+    )"), greedy_configuration, registry);
+    greedy.call("busy");
+    ASSERT_TRUE(greedy.quota_exceeded());
+
+    apolo::cooperative_executor executor;
+    auto a = waiting.call_async(executor, "a");
+    auto b = greedy.call_async(executor, "b");
+    executor.run();
+    EXPECT_NO_THROW(a.get());
+    EXPECT_NO_THROW(b.get());
+}
@@ -0,0 +1,78 @@
+#include "common.h"
+
+namespace
+{
+    std::vector<std::string> s_steps;
+
+    void step(const std::string& name)
+    {
+        s_steps.push_back(name);
+    }
+}
+
+TEST(script_async, runs_on_executor)
+{
+    apolo::cooperative_executor executor;
+    auto future = apolo::script::create_async(executor, "dummy", S("x = 42 function foo() return x end"));
+    EXPECT_NE(std::future_status::ready, future.wait_for(std::chrono::seconds(0)));
+
+    executor.run();
+    auto script = future.get();
+    ASSERT_NE(nullptr, script);
+    EXPECT_EQ(42, script->call("foo").as<long long int>());
+}
+
+TEST(script_async, top_level_yields_interleave)
+{
+    s_steps.clear();
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("step", &step);
+
+    apolo::cooperative_executor executor;
+    auto first = apolo::script::create_async(executor, "first", S("step('a1') yield() step('a2')"), registry);
+    auto second = apolo::script::create_async(executor, "second", S("step('b1') yield() step('b2')"), registry);
+    executor.run();
+
+    EXPECT_NE(nullptr, first.get());
+    EXPECT_NE(nullptr, second.get());
+    EXPECT_EQ((std::vector<std::string>{"a1", "b1", "a2", "b2"}), s_steps);
+}
+
+TEST(script_async, syntax_error)
+{
+    apolo::cooperative_executor executor;
+    auto future = apolo::script::create_async(executor, "dummy", S("function foo("));
+    executor.run();
+    EXPECT_THROW(future.get(), apolo::syntax_error);
+}
+
+TEST(script_async, runtime_error_after_yield)
+{
+    apolo::cooperative_executor executor;
+    auto future = apolo::script::create_async(executor, "dummy", S("yield() unknown_function()"));
+    executor.run();
+    EXPECT_THROW(future.get(), apolo::runtime_error);
+}
+
+TEST(script_async, abandoned)
+{
+    std::future<std::unique_ptr<apolo::script>> future;
+    {
+        apolo::cooperative_executor executor;
+        future = apolo::script::create_async(executor, "dummy", S("x = 1"));
+    }
+    EXPECT_THROW(future.get(), apolo::runtime_error);
+}
+
+TEST(script_async, require_and_compaction)
+{
+    apolo::configuration config = apolo::configuration::minimal_footprint();
+    config.load_function([](const std::string& name) { return S(("function library_name() return '" + name + "' end").c_str()); });
+
+    apolo::cooperative_executor executor;
+    auto future = apolo::script::create_async(executor, "dummy", S("require('mylib') yield() function foo() return library_name() end"), config);
+    executor.run();
+    auto script = future.get();
+    EXPECT_EQ("mylib", script->call("foo").as<std::string>());
+    EXPECT_GT(script->baseline_memory(), 0u);
+}
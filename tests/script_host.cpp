@@ -0,0 +1,97 @@
+#include "common.h"
+#include <apolo/script_host.h>
+
+TEST(script_host, environments_are_isolated)
+{
+    apolo::script_host host;
+    auto a = host.create("a", S("rate = 2; function tax(x) return x * rate end"));
+    auto b = host.create("b", S("rate = 3; function tax(x) return x * rate end; function set(r) rate = r end"));
+
+    EXPECT_EQ(20, a.call("tax", 10).as<long long>());
+    EXPECT_EQ(30, b.call("tax", 10).as<long long>());
+    b.call("set", 5);
+    EXPECT_EQ(20, a.call("tax", 10).as<long long>());
+    EXPECT_EQ(50, b.call("tax", 10).as<long long>());
+    EXPECT_THROW(a.call("set", 1), apolo::runtime_error);
+    EXPECT_EQ("b", b.name());
+}
+
+TEST(script_host, builtins)
+{
+    apolo::script_host host;
+    auto env = host.create("env", S(R"(
+        function test()
+            local buffer = string_buffer()
+            buffer:append(string.upper("a"), ("b"):upper(), tostring(math.max(1, 2)))
+            return buffer:tostring()
+        end
+        function globals() return _G == _ENV and _G.test == test end
+        function count()
+            local n = 0
+            for name in pairs(math) do n = n + 1 end
+            return n
+        end
+    )"));
+
+    EXPECT_EQ("AB2", env.call("test").as<std::string>());
+    EXPECT_TRUE(env.call("globals").as<bool>());
+    EXPECT_LT(20, env.call("count").as<long long>());
+
+    // Builtins can be called directly
+    EXPECT_EQ("1", env.call("tostring", 1).as<std::string>());
+}
+
+TEST(script_host, builtins_are_read_only)
+{
+    apolo::script_host host;
+    auto a = host.create("a", S(R"(
+        function change() string.upper = nil end
+        function replace() string = 1; return string end
+    )"));
+    auto b = host.create("b", S(R"(function test() return string.upper("x") end)"));
+
+    EXPECT_THROW(a.call("change"), apolo::runtime_error);
+    EXPECT_EQ(1, a.call("replace").as<long long>());
+    EXPECT_EQ("X", b.call("test").as<std::string>());
+    EXPECT_THROW(host.create("c", S("setmetatable(string, nil)")), apolo::runtime_error);
+}
+
+TEST(script_host, registered_functions)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("discount", [](double price) { return price / 2; });
+
+    apolo::script_host host({}, registry);
+    auto env = host.create("env", S("function test(x) return discount(x) end"));
+    EXPECT_EQ(5.0, env.call("test", 10).as<double>());
+}
+
+TEST(script_host, call_async)
+{
+    apolo::script_host host;
+    auto a = host.create("a", S("function run(x) yield(); return x + 1 end"));
+    auto b = host.create("b", S("function run(x) yield(); yield(); return x * 2 end"));
+
+    apolo::cooperative_executor executor;
+    auto first = a.call_async(executor, "run", 1);
+    auto second = b.call_async(executor, "run", 5);
+    executor.run();
+    EXPECT_EQ(2, first.get().as<long long>());
+    EXPECT_EQ(10, second.get().as<long long>());
+}
+
+TEST(script_host, errors)
+{
+    apolo::script_host host;
+    EXPECT_THROW(host.create("syntax", S("function")), apolo::syntax_error);
+    EXPECT_THROW(host.create("runtime", S("error('failed')")), apolo::runtime_error);
+    EXPECT_THROW(host.create("binary", S("\x1bLua")), apolo::syntax_error);
+
+    auto env = host.create("env", S("function fail() error('failed') end"));
+    EXPECT_THROW(env.call("undefined"), apolo::runtime_error);
+    EXPECT_THROW(env.call("fail"), apolo::runtime_error);
+
+    // Environments still work after errors
+    auto other = host.create("other", S("function test() return 1 end"));
+    EXPECT_EQ(1, other.call("test").as<long long>());
+}
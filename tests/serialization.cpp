@@ -0,0 +1,121 @@
+#include "common.h"
+#include <apolo/serialization.h>
+#include <limits>
+
+namespace
+{
+    // Runs a chunk of Lua code and leaves its (single) return value on the stack
+    apolo::detail::lua_state_ptr eval(const char* code)
+    {
+        apolo::detail::lua_state_ptr state(luaL_newstate());
+        luaL_openlibs(state.get());
+        EXPECT_EQ(LUA_OK, luaL_loadstring(state.get(), code));
+        EXPECT_EQ(LUA_OK, lua_pcall(state.get(), 0, 1, 0));
+        return state;
+    }
+
+    // Pushes a global checker function and calls it with the value on top of the stack
+    bool check(lua_State* state, const char* code)
+    {
+        EXPECT_EQ(LUA_OK, luaL_loadstring(state, code));
+        lua_insert(state, -2);
+        EXPECT_EQ(LUA_OK, lua_pcall(state, 1, 1, 0));
+        bool result = lua_toboolean(state, -1) != 0;
+        lua_pop(state, 1);
+        return result;
+    }
+}
+
+TEST(serialization, value_roundtrip)
+{
+    const std::vector<apolo::value> values{
+        {}, true, false, 0, 1, -1, 300, -300,
+        std::numeric_limits<long long>::max(), std::numeric_limits<long long>::min(),
+        0.0, -2.5, 1e300, "", "Hello World", std::string("a\0b", 3)
+    };
+
+    apolo::script_data buffer;
+    apolo::value_writer writer(buffer);
+    for (const auto& value : values)
+    {
+        writer.write(value);
+        EXPECT_EQ(value, apolo::deserialize(apolo::serialize(value)));
+    }
+
+    apolo::value_reader reader(buffer);
+    for (const auto& value : values)
+    {
+        EXPECT_EQ(value, reader.read());
+    }
+    EXPECT_TRUE(reader.empty());
+}
+
+TEST(serialization, compact_encoding)
+{
+    EXPECT_EQ(2u, apolo::serialize(1).size());
+    EXPECT_EQ(2u, apolo::serialize(-1).size());
+    EXPECT_EQ(9u, apolo::serialize(1.0).size());
+    EXPECT_EQ(7u, apolo::serialize("Hello").size());
+}
+
+TEST(serialization, object_reference_not_serializable)
+{
+    EXPECT_THROW(apolo::serialize(std::make_shared<std::string>()), apolo::serialization_error);
+}
+
+TEST(serialization, malformed_data)
+{
+    EXPECT_THROW(apolo::deserialize({}), apolo::serialization_error);
+    EXPECT_THROW(apolo::deserialize({'\x42'}), apolo::serialization_error);
+    EXPECT_THROW(apolo::deserialize({'\x05', '\x10', 'a'}), apolo::serialization_error);
+    EXPECT_THROW(apolo::deserialize({'\x03', '\x02', '\x00'}), apolo::serialization_error);
+
+    auto state = eval("return {}");
+    apolo::script_data truncated{'\x06', '\x02', '\x03'};
+    apolo::value_reader reader(truncated);
+    EXPECT_THROW(reader.read(*state), apolo::serialization_error);
+    EXPECT_EQ(1, lua_gettop(state.get()));
+}
+
+TEST(serialization, table_roundtrip)
+{
+    auto state = eval("return { 1, 2.0, 'three', { nested = true }, [10] = -1, name = 'x', [1.5] = false }");
+
+    apolo::script_data buffer;
+    apolo::value_writer(buffer).write(*state, -1);
+    EXPECT_EQ(1, lua_gettop(state.get()));
+
+    apolo::value_reader reader(buffer);
+    reader.read(*state);
+    EXPECT_TRUE(reader.empty());
+    EXPECT_TRUE(check(state.get(), R"(local t = ...
+        return #t == 4 and math.type(t[1]) == 'integer' and math.type(t[2]) == 'float'
+           and t[3] == 'three' and t[4].nested == true and t[10] == -1 and t.name == 'x' and t[1.5] == false)"));
+}
+
+TEST(serialization, table_into_value)
+{
+    auto state = eval("return {}");
+    apolo::script_data buffer;
+    apolo::value_writer(buffer).write(*state, -1);
+    EXPECT_THROW(apolo::deserialize(buffer), apolo::serialization_error);
+}
+
+TEST(serialization, shared_and_cyclic_tables)
+{
+    auto state = eval("local shared = {} local t = { a = shared, b = shared } t.self = t return t");
+
+    apolo::script_data buffer;
+    apolo::value_writer(buffer).write(*state, -1);
+
+    apolo::value_reader(buffer).read(*state);
+    EXPECT_TRUE(check(state.get(), "local t = ... return t.a == t.b and t.self == t"));
+}
+
+TEST(serialization, unsupported_lua_types)
+{
+    auto state = eval("return { f = function() end }");
+    apolo::script_data buffer;
+    EXPECT_THROW(apolo::value_writer(buffer).write(*state, -1), apolo::serialization_error);
+    EXPECT_EQ(1, lua_gettop(state.get()));
+}
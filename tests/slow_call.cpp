@@ -0,0 +1,85 @@
+#include "common.h"
+
+using ::testing::HasSubstr;
+
+namespace
+{
+    const char* const SCRIPT = R"(
+        function fast() return 1 end
+        function busy(n, s) local x = 0 for i = 1, n do x = x + i end return x end
+        function yielding(n)
+            yield()
+            busy(n)
+            yield()
+        end
+        function failing() error("failed") end
+    )";
+
+    apolo::configuration slow_call_configuration(std::vector<apolo::slow_call>& records, std::chrono::nanoseconds threshold)
+    {
+        apolo::configuration config;
+        config.slow_call_threshold(threshold);
+        config.slow_call_function([&records](const apolo::slow_call& record) {
+            records.push_back(record);
+        });
+        return config;
+    }
+}
+
+TEST(slow_call, disabled_by_default)
+{
+    apolo::configuration config;
+    EXPECT_EQ(0, config.slow_call_threshold().count());
+    EXPECT_FALSE(config.slow_call_function());
+}
+
+TEST(slow_call, ignores_fast_calls)
+{
+    std::vector<apolo::slow_call> records;
+    apolo::script script("dummy", S(SCRIPT), slow_call_configuration(records, std::chrono::seconds(10)), nullptr);
+    script.call("fast");
+    script.call("busy", 1000, "abc");
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(slow_call, reports_slow_calls)
+{
+    std::vector<apolo::slow_call> records;
+    apolo::script script("dummy", S(SCRIPT), slow_call_configuration(records, std::chrono::nanoseconds(1)), nullptr);
+    script.call("busy", 1000, std::string(100, 'x'));
+
+    ASSERT_EQ(1u, records.size());
+    EXPECT_EQ("busy", records[0].function);
+    EXPECT_EQ("(1000, \"" + std::string(32, 'x') + "...\")", records[0].arguments);
+    EXPECT_EQ(1, records[0].resumes);
+    EXPECT_FALSE(records[0].failed);
+    EXPECT_GT(records[0].duration.count(), 0);
+    EXPECT_LE(records[0].run_time, records[0].duration);
+    EXPECT_THAT(records[0].traceback, HasSubstr("dummy\"]:3: in function 'busy'"));
+}
+
+TEST(slow_call, reports_traceback_of_slowest_resume)
+{
+    std::vector<apolo::slow_call> records;
+    apolo::script script("dummy", S(SCRIPT), slow_call_configuration(records, std::chrono::nanoseconds(1)), nullptr);
+    script.call("yielding", 1000000);
+
+    ASSERT_EQ(1u, records.size());
+    EXPECT_EQ("yielding", records[0].function);
+    EXPECT_EQ("(1000000)", records[0].arguments);
+    EXPECT_EQ(3, records[0].resumes);
+
+    // The second resume runs busy() and yields at line 7
+    EXPECT_THAT(records[0].traceback, HasSubstr(":7: in function <[string \"dummy\"]:4>"));
+}
+
+TEST(slow_call, reports_failed_calls)
+{
+    std::vector<apolo::slow_call> records;
+    apolo::script script("dummy", S(SCRIPT), slow_call_configuration(records, std::chrono::nanoseconds(1)), nullptr);
+    EXPECT_THROW(script.call("failing"), apolo::runtime_error);
+
+    ASSERT_EQ(1u, records.size());
+    EXPECT_TRUE(records[0].failed);
+    EXPECT_THAT(records[0].traceback, HasSubstr(":9: in function <[string \"dummy\"]:9>"));
+}
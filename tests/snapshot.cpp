@@ -0,0 +1,99 @@
+#include "common.h"
+#include <apolo/serialization.h>
+
+using ::testing::Return;
+
+namespace
+{
+    class MockObject
+    {
+    public:
+        MOCK_METHOD0(initialize, void());
+    };
+}
+
+TEST(snapshot, restores_globals)
+{
+    apolo::script original("dummy", S(R"(
+        local shared = { 1, 2.5, "three" }
+        index = { a = shared, b = shared, nested = { flag = true } }
+        counter = 42
+        function check()
+            return index.a == index.b and index.a[3] == "three" and math.type(index.a[2]) == "float"
+               and index.nested.flag and counter == 43
+        end
+        function increment() counter = counter + 1 return counter end
+    )"));
+    original.call("increment");
+
+    apolo::script restored("dummy", original.snapshot(), nullptr);
+    EXPECT_EQ(apolo::value(true), restored.call("check"));
+    EXPECT_EQ(apolo::value(44), restored.call("increment"));
+}
+
+TEST(snapshot, does_not_run_top_level_chunk)
+{
+    MockObject obj;
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("initialize", obj, &MockObject::initialize);
+
+    EXPECT_CALL(obj, initialize()).Times(1);
+    apolo::script original("dummy", S("initialize() function foo() return 1 end"), registry);
+
+    apolo::script restored("dummy", original.snapshot(), registry);
+    EXPECT_EQ(apolo::value(1), restored.call("foo"));
+}
+
+TEST(snapshot, survives_serialized_data)
+{
+    apolo::script original("dummy", S("data = { 1, 2, 3 } function sum() return data[1] + data[2] + data[3] end"));
+
+    // Simulate storing and loading the snapshot data
+    const apolo::script_data stored = original.snapshot().data();
+    apolo::script restored("dummy", apolo::script_snapshot(stored), nullptr);
+    EXPECT_EQ(apolo::value(6), restored.call("sum"));
+}
+
+TEST(snapshot, keeps_loaded_libraries)
+{
+    testing::MockFunction<apolo::script_data(const std::string&)> loader;
+    apolo::configuration configuration;
+    configuration.load_function(loader.AsStdFunction());
+
+    EXPECT_CALL(loader, Call("lib")).WillOnce(Return(S("loaded = true")));
+    apolo::script original("dummy", S("require('lib') function foo() require('lib') return loaded end"), configuration);
+
+    apolo::script restored("dummy", original.snapshot(), configuration, nullptr);
+    EXPECT_EQ(apolo::value(true), restored.call("foo"));
+}
+
+TEST(snapshot, objects_become_nil)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_object_type<MockObject>();
+
+    apolo::script original("dummy", S("function keep(x) obj = x end function get() return type(obj) end"), registry);
+    original.call("keep", std::make_shared<MockObject>());
+    EXPECT_EQ(apolo::value("userdata"), original.call("get"));
+
+    apolo::script restored("dummy", original.snapshot(), registry);
+    EXPECT_EQ(apolo::value("nil"), restored.call("get"));
+}
+
+TEST(snapshot, function_with_local_upvalues)
+{
+    apolo::script script("dummy", S("local x = 1 function foo() return x end"));
+    EXPECT_THROW(script.snapshot(), apolo::serialization_error);
+}
+
+TEST(snapshot, native_function_alias)
+{
+    apolo::script script("dummy", S("t = { f = tostring }"));
+    EXPECT_THROW(script.snapshot(), apolo::serialization_error);
+}
+
+TEST(snapshot, invalid_snapshot)
+{
+    EXPECT_THROW(apolo::script("dummy", apolo::script_snapshot(S("")), nullptr), apolo::serialization_error);
+    EXPECT_THROW(apolo::script("dummy", apolo::script_snapshot(S("garbage")), nullptr), apolo::serialization_error);
+}
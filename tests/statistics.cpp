@@ -0,0 +1,107 @@
+#include "common.h"
+
+namespace
+{
+    class Counter
+    {
+    public:
+        void increment() { ++m_count; }
+
+    private:
+        int m_count = 0;
+    };
+
+    const apolo::binding_statistics* find(const std::vector<apolo::binding_statistics>& statistics, const std::string& name)
+    {
+        for (const auto& entry : statistics)
+        {
+            if (entry.name == name)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+}
+
+TEST(statistics, disabled_by_default)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("foo", []{});
+    EXPECT_FALSE(registry->collect_statistics());
+
+    apolo::script script("dummy", S("function test() foo() end"), registry);
+    script.call("test");
+
+    const auto statistics = registry->statistics();
+    ASSERT_EQ(1u, statistics.size());
+    EXPECT_EQ("foo", statistics[0].name);
+    EXPECT_EQ(0u, statistics[0].calls);
+}
+
+TEST(statistics, counts_calls_and_errors)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->collect_statistics(true);
+    registry->add_free_function("foo", []{});
+    registry->add_free_function("fail", []{ throw std::runtime_error("failed"); });
+
+    apolo::script script("dummy", S("function test() for i = 1, 10 do foo() end end function test_fail() fail() end"), registry);
+    script.call("test");
+    EXPECT_THROW(script.call("test_fail"), apolo::runtime_error);
+
+    const auto statistics = registry->statistics();
+    const auto* foo = find(statistics, "foo");
+    ASSERT_NE(nullptr, foo);
+    EXPECT_EQ("", foo->type);
+    EXPECT_EQ(10u, foo->calls);
+    EXPECT_EQ(0u, foo->errors);
+
+    std::uint64_t histogram_calls = 0;
+    for (auto count : foo->latency_histogram)
+    {
+        histogram_calls += count;
+    }
+    EXPECT_EQ(10u, histogram_calls);
+    EXPECT_GT(foo->latency_percentile(0.99).count(), 0);
+    EXPECT_LE(foo->latency_percentile(0.5), foo->latency_percentile(0.99));
+
+    const auto* fail = find(statistics, "fail");
+    ASSERT_NE(nullptr, fail);
+    EXPECT_EQ(1u, fail->calls);
+    EXPECT_EQ(1u, fail->errors);
+}
+
+TEST(statistics, aggregates_over_scripts)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->collect_statistics(true);
+    registry->add_free_function("foo", []{});
+
+    apolo::script first("first", S("function test() foo() end"), registry);
+    apolo::script second("second", S("function test() foo() foo() end"), registry);
+    first.call("test");
+    second.call("test");
+
+    EXPECT_EQ(3u, find(registry->statistics(), "foo")->calls);
+
+    registry->reset_statistics();
+    EXPECT_EQ(0u, find(registry->statistics(), "foo")->calls);
+}
+
+TEST(statistics, counts_method_calls)
+{
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->collect_statistics(true);
+    registry->add_object_type<Counter>()
+        .WithMethod("increment", &Counter::increment);
+
+    apolo::script script("dummy", S("function test(counter) counter:increment() counter:increment() end"), registry);
+    script.call("test", std::make_shared<Counter>());
+
+    const auto statistics = registry->statistics();
+    const auto* increment = find(statistics, "increment");
+    ASSERT_NE(nullptr, increment);
+    EXPECT_EQ(typeid(Counter).name(), increment->type);
+    EXPECT_EQ(2u, increment->calls);
+}
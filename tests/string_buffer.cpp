@@ -0,0 +1,117 @@
+#include "common.h"
+
+TEST(string_buffer, appends_values)
+{
+    apolo::script script("dummy", S(R"(
+        function build()
+            local buffer = string_buffer()
+            buffer:append("a", 1, 2.5, true):append("b")
+            return buffer:tostring()
+        end
+        function length()
+            local buffer = string_buffer(16)
+            buffer:append("abc")
+            return #buffer
+        end
+        function convert()
+            local buffer = string_buffer()
+            buffer:append("xyz")
+            return tostring(buffer)
+        end
+    )"));
+
+    EXPECT_EQ("a12.5trueb", script.call("build").as<std::string>());
+    EXPECT_EQ(3, script.call("length").as<long long>());
+    EXPECT_EQ("xyz", script.call("convert").as<std::string>());
+}
+
+TEST(string_buffer, appends_formatted_values)
+{
+    apolo::script script("dummy", S(R"(
+        function build()
+            local buffer = string_buffer()
+            for i = 1, 3 do
+                buffer:appendf("%d:%s;", i, "x")
+            end
+            return buffer:tostring()
+        end
+        function bad_format() string_buffer():appendf("%d", "x") end
+    )"));
+
+    EXPECT_EQ("1:x;2:x;3:x;", script.call("build").as<std::string>());
+    EXPECT_THROW(script.call("bad_format"), apolo::runtime_error);
+}
+
+TEST(string_buffer, appends_buffers)
+{
+    apolo::script script("dummy", S(R"(
+        function build()
+            local buffer = string_buffer()
+            local other = string_buffer()
+            other:append("ab")
+            buffer:append(other, "-")
+            buffer:append(buffer)
+            return buffer:tostring()
+        end
+    )"));
+
+    EXPECT_EQ("ab-ab-", script.call("build").as<std::string>());
+}
+
+TEST(string_buffer, keeps_embedded_zeros)
+{
+    apolo::script script("dummy", S(R"(
+        function build()
+            local buffer = string_buffer()
+            buffer:append("a\0b")
+            return #buffer
+        end
+    )"));
+
+    EXPECT_EQ(3, script.call("build").as<long long>());
+}
+
+TEST(string_buffer, passes_contents_to_native_functions_without_copy)
+{
+    std::string received;
+    const void* data = nullptr;
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("report", [&](std::string_view text) {
+        received = std::string(text);
+        data = text.data();
+    });
+    registry->add_free_function("address", [&](std::string_view text) {
+        return text.data() == data;
+    });
+
+    apolo::script script("dummy", S(R"(
+        buffer = string_buffer()
+        for i = 1, 100 do buffer:append(i, ",") end
+        report(buffer)
+        function check() return address(buffer) end
+        function plain() report("plain string") end
+    )"), registry);
+
+    EXPECT_EQ(292u, received.size());
+    EXPECT_EQ("1,2,3,", received.substr(0, 6));
+    EXPECT_TRUE(script.call("check").as<bool>());
+
+    script.call("plain");
+    EXPECT_EQ("plain string", received);
+}
+
+TEST(string_buffer, rejects_wrong_arguments)
+{
+    auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("report", [](std::string_view) {});
+
+    apolo::script script("dummy", S(R"(
+        function negative() string_buffer(-1) end
+        function not_a_buffer() string_buffer().append({}) end
+        function number() report(1) end
+    )"), registry);
+
+    EXPECT_THROW(script.call("negative"), apolo::runtime_error);
+    EXPECT_THROW(script.call("not_a_buffer"), apolo::runtime_error);
+    EXPECT_THROW(script.call("number"), apolo::runtime_error);
+}
@@ -0,0 +1,64 @@
+#include "common.h"
+
+TEST(table_conversion, passes_vectors_as_tables)
+{
+    apolo::script script("dummy", S(R"(
+        function sum(t) local s = 0 for _, v in ipairs(t) do s = s + v end return s end
+        function size(t) return #t end
+        function first_type(t) return math.type(t[1]) end
+    )"));
+
+    EXPECT_EQ(6, script.call("sum", std::vector<int>{1, 2, 3}).as<long long>());
+    EXPECT_EQ(4.5, script.call("sum", std::vector<double>{1.5, 3.0}).as<double>());
+    EXPECT_EQ(0, script.call("size", std::vector<float>{}).as<long long>());
+    EXPECT_EQ("integer", script.call("first_type", std::vector<std::uint16_t>{7}).as<std::string>());
+    EXPECT_EQ("float", script.call("first_type", std::vector<float>{7}).as<std::string>());
+}
+
+TEST(table_conversion, converts_vectors_in_registered_functions)
+{
+    std::vector<double> received;
+
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("receive", [&](const std::vector<double>& values) { received = values; });
+    registry->add_free_function("range", [](int n) {
+        std::vector<long long> values(n);
+        for (int i = 0; i < n; ++i)
+        {
+            values[i] = i + 1;
+        }
+        return values;
+    });
+    registry->add_free_function("bytes", [](const std::vector<std::uint8_t>& values) { return values.size(); });
+
+    apolo::script script("dummy", S(R"(
+        function test() local t = range(200) table.sort(t, function(a, b) return a > b end) receive(t) end
+        function test_bytes(t) return bytes(t) end
+    )"), registry);
+
+    script.call("test");
+    ASSERT_EQ(200u, received.size());
+    EXPECT_EQ(200.0, received.front());
+    EXPECT_EQ(1.0, received.back());
+
+    EXPECT_EQ(3, script.call("test_bytes", std::vector<int>{1, 2, 255}).as<long long>());
+    EXPECT_THROW(script.call("test_bytes", std::vector<int>{1, 256}), apolo::runtime_error);
+    EXPECT_THROW(script.call("test_bytes", std::vector<double>{1.5}), apolo::runtime_error);
+}
+
+TEST(table_conversion, rejects_non_numeric_elements)
+{
+    std::vector<double> received;
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("receive", [&](const std::vector<double>& values) { received = values; });
+
+    apolo::script script("dummy", S(R"(
+        function test_string() receive({1, 2, "3"}) end
+        function test_scalar() receive(1) end
+        function test_large() local t = {} for i = 1, 1000 do t[i] = i end t[700] = {} receive(t) end
+    )"), registry);
+
+    EXPECT_THROW(script.call("test_string"), apolo::runtime_error);
+    EXPECT_THROW(script.call("test_scalar"), apolo::runtime_error);
+    EXPECT_THROW(script.call("test_large"), apolo::runtime_error);
+}
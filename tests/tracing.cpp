@@ -0,0 +1,113 @@
+#include "common.h"
+
+using ::testing::HasSubstr;
+
+namespace
+{
+    // Records the spans as "begin name" and "end name" lines
+    class recording_tracer : public apolo::tracer
+    {
+    public:
+        void begin(std::string_view name, const apolo::trace_arguments& arguments, clock::time_point) override
+        {
+            std::string line = "begin " + std::string(name);
+            for (const auto& [key, value] : arguments)
+            {
+                line += " " + key + "=";
+                if (const auto* number = std::get_if<long long>(&value))
+                {
+                    line += std::to_string(*number);
+                }
+                else
+                {
+                    line += std::get<std::string>(value);
+                }
+            }
+            spans.push_back(line);
+        }
+
+        void end(std::string_view name, clock::time_point) override
+        {
+            spans.push_back("end " + std::string(name));
+        }
+
+        std::vector<std::string> spans;
+    };
+}
+
+TEST(tracing, traces_construction)
+{
+    const auto tracer = std::make_shared<recording_tracer>();
+    apolo::configuration config;
+    config.tracer(tracer);
+
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("foo", []{});
+
+    apolo::script script("dummy", S("x = 1"), config, registry);
+
+    EXPECT_EQ((std::vector<std::string>{
+        "begin script name=dummy size=5",
+        "begin load_builtins",
+        "end load_builtins",
+        "begin register_functions count=1",
+        "end register_functions",
+        "begin compile name=dummy size=5",
+        "end compile",
+        "begin execute name=dummy",
+        "end execute",
+        "end script"}), tracer->spans);
+}
+
+TEST(tracing, traces_libraries)
+{
+    const auto tracer = std::make_shared<recording_tracer>();
+    apolo::configuration config;
+    config.tracer(tracer);
+    config.load_function([](const std::string&) { return S("y = 2"); });
+
+    apolo::script script("dummy", S("require('lib')"), config);
+
+    EXPECT_EQ((std::vector<std::string>{
+        "begin script name=dummy size=14",
+        "begin load_builtins",
+        "end load_builtins",
+        "begin compile name=dummy size=14",
+        "end compile",
+        "begin execute name=dummy",
+        "begin require library=lib",
+        "begin load_function library=lib",
+        "end load_function",
+        "begin compile name=lib size=5",
+        "end compile",
+        "begin execute name=lib",
+        "end execute",
+        "end require",
+        "end execute",
+        "end script"}), tracer->spans);
+}
+
+TEST(tracing, ends_spans_on_errors)
+{
+    const auto tracer = std::make_shared<recording_tracer>();
+    apolo::configuration config;
+    config.tracer(tracer);
+
+    EXPECT_THROW(apolo::script("dummy", S("x = "), config), apolo::syntax_error);
+    EXPECT_EQ("end script", tracer->spans.back());
+}
+
+TEST(tracing, writes_chrome_trace_events)
+{
+    const auto writer = std::make_shared<apolo::chrome_trace_writer>();
+    apolo::configuration config;
+    config.tracer(writer);
+
+    apolo::script script("du\"mmy", S("x = 1"), config);
+
+    const auto json = writer->json();
+    EXPECT_THAT(json, HasSubstr("{\"traceEvents\":["));
+    EXPECT_THAT(json, HasSubstr("{\"name\":\"script\",\"cat\":\"apolo\",\"ph\":\"B\",\"ts\":"));
+    EXPECT_THAT(json, HasSubstr("\"args\":{\"name\":\"du\\\"mmy\",\"size\":5}}"));
+    EXPECT_THAT(json, HasSubstr("{\"name\":\"script\",\"cat\":\"apolo\",\"ph\":\"E\",\"ts\":"));
+}
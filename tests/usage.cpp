@@ -0,0 +1,135 @@
+#include "common.h"
+
+namespace
+{
+    const char* const SCRIPT = R"(
+        function busy(n) local s = 0 for i = 1, n do s = s + i end return s end
+        function yielding(n) for i = 1, 3 do busy(n) yield() end end
+        function worker(id) for i = 1, 3 do record(id) yield() end end
+    )";
+
+    apolo::configuration quota_configuration(std::uint64_t instructions, apolo::quota_action action)
+    {
+        apolo::usage_quota quota;
+        quota.instructions = instructions;
+        quota.action = action;
+
+        apolo::configuration config;
+        config.usage_quota(quota);
+        return config;
+    }
+}
+
+TEST(usage, disabled_by_default)
+{
+    apolo::configuration config;
+    EXPECT_FALSE(config.usage_accounting());
+
+    apolo::script script("dummy", S(SCRIPT));
+    script.call("busy", 100000);
+    EXPECT_EQ(0u, script.usage().instructions);
+    EXPECT_EQ(0, script.usage().cpu_time.count());
+    EXPECT_FALSE(script.quota_exceeded());
+}
+
+TEST(usage, accounts_calls_and_top_level_chunk)
+{
+    apolo::configuration config;
+    config.usage_accounting(true);
+    config.load_function([](const std::string&) { return S("local s = 0 for i = 1, 100000 do s = s + i end"); });
+
+    apolo::script script("dummy", S((std::string(SCRIPT) + "require('lib')").c_str()), config);
+    const auto initial = script.usage();
+    EXPECT_GE(initial.instructions, 100000u);
+    EXPECT_GT(initial.wall_time.count(), 0);
+
+    script.call("busy", 100000);
+    script.call("yielding", 100000);
+    const auto usage = script.usage();
+    EXPECT_GE(usage.instructions, initial.instructions + 400000);
+    EXPECT_EQ(0u, usage.instructions % apolo::script_usage::INSTRUCTION_GRANULARITY);
+    EXPECT_GT(usage.cpu_time, initial.cpu_time);
+    EXPECT_GT(usage.wall_time, initial.wall_time);
+
+    script.reset_usage();
+    EXPECT_EQ(0u, script.usage().instructions);
+}
+
+TEST(usage, accounts_while_profiling)
+{
+    apolo::configuration config;
+    config.usage_accounting(true);
+    config.profiler_sample_interval(100);
+
+    apolo::script script("dummy", S(SCRIPT), config);
+    script.call("busy", 100000);
+    EXPECT_GE(script.usage().instructions, 200000u);
+    EXPECT_FALSE(script.profiler().functions().empty());
+
+    script.profiler().stop();
+    script.reset_usage();
+    script.call("busy", 100000);
+    EXPECT_GE(script.usage().instructions, 200000u);
+}
+
+TEST(usage, rejects_calls_over_quota)
+{
+    apolo::script script("dummy", S(SCRIPT), quota_configuration(100000, apolo::quota_action::reject), nullptr);
+    script.call("busy", 10);
+    EXPECT_FALSE(script.quota_exceeded());
+
+    // The running call is aborted
+    EXPECT_THROW(script.call("busy", 1000000), apolo::quota_exceeded_error);
+    EXPECT_TRUE(script.quota_exceeded());
+    EXPECT_LT(script.usage().instructions, 200000u);
+
+    // Further calls are rejected
+    EXPECT_THROW(script.call("busy", 10), apolo::quota_exceeded_error);
+
+    script.reset_usage();
+    EXPECT_EQ(55, script.call("busy", 10).as<long long>());
+}
+
+TEST(usage, deprioritizes_threads_over_quota)
+{
+    std::vector<std::string> order;
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("record", [&](const std::string& id) { order.push_back(id); });
+
+    const auto config = quota_configuration(1000, apolo::quota_action::deprioritize);
+    apolo::script greedy("greedy", S(SCRIPT), config, registry);
+    apolo::script other("other", S(SCRIPT), registry);
+
+    // Deprioritized scripts can still be called
+    greedy.call("busy", 100000);
+    EXPECT_TRUE(greedy.quota_exceeded());
+
+    apolo::cooperative_executor executor;
+    auto first = greedy.call_async(executor, "worker", "greedy");
+    auto second = other.call_async(executor, "worker", "other");
+    executor.run();
+    first.get();
+    second.get();
+
+    EXPECT_EQ((std::vector<std::string>{"other", "other", "other", "greedy", "greedy", "greedy"}), order);
+}
+
+TEST(usage, deprioritized_threads_take_turns)
+{
+    std::vector<std::string> order;
+    const auto registry = std::make_shared<apolo::type_registry>();
+    registry->add_free_function("record", [&](const std::string& id) { order.push_back(id); });
+
+    const auto config = quota_configuration(1000, apolo::quota_action::deprioritize);
+    apolo::script greedy("greedy", S(SCRIPT), config, registry);
+    greedy.call("busy", 100000);
+
+    apolo::cooperative_executor executor;
+    auto first = greedy.call_async(executor, "worker", "a");
+    auto second = greedy.call_async(executor, "worker", "b");
+    executor.run();
+    first.get();
+    second.get();
+
+    EXPECT_EQ((std::vector<std::string>{"a", "b", "a", "b", "a", "b"}), order);
+}
@@ -1,5 +1,6 @@
 #include "common.h"
 #include <optional>
+#include <unordered_set>
 
 namespace
 {
@@ -71,3 +72,14 @@ TEST(value, strings)
     EXPECT_EQ(Type::String, get_type(apolo::value(std::string("Hello World"))));
 }
 
+TEST(value, hash)
+{
+    EXPECT_EQ(apolo::value(1).hash(), apolo::value(1ll).hash());
+    EXPECT_EQ(apolo::value("abc").hash(), apolo::value(std::string("abc")).hash());
+    EXPECT_NE(apolo::value(1).hash(), apolo::value(2).hash());
+
+    // Values that are not equal, such as integers and floats, don't collide in a set
+    const std::unordered_set<apolo::value> values{1, 1.0, true, "1", nullptr, 1};
+    EXPECT_EQ(5u, values.size());
+    EXPECT_EQ(1u, values.count(apolo::value(1.0)));
+}
@@ -0,0 +1,130 @@
+#include "common.h"
+#include <cmath>
+
+namespace
+{
+    apolo::configuration vector_math_configuration()
+    {
+        apolo::configuration config;
+        config.vector_math(true);
+        return config;
+    }
+
+    // Runs a script with the vmath module and returns the result of calling 'test'
+    apolo::value run(const char* code)
+    {
+        apolo::script script("dummy", S(code), vector_math_configuration());
+        return script.call("test");
+    }
+}
+
+TEST(vector_math, disabled_by_default)
+{
+    EXPECT_THROW(apolo::script("dummy", S("vmath.vec3(1, 2, 3)")), apolo::runtime_error);
+}
+
+TEST(vector_math, vector_arithmetic)
+{
+    EXPECT_TRUE(run(R"(function test()
+        local a, b = vmath.vec3(1, 2, 3), vmath.vec3(4, 5, 6)
+        return a + b == vmath.vec3(5, 7, 9) and b - a == vmath.vec3(3, 3, 3) and -a == vmath.vec3(-1, -2, -3)
+           and a * 2 == vmath.vec3(2, 4, 6) and 2 * a == a * 2 and a * b == vmath.vec3(4, 10, 18)
+           and b / 2 == vmath.vec3(2, 2.5, 3) and a ~= b
+    end)").as<bool>());
+
+    EXPECT_TRUE(run(R"(function test()
+        local v = vmath.vec4(1, 2, 3, 4)
+        return v.x == 1 and v.y == 2 and v.z == 3 and v.w == 4 and vmath.vec2(1, 2).z == nil
+    end)").as<bool>());
+}
+
+TEST(vector_math, vector_functions)
+{
+    EXPECT_EQ(32.0, run("function test() return vmath.dot(vmath.vec3(1, 2, 3), vmath.vec3(4, 5, 6)) end").as<double>());
+    EXPECT_EQ(5.0, run("function test() return vmath.vec2(3, 4):length() end").as<double>());
+    EXPECT_TRUE(run(R"(function test()
+        local x, y = vmath.vec3(1, 0, 0), vmath.vec3(0, 1, 0)
+        return vmath.cross(x, y) == vmath.vec3(0, 0, 1) and vmath.vec3(0, 3, 4):normalize() == vmath.vec3(0, 0.6, 0.8)
+           and vmath.lerp(x, y, 0.5) == vmath.vec3(0.5, 0.5, 0)
+    end)").as<bool>());
+    EXPECT_EQ("vec2(1.0, 2.5)", run("function test() return tostring(vmath.vec2(1, 2.5)) end").as<std::string>());
+}
+
+TEST(vector_math, quaternions)
+{
+    // A quarter turn around z maps x to y
+    EXPECT_TRUE(run(R"(function test()
+        local q = vmath.axis_angle(vmath.vec3(0, 0, 1), math.pi / 2)
+        local v = q * vmath.vec3(1, 0, 0)
+        local half = vmath.axis_angle(vmath.vec3(0, 0, 1), math.pi / 4)
+        local combined = (half * half) * vmath.vec3(1, 0, 0)
+        local back = vmath.conjugate(q) * v
+        return math.abs(v.x) < 1e-6 and math.abs(v.y - 1) < 1e-6 and math.abs(combined.y - 1) < 1e-6
+           and math.abs(back.x - 1) < 1e-6 and vmath.quat() * q == q
+    end)").as<bool>());
+}
+
+TEST(vector_math, matrices)
+{
+    EXPECT_TRUE(run(R"(function test()
+        local m = vmath.translation(vmath.vec3(1, 2, 3)) * vmath.scaling(vmath.vec3(2, 2, 2))
+        return m * vmath.vec3(1, 1, 1) == vmath.vec3(3, 4, 5) and m * vmath.vec4(1, 1, 1, 0) == vmath.vec4(2, 2, 2, 0)
+           and m:get(1, 4) == 1 and vmath.transpose(m):get(4, 1) == 1 and vmath.mat4() * m == m
+    end)").as<bool>());
+
+    EXPECT_TRUE(run(R"(function test()
+        local q = vmath.axis_angle(vmath.vec3(0, 1, 0), 1.0)
+        local a, b = vmath.rotation(q) * vmath.vec3(1, 2, 3), q * vmath.vec3(1, 2, 3)
+        return (a - b):length() < 1e-6
+    end)").as<bool>());
+
+    EXPECT_TRUE(run(R"(function test()
+        local m = vmath.mat4(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16)
+        return m:get(2, 1) == 2 and m:get(1, 2) == 5
+    end)").as<bool>());
+}
+
+TEST(vector_math, rejects_wrong_operands)
+{
+    EXPECT_THROW(run("function test() return vmath.vec2(1, 2) + vmath.vec3(1, 2, 3) end"), apolo::runtime_error);
+    EXPECT_THROW(run("function test() return vmath.vec3(1, 2, 3) * vmath.quat() end"), apolo::runtime_error);
+    EXPECT_THROW(run("function test() return vmath.cross(vmath.vec2(1, 2), vmath.vec2(1, 2)) end"), apolo::runtime_error);
+    EXPECT_THROW(run("function test() return vmath.vec3(0, 0, 0):normalize() end"), apolo::runtime_error);
+    EXPECT_THROW(run("function test() return vmath.mat4():get(5, 1) end"), apolo::runtime_error);
+    EXPECT_THROW(run("function test() return vmath.vec3(1, 2, 3) + {} end"), apolo::runtime_error);
+}
+
+TEST(vector_math, batch_operations)
+{
+    apolo::script script("dummy", S(R"(
+        function transform(points, out) vmath.transform_points(vmath.translation(vmath.vec3(1, 0, 0)), points, out) end
+        function rotate(vectors) vmath.rotate_vectors(vmath.axis_angle(vmath.vec3(0, 0, 1), math.pi), vectors, vectors) end
+        function integrate(positions, velocities, dt) vmath.add_scaled(positions, velocities, dt) end
+        function normalize(vectors) vmath.normalize_all(vectors) end
+    )"), vector_math_configuration());
+
+    const std::vector<float> points{0, 0, 0, 1, 2, 3};
+    std::vector<float> transformed(6);
+    script.call("transform", apolo::array_view<const float>(points), apolo::array_view<float>(transformed));
+    EXPECT_EQ((std::vector<float>{1, 0, 0, 2, 2, 3}), transformed);
+
+    std::vector<float> vectors{1, 0, 0, 0, 2, 5};
+    script.call("rotate", apolo::array_view<float>(vectors));
+    EXPECT_NEAR(-1.0f, vectors[0], 1e-6f);
+    EXPECT_NEAR(-2.0f, vectors[4], 1e-6f);
+    EXPECT_EQ(5.0f, vectors[5]);
+
+    // Covers the vectorised and remaining elements
+    std::vector<float> positions(19, 1.0f);
+    std::vector<float> velocities(19, 2.0f);
+    script.call("integrate", apolo::array_view<float>(positions), apolo::array_view<const float>(velocities), 0.5);
+    EXPECT_EQ(std::vector<float>(19, 2.0f), positions);
+
+    std::vector<float> directions{3, 0, 4, 0, 0, 0};
+    script.call("normalize", apolo::array_view<float>(directions));
+    EXPECT_EQ((std::vector<float>{0.6f, 0, 0.8f, 0, 0, 0}), directions);
+
+    EXPECT_THROW(script.call("integrate", apolo::array_view<float>(positions), apolo::array_view<float>(transformed), 1), apolo::runtime_error);
+    EXPECT_THROW(script.call("transform", apolo::array_view<const float>(points), apolo::array_view<const float>(transformed)), apolo::runtime_error);
+    EXPECT_THROW(script.call("normalize", apolo::array_view<float>(positions)), apolo::runtime_error);
+}
@@ -0,0 +1,80 @@
+#include "common.h"
+
+namespace
+{
+    std::shared_ptr<apolo::type_registry> make_registry()
+    {
+        auto registry = std::make_shared<apolo::type_registry>();
+        registry->add_vectorized_function("scale", [](double x, double factor) { return x * factor; });
+        registry->add_vectorized_function("clamp", [](float x, float low, float high) { return x < low ? low : (x > high ? high : x); });
+        registry->add_vectorized_function("halve", [](int x) { return x / 2; });
+        return registry;
+    }
+}
+
+TEST(vectorized_function, numbers)
+{
+    apolo::script script("dummy", S("function test() return scale(1.5, 2) + halve(7) end"), make_registry());
+    EXPECT_EQ(6.0, script.call("test").as<double>());
+}
+
+TEST(vectorized_function, tables)
+{
+    apolo::script script("dummy", S(R"(
+        function test()
+            local scaled = scale({1, 2, 3}, 2)
+            local clamped = clamp({-1, 0.5, 2}, 0, 1)
+            local combined = scale({1, 2, 3}, {4, 5, 6})
+            return #scaled == 3 and scaled[1] == 2 and scaled[3] == 6
+               and clamped[1] == 0 and clamped[2] == 0.5 and clamped[3] == 1
+               and combined[1] == 4 and combined[2] == 10 and combined[3] == 18
+               and #scale({}, 2) == 0
+        end
+    )"), make_registry());
+    EXPECT_TRUE(script.call("test").as<bool>());
+}
+
+TEST(vectorized_function, array_views)
+{
+    apolo::script script("dummy", S(R"(
+        function to_table(values) local result = scale(values, 10) return #result == 3 and result[3] == 30 end
+        function in_place(values, factor) scale(values, factor, values) end
+        function into(values, out) halve(values, out) end
+    )"), make_registry());
+
+    std::vector<double> values{1, 2, 3};
+    EXPECT_TRUE(script.call("to_table", apolo::array_view<const double>(values)).as<bool>());
+
+    script.call("in_place", apolo::array_view<double>(values), 0.5);
+    EXPECT_EQ((std::vector<double>{0.5, 1, 1.5}), values);
+
+    std::vector<int> integers{2, 5, 9};
+    std::vector<int> out(3);
+    script.call("into", apolo::array_view<const int>(integers), apolo::array_view<int>(out));
+    EXPECT_EQ((std::vector<int>{1, 2, 4}), out);
+}
+
+TEST(vectorized_function, wrong_arguments)
+{
+    apolo::script script("dummy", S(R"(
+        function sizes() return scale({1, 2}, {1, 2, 3}) end
+        function empty() return scale({}, {1, 2, 3, 4, 5, 6, 7, 8}) end
+        function empty_last() return scale({1, 2, 3, 4, 5, 6, 7, 8}, {}) end
+        function output(values) scale({1, 2}, 2, values) end
+        function type() return scale("x", 2) end
+        function count() return scale(1) end
+        function element() return scale({1, "x"}, 2) end
+    )"), make_registry());
+
+    std::vector<double> values(3);
+    std::vector<float> floats(2);
+    EXPECT_THROW(script.call("sizes"), apolo::runtime_error);
+    EXPECT_THROW(script.call("empty"), apolo::runtime_error);
+    EXPECT_THROW(script.call("empty_last"), apolo::runtime_error);
+    EXPECT_THROW(script.call("output", apolo::array_view<double>(values)), apolo::runtime_error);
+    EXPECT_THROW(script.call("output", apolo::array_view<float>(floats)), apolo::runtime_error);
+    EXPECT_THROW(script.call("output", apolo::array_view<const double>(values)), apolo::runtime_error);
+    EXPECT_THROW(script.call("type"), apolo::runtime_error);
+    EXPECT_THROW(script.call("count"), apolo::runtime_error);
+    EXPECT_THROW(script.call("element"), apolo::runtime_error);
+}